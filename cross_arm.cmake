@@ -4,4 +4,6 @@ SET(CMAKE_LINKER arm-linux-gnueabihf-ld)
 SET(CMAKE_NM arm-linux-gnueabihf-nm)
 SET(CMAKE_OBJCOPY arm-linux-gnueabihf-objcopy)
 SET(CMAKE_OBJDUMP arm-linux-gnueabihf-objdump)
-SET(CMAKE_RANLIB arm-linux-gnueabihf-ranlib)
\ No newline at end of file
+SET(CMAKE_RANLIB arm-linux-gnueabihf-ranlib)
+# Enable NEON kernels of software renderer
+SET(CMAKE_C_FLAGS_INIT "-mfpu=neon")
@@ -0,0 +1,50 @@
+/*! \brief Monotonic clock
+    \file clock.h
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-08
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Every time value of program is nanoseconds of CLOCK_MONOTONIC, which never jumps on
+        wall clock adjustments. Kept in 64 bit integers, it neither loses precision over long
+        sessions like accumulated floating point time does.
+ */
+#pragma once
+#include <stdint.h>
+#include <time.h>
+
+#define CLOCK_NS_PER_US 1000ull
+#define CLOCK_NS_PER_MS 1000000ull
+#define CLOCK_NS_PER_SEC 1000000000ull
+
+//! Current time in nanoseconds.
+static inline uint64_t Clock_Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * CLOCK_NS_PER_SEC + ts.tv_nsec;
+}
+
+static inline uint64_t Clock_FromTimespec(struct timespec const *ts)
+{
+    return ts->tv_sec * CLOCK_NS_PER_SEC + ts->tv_nsec;
+}
+
+static inline struct timespec Clock_ToTimespec(uint64_t ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / CLOCK_NS_PER_SEC;
+    ts.tv_nsec = ns % CLOCK_NS_PER_SEC;
+    return ts;
+}
+
+static inline double Clock_ToSeconds(uint64_t ns)
+{
+    return ns * 1e-9;
+}
+
+static inline uint64_t Clock_FromSeconds(double sec)
+{
+    return (uint64_t)(sec * 1e9 + 0.5);
+}
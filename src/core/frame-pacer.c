@@ -0,0 +1,150 @@
+#include "frame-pacer.h"
+#include "clock.h"
+#include "common.h"
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+// Bounds of spin margin. Lower bound absorbs timer slack, upper bound caps wasted CPU.
+#define PACER_MIN_MARGIN_NS (50 * CLOCK_NS_PER_US)
+#define PACER_MAX_MARGIN_NS (2 * CLOCK_NS_PER_MS)
+#define PACER_MARGIN_SLACK_NS (20 * CLOCK_NS_PER_US)
+// Peak latency loses 1/64 of itself every frame, about half in 45 frames.
+#define PACER_PEAK_DECAY_SHIFT 6
+
+static inline void pacer_cpu_relax(void)
+{
+#if defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#elif defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause");
+#endif
+}
+
+static inline uint64_t pacer_thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return Clock_FromTimespec(&ts);
+}
+
+//! Sleep until given time, then return actual wake-up time.
+static uint64_t pacer_sleep_until(uint64_t until)
+{
+    struct timespec ts = Clock_ToTimespec(until);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+    return Clock_Now();
+}
+
+static void pacer_calibrate(FFramePacer *p, uint64_t LatencyNs)
+{
+    p->PeakLatencyNs -= p->PeakLatencyNs >> PACER_PEAK_DECAY_SHIFT;
+    if (LatencyNs > p->PeakLatencyNs)
+        p->PeakLatencyNs = LatencyNs;
+
+    uint64_t margin = p->PeakLatencyNs + PACER_MARGIN_SLACK_NS;
+    if (margin < PACER_MIN_MARGIN_NS)
+        margin = PACER_MIN_MARGIN_NS;
+    if (margin > PACER_MAX_MARGIN_NS)
+        margin = PACER_MAX_MARGIN_NS;
+    p->MarginNs = margin;
+}
+
+void FramePacer_Init(FFramePacer *p, uint64_t PeriodNs)
+{
+    memset(p, 0, sizeof *p);
+    p->PeriodNs = PeriodNs;
+    p->Deadline = Clock_Now();
+    p->MarginNs = PACER_MIN_MARGIN_NS;
+    FramePacer_ResetStats(p);
+}
+
+uint64_t FramePacer_Wait(FFramePacer *p)
+{
+    FFramePacerStats *st = &p->Stats;
+    uint64_t deadline = p->Deadline + p->PeriodNs;
+    uint64_t now = Clock_Now();
+
+    if (now > deadline + p->PeriodNs)
+    {
+        // Too late to catch up. Start over from now.
+        st->NumMissed++;
+        st->NumFrames++;
+        p->Deadline = now;
+        return now;
+    }
+
+    if (now + p->MarginNs < deadline)
+    {
+        uint64_t wake_at = deadline - p->MarginNs;
+        uint64_t woke = pacer_sleep_until(wake_at);
+
+        st->SleepNs += woke - now;
+        if (woke > deadline)
+            st->NumLateWakeups++;
+
+        pacer_calibrate(p, woke - wake_at);
+        now = woke;
+    }
+
+    uint64_t spin_begin = now;
+    while (now < deadline)
+    {
+        pacer_cpu_relax();
+        now = Clock_Now();
+    }
+    st->SpinNs += now - spin_begin;
+
+    uint64_t jitter = now - deadline;
+    st->NumFrames++;
+    st->TotalJitterNs += jitter;
+    st->SumJitterSqNs += (double)jitter * jitter;
+    if (jitter > st->MaxJitterNs)
+        st->MaxJitterNs = jitter;
+
+    p->Deadline = deadline;
+    return now;
+}
+
+void FramePacer_Resync(FFramePacer *p)
+{
+    p->Deadline = Clock_Now();
+}
+
+void FramePacer_GetStats(FFramePacer *p, FFramePacerStats *out)
+{
+    *out = p->Stats;
+    out->CpuNs = pacer_thread_cpu_ns() - p->StatsCpuBegin;
+    out->WallNs = Clock_Now() - p->StatsWallBegin;
+    out->MarginNs = p->MarginNs;
+}
+
+void FramePacer_ResetStats(FFramePacer *p)
+{
+    memset(&p->Stats, 0, sizeof p->Stats);
+    p->StatsWallBegin = Clock_Now();
+    p->StatsCpuBegin = pacer_thread_cpu_ns();
+}
+
+void FramePacer_DumpStats(FFramePacer *p)
+{
+    FFramePacerStats st;
+    FramePacer_GetStats(p, &st);
+
+    size_t n = st.NumFrames - st.NumMissed;
+    double mean = n ? (double)st.TotalJitterNs / n : 0.0;
+    double var = n ? st.SumJitterSqNs / n - mean * mean : 0.0;
+
+    lvlog(LOGLEVEL_INFO,
+          "Pacing stats: %zu frames at %.1f Hz, %zu missed, %zu late wake-ups\n"
+          "\tJitter: %.1f us mean, %.1f us stddev, %.1f us max\n"
+          "\tWait: %.1f%% sleeping, %.1f%% spinning, margin %.1f us\n"
+          "\tMain thread CPU: %.1f%%\n",
+          st.NumFrames, p->PeriodNs ? 1e9 / p->PeriodNs : 0.0, st.NumMissed, st.NumLateWakeups,
+          mean * 1e-3, sqrt(var > 0.0 ? var : 0.0) * 1e-3, st.MaxJitterNs * 1e-3,
+          st.WallNs ? 100.0 * st.SleepNs / st.WallNs : 0.0,
+          st.WallNs ? 100.0 * st.SpinNs / st.WallNs : 0.0,
+          st.MarginNs * 1e-3,
+          st.WallNs ? 100.0 * st.CpuNs / st.WallNs : 0.0);
+}
@@ -0,0 +1,77 @@
+/*! \brief Main loop pacing
+    \file frame-pacer.h
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-08
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Waits for each frame deadline by sleeping until shortly before it, then spinning for the rest.
+        Sleep alone wakes up late by scheduler latency, and spin alone burns a whole core.
+        Spin margin follows the worst recent wake-up latency, so it stays small on an idle system
+        and grows when wake-ups get late.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/*! \brief Pacing statistics. Accumulated since FramePacer_Init or last FramePacer_ResetStats. */
+typedef struct FramePacerStats
+{
+    //! Number of waits, and ones which found deadline already passed by over a period.
+    size_t NumFrames;
+    size_t NumMissed;
+    //! Sleeps which woke up after the deadline itself.
+    size_t NumLateWakeups;
+    //! Distance from deadline to return of wait.
+    uint64_t TotalJitterNs;
+    uint64_t MaxJitterNs;
+    double SumJitterSqNs;
+    //! Time spent sleeping and spinning in waits.
+    uint64_t SleepNs;
+    uint64_t SpinNs;
+    //! CPU time of waiting thread, and wall clock time, since stats reset.
+    uint64_t CpuNs;
+    uint64_t WallNs;
+    //! Current spin margin before deadline.
+    uint64_t MarginNs;
+} FFramePacerStats;
+
+typedef struct FramePacer
+{
+    uint64_t PeriodNs;
+    uint64_t Deadline;
+
+    // Spin margin is decaying peak of wake-up latency.
+    uint64_t MarginNs;
+    uint64_t PeakLatencyNs;
+
+    // Stats window begin
+    uint64_t StatsWallBegin;
+    uint64_t StatsCpuBegin;
+    FFramePacerStats Stats;
+} FFramePacer;
+
+/*! \brief Initialize pacer. First deadline is one period after now. */
+void FramePacer_Init(FFramePacer *p, uint64_t PeriodNs);
+
+/*! \brief Wait until next deadline.
+    \details Deadlines advance by period from previous one, so that frame rate doesn't drift.
+        If deadline has passed by more than a period, the pacer resynchronizes to now instead of
+        returning immediately several times to catch up.
+    \return Timestamp of return, on Clock_Now() clock.
+ */
+uint64_t FramePacer_Wait(FFramePacer *p);
+
+/*! \brief Restart deadlines from now, after the caller has been blocked elsewhere.
+    \details Next wait returns one period later, instead of counting a missed deadline.
+ */
+void FramePacer_Resync(FFramePacer *p);
+
+//! Copy statistics, with CPU and wall time up to now.
+void FramePacer_GetStats(FFramePacer *p, FFramePacerStats *out);
+
+void FramePacer_ResetStats(FFramePacer *p);
+
+//! Print pacing statistics to log.
+void FramePacer_DumpStats(FFramePacer *p);
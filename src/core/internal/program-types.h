@@ -11,14 +11,42 @@ struct ProgramInstance
 
     // Sound manageer handle.
     void *hSound;
+    float SoundLatency;
+    bool bFastWavResample;
 
     // Aspect ratio of screen. Used in translation.
     float AspectRatio;
 
-    // Resource management
+    // Resource management. Resources are stored in slots which never move, and
+    // indexed by open addressing hash table which holds slot index + 1, zero if empty.
+    // NumResource is number of slots ever used. Slots of unloaded resources are stacked on free list.
     struct Resource *arrResource;
     size_t NumResource;
     size_t NumMaxResource;
+    uint32_t *arrResourceIndex;
+    size_t ResourceIndexMask;
+    uint32_t *arrFreeResource;
+    size_t NumFreeResource;
+    pthread_mutex_t ResourceLock;
+
+    // Decoded bytes per resource type. Index RESOURCE_NONE holds total of every type.
+    size_t ResourceBytes[NUM_RESOURCE_TYPE];
+    size_t ResourceMemoryBudget;
+    size_t NumResourceEvicted;
+    size_t NumResourceReloaded;
+    // Compressed sources kept for lazily decoded images.
+    size_t ResourceSourceBytes;
+    // Atlas pages, which are counted to decoded bytes of images.
+    size_t ResourceAtlasBytes;
+
+    // Mapped resource pack. Entries are sorted by hash.
+    void *PackAddr;
+    size_t PackSize;
+    struct ResourcePackEntry const *arrPackEntry;
+    size_t NumPackEntry;
+
+    // Number of successful flips. Frame being queued is NumFlip + 1.
+    size_t NumFlip;
 
     // Double buffered draw arg pool
     int ActiveBufferIndex; // 0 or 1.
@@ -29,7 +57,7 @@ struct ProgramInstance
     // Camera tranform for next frame.
     FTransform2 PendingCameraTransform;
 
-    // Renderer status
+    // Renderer status. Written under RenderLock.
     int RendererStatus;
 
     // Rendering event memory pool. Double buffered.
@@ -48,14 +76,80 @@ struct ProgramInstance
     // Thread handle of rendering thread
     pthread_t ThreadHandle;
 
+    // Renderer sleeps on condition until flip switches active buffer, or shutdown.
+    // Game thread sleeps on same condition until renderer becomes idle.
+    pthread_mutex_t RenderLock;
+    pthread_cond_t RenderCond;
+
+    // Signature of draw calls queued on each buffer, and of frame on screen.
+    // Flip of a frame identical to the screen is skipped.
+    uint64_t FrameSignature[RENDERER_NUM_MAX_BUFFER];
+    uint64_t ScreenSignature;
+    bool bScreenValid;
+    bool bFrameStatic;
+
+    // Idle mode. Game thread blocks on eventfd, which is written by PInst_Wake.
+    int WakeFd;
+    size_t NumFlipSkipped;
+    size_t NumIdleWaits;
+    uint64_t IdleTimeNs;
+
     // Timer functionality
-    timer_logic_t Timer;
-    size_t TotalTimeMs;
-    double TotalTime;
+    timer_wheel_t Timer;
+
+    // Frame timestamps. Timer ticks in microseconds of same clock.
+    uint64_t FrameTime;
+    uint64_t PrevFrameTime;
+    // Timestamp of frame queued on each buffer, to measure latency on renderer.
+    uint64_t BufferFrameTime[RENDERER_NUM_MAX_BUFFER];
+
+    // Renderer statistics. Rendering thread accumulates them in working copy, and publishes
+    // the copy under RenderLock after each frame.
+    FRenderStats RenderStatsWork;
+    FRenderStats RenderStats;
+    // Number of frames renderer has finished, read by game thread without RenderLock.
+    size_t NumFramesRendered;
+
+    // Asynchronous resource loader. Jobs move from queue to done list, which is drained on game thread.
+    pthread_t *arrLoaderThread;
+    size_t NumLoaderThread;
+    pthread_mutex_t LoaderLock;
+    pthread_cond_t LoaderJobCond;
+    pthread_cond_t LoaderDoneCond;
+    struct AsyncLoadJob *LoaderQueueHead, *LoaderQueueTail;
+    // Jobs taken by loader threads and not finished yet, checked along with queue for duplicated request.
+    struct AsyncLoadJob *LoaderRunning;
+    struct AsyncLoadJob *LoaderDoneHead, *LoaderDoneTail;
+    size_t NumLoaderPending;
+    bool bLoaderShutdown;
 
     // Lock rendering
     bool bRenderingLock;
-    bool bEnableRendererYield;
+    bool bEnableVSync;
+
+    // Dynamic render scale
+    float TargetFrameTime;
+    float MinRenderScale;
+};
+
+/*! \brief Queued asynchronous resource load. */
+struct AsyncLoadJob
+{
+    struct AsyncLoadJob *Next;
+    struct ProgramInstance *PInst;
+    EResourceType Type;
+    FHash Hash;
+    LOADRESOURCE_FLAG_T Flag;
+    PInstLoadCallback Callback;
+    void *CallbackArg;
+
+    // Decoded data. NULL if failed, or skipped since resource already exists.
+    void *Data;
+    // Resource to decode data for, if this is a prefetch.
+    struct Resource *Target;
+    uint64_t DecodeTimeNs;
+    bool bDuplicate;
+    char Path[];
 };
 
 struct Resource
@@ -64,6 +158,32 @@ struct Resource
     uint32_t Hash;
     EResourceType Type;
     void *data;
+    // Increased whenever slot is assigned to a resource. Handles of previous resource are invalidated.
+    // Slot is retired instead of being reused once its generation reaches maximum, so it never wraps.
+    uint16_t Generation;
+
+    // Resource is evicted only when nobody holds reference, and renderer is done with it.
+    int32_t RefCount;
+    // Decoded size. Zero if data is not loaded, or resource is never evicted.
+    size_t Bytes;
+    // Last frame which has drawn or played this resource.
+    size_t LastUsedFrame;
+
+    // Source of data, to reload after eviction.
+    char *Path;
+    LOADRESOURCE_FLAG_T Flag;
+
+    // Compressed file contents of lazily decoded image. NULL if data is decoded from path.
+    void *Source;
+    size_t SourceBytes;
+    int32_t Width, Height;
+    // Prefetch is queued on loader threads. Game thread only.
+    bool bPrefetching;
+
+    // Size of file data came from, time spent on first load, and on last decode after that.
+    size_t FileBytes;
+    uint64_t LoadTimeNs;
+    uint64_t DecodeTimeNs;
 };
 
 /*! \brief Type of rendering event. */
@@ -0,0 +1,39 @@
+/*! \brief Raw image container format
+    \file raw-image.h
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-04
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Decoded image which can be mapped into memory and used directly, without any decoding.
+        Pixels are stored as premultiplied, native endian 32 bit values, same as cairo's image surface.
+        Converted from PNG files by png2pimg tool.
+ */
+#pragma once
+#include <stdint.h>
+
+#define RAW_IMAGE_MAGIC 0x474d4950u // "PIMG"
+#define RAW_IMAGE_VERSION 1
+#define RAW_IMAGE_EXTENSION ".pimg"
+
+//! Pixel formats of raw image. Values are same as cairo_format_t.
+enum ERawImageFormat
+{
+    RAW_IMAGE_ARGB32 = 0,
+    RAW_IMAGE_RGB24 = 1,
+};
+
+struct RawImageHeader
+{
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t Format;
+    uint32_t Width;
+    uint32_t Height;
+    // Distance between rows in bytes.
+    uint32_t Stride;
+    // Offset of first pixel from beginning of header. Aligned in 16 bytes.
+    uint32_t DataOffset;
+    uint32_t Reserved[2];
+};
@@ -0,0 +1,71 @@
+/*! \brief Resource pack container format
+    \file resource-pack.h
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-06
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Single file which holds every pre-decoded resource, built by respack tool.
+        Pack is mapped into memory once, and its resources are used in place.
+
+        Layout:
+            ResourcePackHeader
+            ResourcePackEntry[NumEntries], sorted by hash
+            Resource data, each aligned in 16 bytes from beginning of file
+ */
+#pragma once
+#include <stdint.h>
+
+#define RESOURCE_PACK_MAGIC 0x4b415052u // "RPAK"
+#define RESOURCE_PACK_VERSION 2
+
+//! Types of packed resource. Values are same as EResourceType.
+enum EResourcePackType
+{
+    RESOURCE_PACK_IMAGE = 2,
+    RESOURCE_PACK_WAV = 4,
+};
+
+struct ResourcePackHeader
+{
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t Reserved0;
+    uint32_t NumEntries;
+    // Offset of first entry from beginning of file.
+    uint32_t EntryOffset;
+    uint32_t Reserved[4];
+};
+
+/*! \brief djb2 hash of path in lower case, which identifies packed resource.
+    \details Letter case is ignored, as directories on disk don't always match case of paths game uses.
+ */
+static inline uint32_t resource_pack_hash(char const *Path)
+{
+    uint32_t hash = 5381;
+    int c;
+    while ((c = (unsigned char)*Path++))
+        hash = ((hash << 5) + hash) + (c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+    return hash;
+}
+
+struct ResourcePackEntry
+{
+    // Hash of resource path given to PInst_LoadResource, by resource_pack_hash.
+    uint32_t Hash;
+    uint32_t Type;
+    // Location of data from beginning of file.
+    uint64_t Offset;
+    uint64_t Size;
+};
+
+/*! \brief Wave data in pack. Followed by NumSamples mono 16 bit samples. */
+struct PackedWaveHeader
+{
+    uint32_t SampleRate;
+    uint32_t Reserved;
+    uint64_t NumSamples;
+};
+
+// Packed image data is a raw image, described in raw-image.h.
@@ -9,19 +9,72 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
 #include "program.h"
 #include "uEmbedded/algorithm.h"
 #include "internal/program-types.h"
+#include "internal/resource-pack.h"
 
 static TYPEID const PInstTypeID = {.TypeName = "ProgramInstance"};
 ASSIGN_TYPEID(UProgramInstance, PInstTypeID);
 
-static int resource_eval_func(void const *veval, void const *velem)
+//! Timers tick in microseconds of frame timestamp.
+static inline uint64_t pinst_timer_now(UProgramInstance const *s)
 {
-    int64_t a = (int64_t) * ((FHash *)veval);
-    int64_t b = (int64_t)((struct Resource *)velem)->Hash;
-    int64_t rmres = a - b;
-    return rmres > 0 ? 1 : rmres < 0 ? -1 : 0;
+    return s->FrameTime / CLOCK_NS_PER_US;
+}
+
+// FNV-1a, 64 bit
+#define PINST_SIGNATURE_BASIS 0xcbf29ce484222325ull
+#define PINST_SIGNATURE_PRIME 0x100000001b3ull
+
+static inline uint64_t pinst_sign(uint64_t h, void const *data, size_t size)
+{
+    for (unsigned char const *p = data, *end = p + size; p != end; ++p)
+        h = (h ^ *p) * PINST_SIGNATURE_PRIME;
+    return h;
+}
+
+/*! \brief Accumulate draw call into signature of frame being queued.
+    \details Resources are identified by address of their data, which changes on reload.
+ */
+static void pinst_sign_render_event(UProgramInstance *s, FRenderEventArg const *ev)
+{
+    uint64_t h = s->FrameSignature[s->ActiveBufferIndex];
+    FRenderEventData const *d = &ev->Data;
+
+    h = pinst_sign(h, &ev->Layer, sizeof ev->Layer);
+    h = pinst_sign(h, &ev->Type, sizeof ev->Type);
+    h = pinst_sign(h, &ev->Transform, sizeof ev->Transform);
+    switch (ev->Type)
+    {
+    case ERET_TEXT:
+        h = pinst_sign(h, &d->Text.Font->data, sizeof(void *));
+        h = pinst_sign(h, &d->Text.rgba, sizeof d->Text.rgba);
+        h = pinst_sign(h, &d->Text.Flags, sizeof d->Text.Flags);
+        h = pinst_sign(h, d->Text.Str, strlen(d->Text.Str));
+        break;
+    case ERET_POLY:
+        h = pinst_sign(h, &d->Poly.PolyLines->data, sizeof(void *));
+        h = pinst_sign(h, &d->Poly.rgba, sizeof d->Poly.rgba);
+        break;
+    case ERET_RECT:
+        h = pinst_sign(h, &d->Rect, sizeof d->Rect);
+        break;
+    case ERET_IMAGE:
+        h = pinst_sign(h, &d->Image.Image->data, sizeof(void *));
+        break;
+    default:
+        break;
+    }
+    s->FrameSignature[s->ActiveBufferIndex] = h;
 }
 
 static FRenderEventArg *pinst_new_renderevent_arg(UProgramInstance *s)
@@ -38,34 +91,213 @@ static inline int pinst_next_buff_idx(UProgramInstance const *s)
     return idx + idxAddVal[idx == (RENDERER_NUM_MAX_BUFFER - 1)];
 }
 
-static struct Resource *pinst_resource_find(UProgramInstance *s, FHash hash);
-static struct Resource *pinst_resource_new(UProgramInstance *s, FHash hash)
+//! First probe position of hash in resource index.
+static inline size_t pinst_resource_home(UProgramInstance const *s, FHash hash)
 {
-    uassert(s);
-    uassert(s->NumResource < s->NumMaxResource);
+    // Spread djb2 hashes, whose low bits are poorly distributed for similar paths.
+    uint32_t h = hash;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h & s->ResourceIndexMask;
+}
 
-    // Find place to insert
-    size_t idx = lowerbound(s->arrResource, &hash, sizeof(struct Resource), s->NumResource, resource_eval_func);
+/*! \brief Find resource by hash. Caller must hold resource lock. */
+static struct Resource *pinst_resource_find(UProgramInstance *s, FHash hash)
+{
+    // Index is never more than half full, thus probing always ends on empty entry.
+    for (size_t i = pinst_resource_home(s, hash);; i = (i + 1) & s->ResourceIndexMask)
+    {
+        uint32_t slot = s->arrResourceIndex[i];
+        if (slot == 0)
+            return NULL;
+        if (s->arrResource[slot - 1].Hash == hash)
+            return s->arrResource + slot - 1;
+    }
+}
 
-    // If any resource with same hash already exists ...
-    if (idx < s->NumResource && s->arrResource[idx].Hash == hash)
+/*! \brief Allocate slot for new resource. Caller must hold resource lock.
+    \return NULL if resource of same hash already exists, or there is no free slot.
+ */
+static struct Resource *pinst_resource_new(UProgramInstance *s, FHash hash)
+{
+    uassert(s);
+    if (s->NumResource == s->NumMaxResource && s->NumFreeResource == 0)
     {
-        lvlog(LOGLEVEL_INFO, "Trying allocate duplicated element ... \n");
+        lvlog(LOGLEVEL_ERROR, "Resource table is full. %zu resources are already loaded.\n", s->NumResource);
         return NULL;
     }
 
-    struct Resource *resource = array_insert(
-        s->arrResource,
-        NULL,
-        idx,
-        sizeof(struct Resource),
-        &s->NumResource);
+    size_t i = pinst_resource_home(s, hash);
+    for (; s->arrResourceIndex[i]; i = (i + 1) & s->ResourceIndexMask)
+    {
+        // If any resource with same hash already exists ...
+        if (s->arrResource[s->arrResourceIndex[i] - 1].Hash == hash)
+        {
+            lvlog(LOGLEVEL_INFO, "Trying allocate duplicated element ... \n");
+            return NULL;
+        }
+    }
 
+    // Slots never move, so resource pointers stay valid until the resource is unloaded.
+    size_t slot = s->NumFreeResource ? s->arrFreeResource[--s->NumFreeResource] : s->NumResource++;
+    struct Resource *resource = s->arrResource + slot;
     resource->Hash = hash;
+    resource->Type = RESOURCE_NONE;
+    resource->data = NULL;
+    resource->Generation++;
+    s->arrResourceIndex[i] = slot + 1;
 
     return resource;
 }
 
+/*! \brief Remove resource from index, and put its slot on free list. Caller must hold resource lock.
+    \details Entries after removed one are shifted back into the gap, so probing needs no tombstone.
+ */
+static void pinst_resource_delete(UProgramInstance *s, struct Resource *rs)
+{
+    size_t const mask = s->ResourceIndexMask;
+    uint32_t const slot = rs - s->arrResource;
+    size_t i = pinst_resource_home(s, rs->Hash);
+    while (s->arrResourceIndex[i] != slot + 1)
+        i = (i + 1) & mask;
+
+    // Entry can fill the gap if the gap lies between its home and its position.
+    for (size_t j = (i + 1) & mask; s->arrResourceIndex[j]; j = (j + 1) & mask)
+    {
+        size_t home = pinst_resource_home(s, s->arrResource[s->arrResourceIndex[j] - 1].Hash);
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            s->arrResourceIndex[i] = s->arrResourceIndex[j];
+            i = j;
+        }
+    }
+    s->arrResourceIndex[i] = 0;
+
+    rs->Type = RESOURCE_NONE;
+    rs->Hash = 0;
+    if (rs->Generation != UINT16_MAX)
+        s->arrFreeResource[s->NumFreeResource++] = slot;
+    else
+        lvlog(LOGLEVEL_INFO, "Resource slot %u is retired, as its generation is exhausted.\n", slot);
+}
+
+static size_t pinst_resource_bytes(EResourceType type, void const *data)
+{
+    if (data == NULL)
+        return 0;
+    if (type == RESOURCE_WAV)
+        return Internal_PInst_WavBytes(data);
+    return Internal_PInst_GraphicResourceBytes(type, data);
+}
+
+static void pinst_resource_free(EResourceType type, void *data)
+{
+    if (type == RESOURCE_WAV)
+        Internal_PInst_FreeWav(data);
+    else
+        Internal_PInst_FreeGraphicResource(type, data);
+}
+
+/*! \brief Set data of resource and update memory accounting. Caller must hold resource lock. */
+static void pinst_resource_set_data(UProgramInstance *s, struct Resource *rs, void *data, size_t bytes)
+{
+    s->ResourceBytes[rs->Type] -= rs->Bytes;
+    s->ResourceBytes[RESOURCE_NONE] -= rs->Bytes;
+    rs->data = data;
+    rs->Bytes = bytes;
+    s->ResourceBytes[rs->Type] += bytes;
+    s->ResourceBytes[RESOURCE_NONE] += bytes;
+}
+
+/*! \brief Add resource to table.
+    \param init Description of resource. Its path is copied.
+    \return Added resource. NULL if resource of same hash already exists, or table is full.
+ */
+static struct Resource *pinst_resource_add(UProgramInstance *s, FHash hash, struct Resource const *init)
+{
+    size_t bytes = pinst_resource_bytes(init->Type, init->data);
+    char *pathCopy = strdup(init->Path);
+
+    pthread_mutex_lock(&s->ResourceLock);
+    struct Resource *rs = pinst_resource_new(s, hash);
+    if (rs)
+    {
+        rs->Type = init->Type;
+        rs->RefCount = 0;
+        rs->LastUsedFrame = 0;
+        rs->Path = pathCopy;
+        rs->Flag = init->Flag;
+        rs->Source = init->Source;
+        rs->SourceBytes = init->SourceBytes;
+        rs->Width = init->Width;
+        rs->Height = init->Height;
+        rs->bPrefetching = false;
+        rs->FileBytes = init->FileBytes;
+        rs->LoadTimeNs = init->LoadTimeNs;
+        rs->DecodeTimeNs = 0;
+        s->ResourceSourceBytes += init->SourceBytes;
+        pinst_resource_set_data(s, rs, init->data, bytes);
+    }
+    pthread_mutex_unlock(&s->ResourceLock);
+
+    if (rs == NULL)
+        free(pathCopy);
+    return rs;
+}
+
+static int pinst_resource_lru_cmp(void const *va, void const *vb)
+{
+    struct Resource const *a = *(struct Resource *const *)va;
+    struct Resource const *b = *(struct Resource *const *)vb;
+    return (a->LastUsedFrame > b->LastUsedFrame) - (a->LastUsedFrame < b->LastUsedFrame);
+}
+
+//! Number of frames renderer has finished.
+static size_t pinst_num_rendered(UProgramInstance *s)
+{
+    return __atomic_load_n(&s->NumFramesRendered, __ATOMIC_ACQUIRE);
+}
+
+/*! \brief Evict least recently used resources without reference, until decoded resources fit in budget.
+    \details Called on game thread only, which is the only thread that evicts or reloads data of existing resource.
+ */
+static void pinst_resource_trim(UProgramInstance *s)
+{
+    if (s->ResourceMemoryBudget == 0 || s->ResourceBytes[RESOURCE_NONE] <= s->ResourceMemoryBudget)
+        return;
+
+    // Resources used by frames which are not rendered yet must be kept.
+    size_t numRendered = pinst_num_rendered(s);
+
+    pthread_mutex_lock(&s->ResourceLock);
+    struct Resource **victims = malloc(s->NumResource * sizeof(struct Resource *));
+    size_t num = 0;
+    for (size_t i = 0; i < s->NumResource; i++)
+    {
+        struct Resource *rs = s->arrResource + i;
+        if (rs->data == NULL || rs->Bytes == 0 || rs->RefCount > 0 || rs->LastUsedFrame > numRendered)
+            continue;
+        if (rs->Type == RESOURCE_WAV && Internal_PInst_IsWavPlaying(s->hSound, rs->data))
+            continue;
+        victims[num++] = rs;
+    }
+    qsort(victims, num, sizeof(struct Resource *), pinst_resource_lru_cmp);
+
+    for (size_t i = 0; i < num && s->ResourceBytes[RESOURCE_NONE] > s->ResourceMemoryBudget; i++)
+    {
+        struct Resource *rs = victims[i];
+        lvlog(LOGLEVEL_DISPLAY, "Evicting %s, %zu bytes ... \n", rs->Path, rs->Bytes);
+        pinst_resource_free(rs->Type, rs->data);
+        pinst_resource_set_data(s, rs, NULL, 0);
+        s->NumResourceEvicted++;
+    }
+    pthread_mutex_unlock(&s->ResourceLock);
+    free(victims);
+}
+
 float *PInst_AspectRatio(struct ProgramInstance *s)
 {
     return &s->AspectRatio;
@@ -76,66 +308,777 @@ void PInst_SetCameraTransform(struct ProgramInstance *s, FTransform2 const *v)
     s->PendingCameraTransform = *v;
 }
 
-EStatus PInst_LoadResource(struct ProgramInstance *PInst, EResourceType Type, FHash Hash, char const *Path, LOADRESOURCE_FLAG_T Flag, UResource **out)
+/*! \brief Find entry of resource pack by path. Returns NULL if no pack is mounted, or pack doesn't have it. */
+static struct ResourcePackEntry const *pinst_pack_find(UProgramInstance const *s, char const *Path)
 {
-    UResource *rs = NULL;
-    EStatus result;
-    rs = pinst_resource_find(PInst, Hash);
+    if (s->NumPackEntry == 0 || Path == NULL)
+        return NULL;
 
-    if (rs)
+    uint32_t Hash = resource_pack_hash(Path);
+    size_t lo = 0, hi = s->NumPackEntry;
+    while (lo < hi)
     {
-        result = STATUS_RESOURCE_ALREADY_EXIST;
-        goto END;
+        size_t mid = (lo + hi) / 2;
+        if (s->arrPackEntry[mid].Hash < Hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < s->NumPackEntry && s->arrPackEntry[lo].Hash == Hash ? s->arrPackEntry + lo : NULL;
+}
+
+EStatus PInst_MountResourcePack(struct ProgramInstance *PInst, char const *Path)
+{
+    int fd = open(Path, O_RDONLY);
+    if (fd == -1)
+    {
+        lvlog(LOGLEVEL_INFO, "No resource pack on %s. Resources are loaded from files.\n", Path);
+        return ERROR_INVALID_RESOURCE_PATH;
+    }
+
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= sizeof(struct ResourcePackHeader))
+        addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED)
+        return ERROR_INVALID_RESOURCE_PATH;
+
+    struct ResourcePackHeader const *h = addr;
+    bool bValid =
+        h->Magic == RESOURCE_PACK_MAGIC &&
+        h->Version == RESOURCE_PACK_VERSION &&
+        h->EntryOffset + (uint64_t)h->NumEntries * sizeof(struct ResourcePackEntry) <= (uint64_t)st.st_size;
+
+    struct ResourcePackEntry const *entries = (void *)((char *)addr + h->EntryOffset);
+    for (size_t i = 0; bValid && i < h->NumEntries; i++)
+    {
+        bValid = entries[i].Offset % 16 == 0 &&
+                 entries[i].Offset + entries[i].Size <= (uint64_t)st.st_size &&
+                 (i == 0 || entries[i - 1].Hash < entries[i].Hash);
+    }
+
+    if (bValid == false)
+    {
+        lvlog(LOGLEVEL_WARNING, "%s is not a valid resource pack\n", Path);
+        munmap(addr, st.st_size);
+        return ERROR_INVALID_RESOURCE_PATH;
+    }
+
+    // Resources loaded from previous pack may still refer it.
+    if (PInst->PackAddr)
+    {
+        lvlog(LOGLEVEL_WARNING, "Resource pack is already mounted. %s is ignored.\n", Path);
+        munmap(addr, st.st_size);
+        return ERROR_FAILED;
+    }
+
+    PInst->PackAddr = addr;
+    PInst->PackSize = st.st_size;
+    PInst->arrPackEntry = entries;
+    PInst->NumPackEntry = h->NumEntries;
+
+    lvlog(LOGLEVEL_INFO, "Mounted resource pack %s, %u resources in %zu KiB\n", Path, h->NumEntries, (size_t)(st.st_size >> 10));
+    return STATUS_OK;
+}
+
+static void *pinst_resource_decode(UProgramInstance *s, EResourceType Type, char const *Path, LOADRESOURCE_FLAG_T Flag)
+{
+    // Pre-decoded resource in pack is used in place.
+    struct ResourcePackEntry const *e = pinst_pack_find(s, Path);
+    if (e && e->Type == Type)
+    {
+        void *packed = (char *)s->PackAddr + e->Offset;
+        void *data = Type == RESOURCE_IMAGE ? Internal_PInst_MapImage(s, packed, e->Size)
+                   : Type == RESOURCE_WAV   ? Internal_PInst_MapWav(s, packed, e->Size)
+                                            : NULL;
+        if (data)
+            return data;
+        lvlog(LOGLEVEL_WARNING, "Packed resource for %s is not usable. Loading from file ...\n", Path);
     }
 
-    void *data;
     switch (Type)
     {
     case RESOURCE_IMAGE:
-        data = Internal_PInst_LoadImgInternal(PInst, Path);
-        break;
+        return Internal_PInst_LoadImgInternal(s, Path);
     case RESOURCE_FONT:
-        data = Internal_PInst_LoadFont(PInst, Path, Flag);
-        break;
+        return Internal_PInst_LoadFont(s, Path, Flag);
     case RESOURCE_WAV:
-        data = Internal_PInst_LoadWav(PInst, Path);
-        break;
+        return Internal_PInst_LoadWav(s, Path);
+    case RESOURCE_LINEVECTOR:
+        return Internal_PInst_LoadVector(s, Path);
     default:
         lvlog(LOGLEVEL_WARNING, "That type of resource is not defined ! \n");
-        data = NULL;
-        break;
+        return NULL;
+    }
+}
+
+//! Size of file in bytes. Zero if it's not a file, e.g. name of font.
+static size_t pinst_file_size(char const *Path)
+{
+    struct stat st;
+    return stat(Path, &st) == 0 && S_ISREG(st.st_mode) ? st.st_size : 0;
+}
+
+//! Read whole file into memory.
+static void *pinst_read_file(char const *Path, size_t *Size)
+{
+    FILE *fp = fopen(Path, "rb");
+    if (fp == NULL)
+        return NULL;
+
+    void *buf = NULL;
+    long len;
+    if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0)
+    {
+        buf = malloc(len);
+        if (buf && fread(buf, len, 1, fp) != 1)
+        {
+            free(buf);
+            buf = NULL;
+        }
+        *Size = len;
+    }
+    fclose(fp);
+    return buf;
+}
+
+/*! \brief Decode resource, or only read its source and dimensions if it's a lazy image, then add it to table.
+    \param Result ERROR_INVALID_RESOURCE_PATH if resource could not be read, ERROR_FAILED if it could not be added.
+    \return Added resource. NULL if failed.
+ */
+static struct Resource *pinst_resource_create(UProgramInstance *s, EResourceType Type, FHash Hash, char const *Path, LOADRESOURCE_FLAG_T Flag, EStatus *Result)
+{
+    struct Resource init = {.Type = Type, .Path = (char *)Path, .Flag = Flag};
+    struct ResourcePackEntry const *e = pinst_pack_find(s, Path);
+    bool bPacked = e && e->Type == Type;
+    bool bValid;
+    uint64_t begin = Clock_Now();
+
+    if ((Flag & LOADRESOURCE_FLAG_LAZY) && Type == RESOURCE_IMAGE)
+    {
+        // Packed image is used in place, thus only compressed file needs to stay resident.
+        if (bPacked)
+        {
+            bValid = Internal_PInst_ProbeImage((char *)s->PackAddr + e->Offset, e->Size, &init.Width, &init.Height);
+        }
+        else
+        {
+            init.Source = pinst_read_file(Path, &init.SourceBytes);
+            bValid = init.Source && Internal_PInst_ProbeImage(init.Source, init.SourceBytes, &init.Width, &init.Height);
+        }
+    }
+    else
+    {
+        init.data = pinst_resource_decode(s, Type, Path, Flag);
+        if ((bValid = init.data != NULL) && Type == RESOURCE_IMAGE)
+            Internal_PInst_GetImageSize(init.data, &init.Width, &init.Height);
     }
 
+    if (bValid == false)
+    {
+        free(init.Source);
+        *Result = ERROR_INVALID_RESOURCE_PATH;
+        return NULL;
+    }
+
+    init.LoadTimeNs = Clock_Now() - begin;
+    if (bPacked)
+        init.FileBytes = e->Size;
+    else if (init.Source)
+        init.FileBytes = init.SourceBytes;
+    else
+        init.FileBytes = pinst_file_size(Path);
+
+    struct Resource *rs = pinst_resource_add(s, Hash, &init);
+    if (rs == NULL)
+    {
+        lvlog(LOGLEVEL_WARNING, "Could not add %s. Loaded data is discarded.\n", Path);
+        if (init.data)
+            pinst_resource_free(Type, init.data);
+        free(init.Source);
+        *Result = ERROR_FAILED;
+        return NULL;
+    }
+
+    lvlog(LOGLEVEL_DISPLAY, "%s data %p for path %s ... \n", init.data ? "Loading" : "Registering", init.data, Path);
+    *Result = STATUS_OK;
+    return rs;
+}
+
+/*! \brief Decode data of resource which is not loaded yet, or has been evicted. */
+static void *pinst_resource_redecode(UProgramInstance *s, struct Resource const *rs)
+{
+    if (rs->Source)
+        return Internal_PInst_DecodeImage(s, rs->Source, rs->SourceBytes);
+    return pinst_resource_decode(s, rs->Type, rs->Path, rs->Flag);
+}
+
+/*! \brief Mark resource as used by frame being queued. Data which is not loaded yet is decoded.
+    \return false if data could not be decoded.
+ */
+static bool pinst_resource_use(UProgramInstance *s, struct Resource *rs)
+{
+    rs->LastUsedFrame = s->NumFlip + 1;
+    if (rs->data)
+        return true;
+
+    uint64_t begin = Clock_Now();
+    void *data = pinst_resource_redecode(s, rs);
     if (data == NULL)
     {
-        result = ERROR_INVALID_RESOURCE_PATH;
+        lvlog(LOGLEVEL_WARNING, "Failed to decode %s\n", rs->Path);
+        return false;
+    }
+
+    size_t bytes = pinst_resource_bytes(rs->Type, data);
+    pthread_mutex_lock(&s->ResourceLock);
+    rs->DecodeTimeNs = Clock_Now() - begin;
+    pinst_resource_set_data(s, rs, data, bytes);
+    s->NumResourceReloaded++;
+    pthread_mutex_unlock(&s->ResourceLock);
+    return true;
+}
+
+EStatus PInst_LoadResource(struct ProgramInstance *PInst, EResourceType Type, FHash Hash, char const *Path, LOADRESOURCE_FLAG_T Flag, UResource **out)
+{
+    UResource *rs = NULL;
+    EStatus result;
+    rs = PInst_GetResource(PInst, Hash);
+
+    if (rs)
+    {
+        result = STATUS_RESOURCE_ALREADY_EXIST;
         goto END;
     }
 
-    rs = pinst_resource_new(PInst, Hash);
-    uassert(rs);
-    rs->Type = RESOURCE_IMAGE;
-    rs->data = data;
-    lvlog(LOGLEVEL_DISPLAY, "Loading data %p for path %s ... \n", data, Path);
-    result = STATUS_OK;
+    rs = pinst_resource_create(PInst, Type, Hash, Path, Flag, &result);
+    if (rs == NULL && result == ERROR_FAILED)
+    {
+        // Loader thread may have added same resource meanwhile.
+        rs = PInst_GetResource(PInst, Hash);
+        result = rs ? STATUS_RESOURCE_ALREADY_EXIST : ERROR_FAILED;
+    }
+
 END:;
+    if (rs)
+    {
+        pthread_mutex_lock(&PInst->ResourceLock);
+        rs->RefCount++;
+        pthread_mutex_unlock(&PInst->ResourceLock);
+        pinst_resource_trim(PInst);
+    }
+
     if (out)
         *out = rs;
     return result;
 }
 
-static struct Resource *pinst_resource_find(UProgramInstance *s, FHash hash)
+void PInst_ForEachResource(struct ProgramInstance *PInst, PInstResourceVisitor Visitor, void *VisitorArg)
 {
-    size_t idx = lowerbound(s->arrResource, &hash, sizeof(struct Resource), s->NumResource, resource_eval_func);
-    if (idx > s->NumResource)
-        return NULL;
-    struct Resource *ret = s->arrResource + idx;
-    return ret->Hash == hash ? ret : NULL;
+    // Visitor runs on snapshot, thus it can call any resource API.
+    pthread_mutex_lock(&PInst->ResourceLock);
+    size_t num = 0;
+    FResourceInfo *infos = malloc(PInst->NumResource * sizeof(FResourceInfo) + 1);
+    for (size_t i = 0; i < PInst->NumResource; i++)
+    {
+        // Free slot
+        struct Resource const *rs = PInst->arrResource + i;
+        if (rs->Type == RESOURCE_NONE)
+            continue;
+
+        FResourceInfo *v = infos + num++;
+        v->Resource = PInst->arrResource + i;
+        v->Hash = rs->Hash;
+        v->Type = rs->Type;
+        v->Path = rs->Path;
+        v->bDecoded = rs->data != NULL;
+        v->Bytes = rs->Bytes;
+        v->SourceBytes = rs->SourceBytes;
+        v->FileBytes = rs->FileBytes;
+        v->LoadTimeNs = rs->LoadTimeNs;
+        v->DecodeTimeNs = rs->DecodeTimeNs;
+        v->LastUsedFrame = rs->LastUsedFrame;
+        v->RefCount = rs->RefCount;
+    }
+    pthread_mutex_unlock(&PInst->ResourceLock);
+
+    for (size_t i = 0; i < num; i++)
+        Visitor(VisitorArg, infos + i);
+    free(infos);
+}
+
+// Number of entries of each ranking in resource dump.
+#define RESOURCE_DUMP_NUM_TOP 5
+
+typedef struct resource_dump
+{
+    size_t Count[NUM_RESOURCE_TYPE];
+    size_t NumDecoded[NUM_RESOURCE_TYPE];
+    size_t Bytes[NUM_RESOURCE_TYPE];
+    size_t FileBytes[NUM_RESOURCE_TYPE];
+    uint64_t LoadTimeNs[NUM_RESOURCE_TYPE];
+
+    // Largest decoded size and slowest loads, in descending order.
+    FResourceInfo Largest[RESOURCE_DUMP_NUM_TOP];
+    FResourceInfo Slowest[RESOURCE_DUMP_NUM_TOP];
+    size_t NumLargest, NumSlowest;
+} resource_dump_t;
+
+static uint64_t resource_dump_size_key(FResourceInfo const *v)
+{
+    return v->Bytes ? v->Bytes : v->SourceBytes;
+}
+
+static uint64_t resource_dump_time_key(FResourceInfo const *v)
+{
+    return v->LoadTimeNs + v->DecodeTimeNs;
+}
+
+//! Insert into descending top list.
+static void resource_dump_rank(FResourceInfo *list, size_t *num, FResourceInfo const *v, uint64_t (*key)(FResourceInfo const *))
+{
+    size_t i = *num < RESOURCE_DUMP_NUM_TOP ? (*num)++ : RESOURCE_DUMP_NUM_TOP;
+    for (; i > 0 && key(list + i - 1) < key(v); i--)
+    {
+        if (i < RESOURCE_DUMP_NUM_TOP)
+            list[i] = list[i - 1];
+    }
+    if (i < RESOURCE_DUMP_NUM_TOP)
+        list[i] = *v;
+}
+
+static void resource_dump_visit(void *VDump, FResourceInfo const *v)
+{
+    resource_dump_t *d = VDump;
+    EResourceType type = v->Type < NUM_RESOURCE_TYPE ? v->Type : RESOURCE_NONE;
+    d->Count[type]++;
+    d->NumDecoded[type] += v->bDecoded;
+    d->Bytes[type] += v->Bytes;
+    d->FileBytes[type] += v->FileBytes;
+    d->LoadTimeNs[type] += v->LoadTimeNs + v->DecodeTimeNs;
+
+    resource_dump_rank(d->Largest, &d->NumLargest, v, resource_dump_size_key);
+    resource_dump_rank(d->Slowest, &d->NumSlowest, v, resource_dump_time_key);
+}
+
+void PInst_DumpResources(struct ProgramInstance *PInst)
+{
+    static char const *const typeNames[NUM_RESOURCE_TYPE] = {"none", "vector", "image", "font", "wave"};
+    resource_dump_t d;
+    memset(&d, 0, sizeof(d));
+    PInst_ForEachResource(PInst, resource_dump_visit, &d);
+
+    size_t numLoaded = 0;
+    for (EResourceType t = RESOURCE_NONE + 1; t < NUM_RESOURCE_TYPE; t++)
+        numLoaded += d.Count[t];
+
+    lvlog(LOGLEVEL_INFO, "Resources: %zu loaded, %zu KiB decoded including %zu KiB of atlas pages, %zu KiB compressed\n",
+          numLoaded, PInst->ResourceBytes[RESOURCE_NONE] >> 10, PInst->ResourceAtlasBytes >> 10, PInst->ResourceSourceBytes >> 10);
+    for (EResourceType t = RESOURCE_NONE + 1; t < NUM_RESOURCE_TYPE; t++)
+    {
+        if (d.Count[t] == 0)
+            continue;
+        lvlog(LOGLEVEL_INFO, "\t%-6s: %zu (%zu decoded), %zu KiB decoded from %zu KiB of files, %.1f ms to load\n",
+              typeNames[t], d.Count[t], d.NumDecoded[t], d.Bytes[t] >> 10, d.FileBytes[t] >> 10, d.LoadTimeNs[t] * 1e-6);
+    }
+
+    lvlog(LOGLEVEL_INFO, "\tLargest:\n");
+    for (size_t i = 0; i < d.NumLargest; i++)
+    {
+        lvlog(LOGLEVEL_INFO, "\t\t%8zu KiB (file %zu KiB) %s\n",
+              (size_t)(resource_dump_size_key(d.Largest + i) >> 10), d.Largest[i].FileBytes >> 10, d.Largest[i].Path);
+    }
+
+    lvlog(LOGLEVEL_INFO, "\tSlowest:\n");
+    for (size_t i = 0; i < d.NumSlowest; i++)
+    {
+        lvlog(LOGLEVEL_INFO, "\t\t%8.2f ms (last used on frame %zu) %s\n",
+              resource_dump_time_key(d.Slowest + i) * 1e-6, d.Slowest[i].LastUsedFrame, d.Slowest[i].Path);
+    }
+}
+
+void PInst_ReleaseResource(struct ProgramInstance *PInst, UResource *Resource)
+{
+    if (Resource == NULL)
+        return;
+
+    pthread_mutex_lock(&PInst->ResourceLock);
+    uassert(Resource->RefCount > 0);
+    Resource->RefCount--;
+    pthread_mutex_unlock(&PInst->ResourceLock);
+
+    pinst_resource_trim(PInst);
+}
+
+size_t PInst_GetResourceBytes(struct ProgramInstance *PInst, EResourceType Type)
+{
+    uassert(Type < NUM_RESOURCE_TYPE);
+    pthread_mutex_lock(&PInst->ResourceLock);
+    size_t bytes = PInst->ResourceBytes[Type];
+    pthread_mutex_unlock(&PInst->ResourceLock);
+    return bytes;
 }
 
 struct Resource *PInst_GetResource(struct ProgramInstance *PInst, FHash Hash)
 {
-    return pinst_resource_find(PInst, Hash);
+    pthread_mutex_lock(&PInst->ResourceLock);
+    struct Resource *rs = pinst_resource_find(PInst, Hash);
+    pthread_mutex_unlock(&PInst->ResourceLock);
+    return rs;
+}
+
+FResourceHandle PInst_GetResourceHandle(struct ProgramInstance *PInst, UResource const *Resource)
+{
+    if (Resource == NULL)
+        return 0;
+
+    pthread_mutex_lock(&PInst->ResourceLock);
+    FResourceHandle handle = (FResourceHandle)Resource->Generation << 16 | (FResourceHandle)(Resource - PInst->arrResource);
+    pthread_mutex_unlock(&PInst->ResourceLock);
+    return handle;
+}
+
+UResource *PInst_ResolveResource(struct ProgramInstance *PInst, FResourceHandle Handle)
+{
+    size_t slot = Handle & 0xffff;
+
+    // Loader threads assign slots concurrently.
+    pthread_mutex_lock(&PInst->ResourceLock);
+    struct Resource *rs = slot < PInst->NumResource ? PInst->arrResource + slot : NULL;
+    if (rs && (rs->Generation != Handle >> 16 || rs->Type == RESOURCE_NONE))
+        rs = NULL;
+    pthread_mutex_unlock(&PInst->ResourceLock);
+    return rs;
+}
+
+EStatus PInst_UnloadResource(struct ProgramInstance *PInst, UResource *Resource)
+{
+    if (Resource == NULL)
+        return ERROR_FAILED;
+
+    // Same conditions as eviction, and prefetch must not be decoding into the slot.
+    size_t numRendered = pinst_num_rendered(PInst);
+    pthread_mutex_lock(&PInst->ResourceLock);
+    struct Resource *rs = Resource;
+    bool bBusy = rs->RefCount > 0 || rs->LastUsedFrame > numRendered || rs->bPrefetching ||
+                 (rs->Type == RESOURCE_WAV && rs->data && Internal_PInst_IsWavPlaying(PInst->hSound, rs->data));
+    if (rs->Type == RESOURCE_NONE || bBusy)
+    {
+        pthread_mutex_unlock(&PInst->ResourceLock);
+        return ERROR_FAILED;
+    }
+
+    if (rs->data)
+        pinst_resource_free(rs->Type, rs->data);
+    pinst_resource_set_data(PInst, rs, NULL, 0);
+    PInst->ResourceSourceBytes -= rs->SourceBytes;
+    free(rs->Source);
+    free(rs->Path);
+    rs->Source = NULL;
+    rs->SourceBytes = 0;
+    rs->Path = NULL;
+    pinst_resource_delete(PInst, rs);
+    pthread_mutex_unlock(&PInst->ResourceLock);
+    return STATUS_OK;
+}
+
+size_t PInst_BuildImageAtlas(struct ProgramInstance *PInst)
+{
+    pthread_mutex_lock(&PInst->ResourceLock);
+    struct Resource **images = malloc(PInst->NumResource * sizeof(struct Resource *));
+    size_t num = 0;
+    for (size_t i = 0; i < PInst->NumResource; i++)
+    {
+        if (PInst->arrResource[i].Type == RESOURCE_IMAGE && PInst->arrResource[i].data)
+            images[num++] = PInst->arrResource + i;
+    }
+    pthread_mutex_unlock(&PInst->ResourceLock);
+
+    // Renderer may be reading image descriptors. No frame begins until next flip.
+    PInst_WaitRendererIdle(PInst);
+
+    size_t pageBytes = 0;
+    size_t numPages = num ? Internal_PInst_BuildImageAtlas(PInst, images, num, &pageBytes) : 0;
+
+    // Packed images are pinned by their atlas page, which is counted in their place. Pages are
+    // released along with their last image only, thus they stay counted.
+    pthread_mutex_lock(&PInst->ResourceLock);
+    for (size_t i = 0; i < num; i++)
+        pinst_resource_set_data(PInst, images[i], images[i]->data, pinst_resource_bytes(RESOURCE_IMAGE, images[i]->data));
+    PInst->ResourceBytes[RESOURCE_IMAGE] += pageBytes;
+    PInst->ResourceBytes[RESOURCE_NONE] += pageBytes;
+    PInst->ResourceAtlasBytes += pageBytes;
+    pthread_mutex_unlock(&PInst->ResourceLock);
+    free(images);
+    return numPages;
+}
+
+static void *LoaderThread(void *VPInst)
+{
+    UProgramInstance *s = VPInst;
+    pthread_mutex_lock(&s->LoaderLock);
+
+    for (;;)
+    {
+        while (s->LoaderQueueHead == NULL && s->bLoaderShutdown == false)
+            pthread_cond_wait(&s->LoaderJobCond, &s->LoaderLock);
+        if (s->LoaderQueueHead == NULL)
+            break;
+
+        struct AsyncLoadJob *job = s->LoaderQueueHead;
+        s->LoaderQueueHead = job->Next;
+        if (s->LoaderQueueHead == NULL)
+            s->LoaderQueueTail = NULL;
+        job->Next = s->LoaderRunning;
+        s->LoaderRunning = job;
+        pthread_mutex_unlock(&s->LoaderLock);
+
+        // Prefetch decodes data of existing resource, which is installed on game thread.
+        EStatus result;
+        uint64_t begin = Clock_Now();
+        if (job->Target)
+            job->Data = pinst_resource_redecode(s, job->Target);
+        else if (pinst_resource_create(s, job->Type, job->Hash, job->Path, job->Flag, &result) == NULL && result == ERROR_INVALID_RESOURCE_PATH)
+            lvlog(LOGLEVEL_WARNING, "Failed to load %s asynchronously\n", job->Path);
+        job->DecodeTimeNs = Clock_Now() - begin;
+
+        pthread_mutex_lock(&s->LoaderLock);
+        struct AsyncLoadJob **link = &s->LoaderRunning;
+        while (*link != job)
+            link = &(*link)->Next;
+        *link = job->Next;
+
+        job->Next = NULL;
+        if (s->LoaderDoneTail)
+            s->LoaderDoneTail->Next = job;
+        else
+            s->LoaderDoneHead = job;
+        s->LoaderDoneTail = job;
+        s->NumLoaderPending--;
+        pthread_cond_broadcast(&s->LoaderDoneCond);
+        PInst_Wake(s);
+    }
+
+    pthread_mutex_unlock(&s->LoaderLock);
+    return NULL;
+}
+
+static void pinst_loader_init(UProgramInstance *s, size_t NumThreads)
+{
+    if (NumThreads == 0)
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        NumThreads = n > 0 ? n : 1;
+    }
+
+    pthread_mutex_init(&s->LoaderLock, NULL);
+    pthread_cond_init(&s->LoaderJobCond, NULL);
+    pthread_cond_init(&s->LoaderDoneCond, NULL);
+    s->arrLoaderThread = malloc(sizeof(pthread_t) * NumThreads);
+    for (; s->NumLoaderThread < NumThreads; s->NumLoaderThread++)
+        pthread_create(s->arrLoaderThread + s->NumLoaderThread, NULL, LoaderThread, s);
+
+    lvlog(LOGLEVEL_INFO, "%zu resource loader threads are running.\n", NumThreads);
+}
+
+static void pinst_loader_deinit(UProgramInstance *s)
+{
+    // Loaders finish queued jobs first.
+    pthread_mutex_lock(&s->LoaderLock);
+    s->bLoaderShutdown = true;
+    pthread_cond_broadcast(&s->LoaderJobCond);
+    pthread_mutex_unlock(&s->LoaderLock);
+
+    for (size_t i = 0; i < s->NumLoaderThread; i++)
+        pthread_join(s->arrLoaderThread[i], NULL);
+    free(s->arrLoaderThread);
+
+    for (struct AsyncLoadJob *job = s->LoaderDoneHead, *next; job; job = next)
+    {
+        next = job->Next;
+        if (job->Target && job->Data)
+            pinst_resource_free(job->Type, job->Data);
+        free(job);
+    }
+
+    pthread_cond_destroy(&s->LoaderDoneCond);
+    pthread_cond_destroy(&s->LoaderJobCond);
+    pthread_mutex_destroy(&s->LoaderLock);
+}
+
+//! Timer callback which reports finished job.
+static void pinst_loader_report(void *VJob)
+{
+    struct AsyncLoadJob *job = VJob;
+    UProgramInstance *s = job->PInst;
+
+    pthread_mutex_lock(&s->ResourceLock);
+    struct Resource *rs = pinst_resource_find(s, job->Hash);
+    if (rs)
+        rs->RefCount++;
+    pthread_mutex_unlock(&s->ResourceLock);
+
+    if (job->Callback)
+        job->Callback(job->CallbackArg, rs);
+    free(job);
+}
+
+/*! \brief Install data decoded by prefetch, unless it has been decoded on game thread meanwhile. */
+static void pinst_prefetch_install(UProgramInstance *s, struct AsyncLoadJob *job)
+{
+    struct Resource *rs = job->Target;
+    rs->bPrefetching = false;
+
+    if (job->Data && rs->data == NULL)
+    {
+        size_t bytes = pinst_resource_bytes(rs->Type, job->Data);
+        pthread_mutex_lock(&s->ResourceLock);
+        rs->DecodeTimeNs = job->DecodeTimeNs;
+        pinst_resource_set_data(s, rs, job->Data, bytes);
+        s->NumResourceReloaded++;
+        pthread_mutex_unlock(&s->ResourceLock);
+    }
+    else if (job->Data)
+    {
+        pinst_resource_free(rs->Type, job->Data);
+    }
+    free(job);
+}
+
+/*! \brief Queue callbacks of finished loads. */
+static void pinst_loader_drain(UProgramInstance *s)
+{
+    pthread_mutex_lock(&s->LoaderLock);
+    struct AsyncLoadJob *list = s->LoaderDoneHead;
+    s->LoaderDoneHead = s->LoaderDoneTail = NULL;
+    size_t numPending = s->NumLoaderPending;
+    pthread_mutex_unlock(&s->LoaderLock);
+
+    // Duplicated request is held back while the job loading its resource is in progress.
+    struct AsyncLoadJob *deferred = NULL, *deferredLast = NULL;
+    for (struct AsyncLoadJob *job = list, *next; job; job = next)
+    {
+        next = job->Next;
+        job->Next = NULL;
+
+        if (job->Target)
+        {
+            pinst_prefetch_install(s, job);
+            continue;
+        }
+
+        if (job->bDuplicate && numPending && PInst_GetResource(s, job->Hash) == NULL)
+        {
+            if (deferredLast)
+                deferredLast->Next = job;
+            else
+                deferred = job;
+            deferredLast = job;
+            continue;
+        }
+        timer_wheel_add(&s->Timer, pinst_timer_now(s), pinst_loader_report, job);
+    }
+
+    if (deferred)
+    {
+        pthread_mutex_lock(&s->LoaderLock);
+        deferredLast->Next = s->LoaderDoneHead;
+        if (s->LoaderDoneHead == NULL)
+            s->LoaderDoneTail = deferredLast;
+        s->LoaderDoneHead = deferred;
+        pthread_mutex_unlock(&s->LoaderLock);
+    }
+}
+
+EStatus PInst_LoadResourceAsync(struct ProgramInstance *PInst, EResourceType Type, FHash Hash, char const *Path, LOADRESOURCE_FLAG_T Flag, PInstLoadCallback Callback, void *CallbackArg)
+{
+    size_t len = strlen(Path);
+    struct AsyncLoadJob *job = malloc(sizeof(struct AsyncLoadJob) + len + 1);
+    job->Next = NULL;
+    job->PInst = PInst;
+    job->Type = Type;
+    job->Hash = Hash;
+    job->Flag = Flag;
+    job->Callback = Callback;
+    job->CallbackArg = CallbackArg;
+    job->Data = NULL;
+    job->Target = NULL;
+    job->bDuplicate = false;
+    memcpy(job->Path, Path, len + 1);
+
+    // Resource is loaded once, even if requested again while it is queued or being loaded.
+    // Table is looked up under loader lock, as loader adds resource before it leaves running list.
+    pthread_mutex_lock(&PInst->LoaderLock);
+    bool bExist = PInst_GetResource(PInst, Hash) != NULL;
+    for (struct AsyncLoadJob *q = PInst->LoaderQueueHead; q && !bExist; q = q->Next)
+        bExist = q->Hash == Hash;
+    for (struct AsyncLoadJob *q = PInst->LoaderRunning; q && !bExist; q = q->Next)
+        bExist = q->Hash == Hash;
+
+    // Existing resource is reported without loading, after the job which is loading it.
+    job->bDuplicate = bExist;
+    struct AsyncLoadJob **head = bExist ? &PInst->LoaderDoneHead : &PInst->LoaderQueueHead;
+    struct AsyncLoadJob **tail = bExist ? &PInst->LoaderDoneTail : &PInst->LoaderQueueTail;
+    if (*tail)
+        (*tail)->Next = job;
+    else
+        *head = job;
+    *tail = job;
+
+    if (bExist == false)
+    {
+        PInst->NumLoaderPending++;
+        pthread_cond_signal(&PInst->LoaderJobCond);
+    }
+    pthread_mutex_unlock(&PInst->LoaderLock);
+
+    return bExist ? STATUS_RESOURCE_ALREADY_EXIST : STATUS_OK;
+}
+
+void PInst_PrefetchResource(struct ProgramInstance *PInst, UResource *Resource)
+{
+    if (Resource == NULL || Resource->data || Resource->bPrefetching)
+        return;
+
+    struct AsyncLoadJob *job = calloc(1, sizeof(struct AsyncLoadJob) + 1);
+    job->PInst = PInst;
+    job->Type = Resource->Type;
+    job->Hash = Resource->Hash;
+    job->Target = Resource;
+    Resource->bPrefetching = true;
+
+    pthread_mutex_lock(&PInst->LoaderLock);
+    if (PInst->LoaderQueueTail)
+        PInst->LoaderQueueTail->Next = job;
+    else
+        PInst->LoaderQueueHead = job;
+    PInst->LoaderQueueTail = job;
+    PInst->NumLoaderPending++;
+    pthread_cond_signal(&PInst->LoaderJobCond);
+    pthread_mutex_unlock(&PInst->LoaderLock);
+}
+
+bool PInst_GetImageSize(struct ProgramInstance *PInst, UResource const *Image, FVec2int *Size)
+{
+    if (Image == NULL || Image->Type != RESOURCE_IMAGE)
+        return false;
+
+    Size->x = Image->Width;
+    Size->y = Image->Height;
+    return true;
+}
+
+void PInst_WaitAllResourceLoads(struct ProgramInstance *PInst)
+{
+    pthread_mutex_lock(&PInst->LoaderLock);
+    while (PInst->NumLoaderPending)
+        pthread_cond_wait(&PInst->LoaderDoneCond, &PInst->LoaderLock);
+    pthread_mutex_unlock(&PInst->LoaderLock);
+
+    pinst_loader_drain(PInst);
+    timer_wheel_advance(&PInst->Timer, pinst_timer_now(PInst));
 }
 
 static int RenderEventArg_Predicate(FRenderEventArg const **va, FRenderEventArg const **vb)
@@ -154,21 +1097,49 @@ struct ProgramInstance *PInst_Create(struct ProgramInstInitStruct const *Init)
     UProgramInstance *inst = calloc(1, sizeof(UProgramInstance));
     inst->id = &PInstTypeID;
 
+    // Slot index is stored in lower 16 bits of resource handle
+    uassert(Init->NumMaxResource <= 0x10000);
     inst->arrResource = calloc(Init->NumMaxResource, sizeof(struct Resource));
     inst->NumMaxResource = Init->NumMaxResource;
 
+    // Resource index keeps load factor under 0.5
+    size_t indexSize = 1;
+    while (indexSize < Init->NumMaxResource * 2)
+        indexSize <<= 1;
+    inst->arrResourceIndex = calloc(indexSize, sizeof(uint32_t));
+    inst->ResourceIndexMask = indexSize - 1;
+    inst->arrFreeResource = malloc(Init->NumMaxResource * sizeof(uint32_t) + 1);
+    pthread_mutex_init(&inst->ResourceLock, NULL);
+    inst->ResourceMemoryBudget = Init->ResourceMemoryBudget;
+
     inst->StringPoolMaxSize = Init->RenderStringPoolSize;
     for (size_t i = 0; i < 2; i++)
     {
         inst->RenderStringPool[i] = malloc(Init->RenderStringPoolSize);
     }
 
-    // Renderer yield condition
-    inst->bEnableRendererYield = Init->bAllowRendererYield;
+    // Renderer sleeps until flip
+    pthread_mutex_init(&inst->RenderLock, NULL);
+    pthread_cond_init(&inst->RenderCond, NULL);
+    for (size_t i = 0; i < RENDERER_NUM_MAX_BUFFER; i++)
+        inst->FrameSignature[i] = PINST_SIGNATURE_BASIS;
+
+    // Idle mode wake-up
+    inst->WakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inst->WakeFd < 0)
+        lvlog(LOGLEVEL_WARNING, "Failed to create wake event. Idle mode is disabled.\n");
+
+    // Frame buffer reads presentation mode on initialization
+    inst->bEnableVSync = Init->bEnableVSync;
+    inst->TargetFrameTime = Init->TargetFrameTime;
+    inst->MinRenderScale = Init->MinRenderScale;
 
     // Initialize timer
-    size_t timerBuffSz = TIMER_ELEM_SIZE * Init->NumMaxTimer;
-    timer_init(&inst->Timer, malloc(timerBuffSz), timerBuffSz);
+    inst->FrameTime = inst->PrevFrameTime = Clock_Now();
+    timer_wheel_init(&inst->Timer, Init->NumMaxTimer, pinst_timer_now(inst));
+
+    // Initialize resource loaders
+    pinst_loader_init(inst, Init->NumLoaderThreads);
 
     // Load frame buffer
     inst->hFB = Internal_PInst_InitFB(inst, Init->FrameBufferDevFileName);
@@ -178,6 +1149,8 @@ struct ProgramInstance *PInst_Create(struct ProgramInstInitStruct const *Init)
     lvlog(LOGLEVEL_INFO, "Aspect ratio value: %f\n", inst->AspectRatio);
 
     // Initialize sound
+    inst->SoundLatency = Init->SoundLatency;
+    inst->bFastWavResample = Init->bFastWavResample;
     inst->hSound = Internal_PInst_InitSound(inst);
 
     // Initialize camera transforms
@@ -240,13 +1213,14 @@ static void *RenderThread(void *VPInst)
     {
         // Wait until flip request.
         // This is notified via switching active buffer index value.
-        if (((volatile UProgramInstance *)inst)->ActiveBufferIndex == ActiveIdx)
-        {
-            if (inst->bEnableRendererYield)
-                pthread_yield(NULL);
-            continue;
-        }
-        inst->RendererStatus = RENDERER_BUSY;
+        pthread_mutex_lock(&inst->RenderLock);
+        while (inst->ActiveBufferIndex == ActiveIdx && inst->hFB != NULL)
+            pthread_cond_wait(&inst->RenderCond, &inst->RenderLock);
+        pthread_mutex_unlock(&inst->RenderLock);
+        if (inst->hFB == NULL)
+            break;
+
+        uint64_t FrameBegin = Clock_Now();
 
         // Before draw ...
         Internal_PInst_Predraw(hFB, ActiveIdx);
@@ -257,29 +1231,49 @@ static void *RenderThread(void *VPInst)
         {
             FRenderEventArg const **Arg = pqueue_peek(DrawCallQueue);
             Internal_PInst_Draw(hFB, *Arg, ActiveIdx);
+            inst->RenderStatsWork.NumDrawCalls++;
         }
         Internal_PInst_Flush(hFB, ActiveIdx);
+        inst->RenderStatsWork.NumFrames++;
+        __atomic_store_n(&inst->NumFramesRendered, inst->RenderStatsWork.NumFrames, __ATOMIC_RELEASE);
+        uint64_t FrameEnd = Clock_Now();
+        inst->RenderStatsWork.LastFrameTimeNs = FrameEnd - FrameBegin - inst->RenderStatsWork.LastBufferWaitNs;
+        inst->RenderStatsWork.TotalFrameTimeNs += inst->RenderStatsWork.LastFrameTimeNs;
+        inst->RenderStatsWork.LastFrameLatencyNs = FrameEnd - inst->BufferFrameTime[ActiveIdx];
+        inst->RenderStatsWork.TotalFrameLatencyNs += inst->RenderStatsWork.LastFrameLatencyNs;
 
         // Release memory pools of current active index
         inst->StringPoolHeadIndex[ActiveIdx] = 0;
         inst->PoolHeadIndex[ActiveIdx] = 0;
         ActiveIdx = inst->ActiveBufferIndex;
+
+        // Publish statistics of the frame, and wake game thread waiting for idle. Readers copy statistics under same lock.
+        pthread_mutex_lock(&inst->RenderLock);
+        inst->RenderStats = inst->RenderStatsWork;
         inst->RendererStatus = RENDERER_IDLE;
+        pthread_cond_broadcast(&inst->RenderCond);
+        pthread_mutex_unlock(&inst->RenderLock);
     }
 
     lvlog(LOGLEVEL_INFO, "Rendering thread is shutting down\n");
     return NULL;
 }
 
-EStatus PInst_UpdateTimer(struct ProgramInstance *PInst, float DeltaTime)
+EStatus PInst_UpdateTimer(struct ProgramInstance *PInst, uint64_t FrameTime)
 {
-    // Update accumulated time.
-    PInst->TotalTime += DeltaTime;
-    size_t ms = (size_t)(PInst->TotalTime * 1000.0);
-    PInst->TotalTimeMs = ms;
+    // Clock never goes back, but caller may pass stale timestamp.
+    PInst->PrevFrameTime = PInst->FrameTime;
+    if (FrameTime > PInst->FrameTime)
+        PInst->FrameTime = FrameTime;
+
+    // Finished resource loads are reported through timer queue
+    pinst_loader_drain(PInst);
 
     // Update Timer
-    timer_update(&PInst->Timer, ms);
+    timer_wheel_advance(&PInst->Timer, pinst_timer_now(PInst));
+
+    // Frames rendered meanwhile may have released resources to evict.
+    pinst_resource_trim(PInst);
 
     return STATUS_OK;
 }
@@ -289,34 +1283,187 @@ EStatus PInst_Flip(struct ProgramInstance *s)
     if (s->bRenderingLock)
         return RENDERER_LOCKED;
 
-    if (s->RendererStatus != RENDERER_IDLE)
+    // Renderer releases buffer pools before going idle under the lock.
+    pthread_mutex_lock(&s->RenderLock);
+    bool bBusy = s->RendererStatus != RENDERER_IDLE;
+    bool bReducedScale = s->RenderStats.RenderScale > 0.0f && s->RenderStats.RenderScale < 1.0f;
+    pthread_mutex_unlock(&s->RenderLock);
+    if (bBusy)
         return RENDERER_BUSY;
 
-    s->ActiveBufferIndex = pinst_next_buff_idx(s);
+    // Screen rendered in reduced scale is rendered again, until renderer raises scale back to full.
+    if (bReducedScale)
+        s->bScreenValid = false;
+
+    int active = s->ActiveBufferIndex;
     s->ActiveCameraTransform = s->PendingCameraTransform;
-    lvlog(LOGLEVEL_VERBOSE + 100, "Buffer Successfully Flipped. Active Buffer : %d\n", s->ActiveBufferIndex);
 
-    // Wait until rendering process begin.
-    while (((volatile struct ProgramInstance *)s)->RendererStatus == RENDERER_IDLE)
+    // Frame identical to the screen. Discard it, and keep the screen.
+    if (s->bScreenValid && s->FrameSignature[active] == s->ScreenSignature)
     {
-    };
+        for (pqueue_t *q = &s->arrRenderEventQueue[active]; q->cnt;)
+            pqueue_pop(q);
+        s->StringPoolHeadIndex[active] = 0;
+        s->PoolHeadIndex[active] = 0;
+        s->FrameSignature[active] = PINST_SIGNATURE_BASIS;
+        s->bFrameStatic = true;
+        s->NumFlipSkipped++;
+        return STATUS_OK;
+    }
+    s->ScreenSignature = s->FrameSignature[active];
+    s->bScreenValid = true;
+    s->bFrameStatic = false;
+
+    s->BufferFrameTime[active] = s->FrameTime;
+    s->FrameSignature[pinst_next_buff_idx(s)] = PINST_SIGNATURE_BASIS;
+
+    // Renderer is idle, thus no frame is in progress. Mark busy before waking it up.
+    pthread_mutex_lock(&s->RenderLock);
+    s->RendererStatus = RENDERER_BUSY;
+    s->ActiveBufferIndex = pinst_next_buff_idx(s);
+    pthread_cond_signal(&s->RenderCond);
+    pthread_mutex_unlock(&s->RenderLock);
+
+    s->NumFlip++;
+    lvlog(LOGLEVEL_VERBOSE + 100, "Buffer Successfully Flipped. Active Buffer : %d\n", s->ActiveBufferIndex);
     return STATUS_OK;
 }
 
+void PInst_WaitRendererIdle(struct ProgramInstance *PInst)
+{
+    pthread_mutex_lock(&PInst->RenderLock);
+    while (PInst->RendererStatus != RENDERER_IDLE && PInst->hFB != NULL)
+        pthread_cond_wait(&PInst->RenderCond, &PInst->RenderLock);
+    pthread_mutex_unlock(&PInst->RenderLock);
+}
+
+bool PInst_IsFrameStatic(struct ProgramInstance *PInst)
+{
+    return PInst->bFrameStatic;
+}
+
+void PInst_Wake(struct ProgramInstance *PInst)
+{
+    // Only async-signal-safe calls here.
+    uint64_t one = 1;
+    if (PInst->WakeFd >= 0)
+        (void)!write(PInst->WakeFd, &one, sizeof one);
+}
+
+void PInst_WaitForActivity(struct ProgramInstance *PInst)
+{
+    if (PInst->WakeFd < 0)
+        return;
+
+    // Sleep until next timer, or forever if there's none.
+    uint64_t expires;
+    struct timespec timeout, *ptimeout = NULL;
+    uint64_t begin = Clock_Now();
+    if (timer_wheel_next_expiry(&PInst->Timer, &expires))
+    {
+        uint64_t deadline = expires * CLOCK_NS_PER_US;
+        if (deadline <= begin)
+            return;
+        timeout = Clock_ToTimespec(deadline - begin);
+        ptimeout = &timeout;
+    }
+
+    struct pollfd pfd = {.fd = PInst->WakeFd, .events = POLLIN};
+    ppoll(&pfd, 1, ptimeout, NULL);
+
+    // Reset counter of eventfd. Fails with EAGAIN if woken by timeout.
+    uint64_t count;
+    (void)!read(PInst->WakeFd, &count, sizeof count);
+
+    // Time spent idle doesn't count in delta time of next frame.
+    PInst->FrameTime = Clock_Now();
+    PInst->NumIdleWaits++;
+    PInst->IdleTimeNs += PInst->FrameTime - begin;
+}
+
 void PInst_Destroy(struct ProgramInstance *PInst)
 {
     void *hFB = PInst->hFB;
+    pthread_mutex_lock(&PInst->RenderLock);
     PInst->hFB = NULL;
+    pthread_cond_signal(&PInst->RenderCond);
+    pthread_mutex_unlock(&PInst->RenderLock);
 
     pthread_join(PInst->ThreadHandle, NULL);
+    if (PInst->WakeFd >= 0)
+        close(PInst->WakeFd);
+    pinst_loader_deinit(PInst);
     Internal_PInst_DeinitFB(PInst, hFB);
 
     if (PInst->hSound)
         Internal_PInst_DeinitSound(PInst->hSound);
 
+    PInst_DumpRenderStats(PInst);
+    PInst_DumpResources(PInst);
+    pthread_cond_destroy(&PInst->RenderCond);
+    pthread_mutex_destroy(&PInst->RenderLock);
+    timer_wheel_destroy(&PInst->Timer);
+
+    for (size_t i = 0; i < PInst->NumResource; i++)
+    {
+        struct Resource *rs = PInst->arrResource + i;
+        if (rs->data)
+            pinst_resource_free(rs->Type, rs->data);
+        free(rs->Source);
+        free(rs->Path);
+    }
+
+    free(PInst->arrResource);
+    free(PInst->arrResourceIndex);
+    free(PInst->arrFreeResource);
+
+    // Packed resources refer the pack until they are freed.
+    if (PInst->PackAddr)
+        munmap(PInst->PackAddr, PInst->PackSize);
+
     lvlog(LOGLEVEL_INFO, "Successfully destroied.\n");
 }
 
+void PInst_GetRenderStats(struct ProgramInstance *s, FRenderStats *out)
+{
+    pthread_mutex_lock(&s->RenderLock);
+    *out = s->RenderStats;
+    pthread_mutex_unlock(&s->RenderLock);
+}
+
+void PInst_DumpRenderStats(struct ProgramInstance *s)
+{
+    FRenderStats st;
+    PInst_GetRenderStats(s, &st);
+    size_t lookups = st.TextLayoutHit + st.TextLayoutMiss;
+
+    lvlog(LOGLEVEL_INFO,
+          "Render stats: %zu frames, %zu draw calls, %zu image blits, %.3f ms per frame, %.3f ms latency\n"
+          "\tState changes: %zu emitted, %zu skipped\n"
+          "\tRect fill: %zu rects, %llu pixels, %.1f Mpx/s\n"
+          "\tPolylines: %zu strokes, %.1f us per stroke\n"
+          "\tText layout cache: %zu hit, %zu miss, %zu evicted (hit rate %.1f%%)\n"
+          "\tVSync present: %zu presented, %zu dropped, refresh %.2f Hz, %.3f ms buffer wait per frame\n"
+          "\tIdle: %zu static frames skipped, %zu waits, %.1f s idle\n"
+          "\tRender scale: %.0f%%, changed %zu times\n"
+          "\tResources: %zu KiB decoded (budget %zu KiB), %zu KiB compressed, %zu evicted, %zu decoded on use\n",
+          st.NumFrames, st.NumDrawCalls, st.NumImageBlits,
+          st.NumFrames ? st.TotalFrameTimeNs * 1e-6 / st.NumFrames : 0.0,
+          st.NumFrames ? st.TotalFrameLatencyNs * 1e-6 / st.NumFrames : 0.0,
+          st.StateChangesEmitted, st.StateChangesSkipped,
+          st.NumRectFills, (unsigned long long)st.RectFillPixels,
+          st.RectFillTimeNs ? st.RectFillPixels * 1e3 / st.RectFillTimeNs : 0.0,
+          st.NumPolyDraws, st.NumPolyDraws ? st.PolyDrawTimeNs * 1e-3 / st.NumPolyDraws : 0.0,
+          st.TextLayoutHit, st.TextLayoutMiss, st.TextLayoutEvict,
+          lookups ? 100.0 * st.TextLayoutHit / lookups : 0.0,
+          st.NumFramesPresented, st.NumFramesDropped, st.RefreshIntervalNs ? 1e9 / st.RefreshIntervalNs : 0.0,
+          st.NumFrames ? st.TotalBufferWaitNs * 1e-6 / st.NumFrames : 0.0,
+          s->NumFlipSkipped, s->NumIdleWaits, Clock_ToSeconds(s->IdleTimeNs),
+          st.RenderScale * 100.0, st.NumRenderScaleChanges,
+          s->ResourceBytes[RESOURCE_NONE] >> 10, s->ResourceMemoryBudget >> 10, s->ResourceSourceBytes >> 10,
+          s->NumResourceEvicted, s->NumResourceReloaded);
+}
+
 static bool pinst_push_render_event(UProgramInstance *s, FRenderEventArg *ref)
 {
     int active = s->ActiveBufferIndex;
@@ -357,22 +1504,44 @@ static void pinst_renderer_translate_camera(FTransform2 *dst, FTransform2 const
     }
 }
 
-timer_handle_t PInst_QueueTimer(struct ProgramInstance *PInst, void (*Callback)(void *), void *CallbackArg, size_t delay_ms)
+timer_wheel_handle_t PInst_QueueTimer(struct ProgramInstance *PInst, void (*Callback)(void *), void *CallbackArg, size_t delay_ms)
+{
+    return PInst_QueueTimerUs(PInst, Callback, CallbackArg, delay_ms * (CLOCK_NS_PER_MS / CLOCK_NS_PER_US));
+}
+
+timer_wheel_handle_t PInst_QueueTimerUs(struct ProgramInstance *PInst, void (*Callback)(void *), void *CallbackArg, uint64_t delay_us)
+{
+    lvlog(LOGLEVEL_DISPLAY, "Queueing new timer for us %llu ... now: %llu\n",
+          (unsigned long long)delay_us, (unsigned long long)pinst_timer_now(PInst));
+    return timer_wheel_add(&PInst->Timer, pinst_timer_now(PInst) + delay_us, Callback, CallbackArg);
+}
+
+bool PInst_AbortTimer(struct ProgramInstance *PInst, timer_wheel_handle_t handle)
+{
+    return timer_wheel_cancel(&PInst->Timer, handle);
+}
+
+size_t PInst_GetTimerDelayLeft(struct ProgramInstance *PInst, timer_wheel_handle_t handle)
+{
+    return PInst_GetTimerDelayLeftUs(PInst, handle) / (CLOCK_NS_PER_MS / CLOCK_NS_PER_US);
+}
+
+uint64_t PInst_GetTimerDelayLeftUs(struct ProgramInstance *PInst, timer_wheel_handle_t handle)
 {
-    lvlog(LOGLEVEL_DISPLAY, "Queueing new timer for ms %d ... now: %d\n",
-          delay_ms, PInst->TotalTimeMs + delay_ms);
-    return timer_add(&PInst->Timer, PInst->TotalTimeMs + delay_ms, Callback, CallbackArg);
+    uint64_t expires;
+    if (!timer_wheel_expiry(&PInst->Timer, handle, &expires) || expires <= pinst_timer_now(PInst))
+        return 0;
+    return expires - pinst_timer_now(PInst);
 }
 
-bool PInst_AbortTimer(struct ProgramInstance *PInst, timer_handle_t handle)
+uint64_t PInst_GetFrameTime(struct ProgramInstance *PInst)
 {
-    return timer_erase(&PInst->Timer, handle);
+    return PInst->FrameTime;
 }
 
-size_t PInst_GetTimerDelayLeft(struct ProgramInstance *PInst, timer_handle_t handle)
+float PInst_GetDeltaTime(struct ProgramInstance *PInst)
 {
-    timer_info_t *info = timer_browse(&PInst->Timer, handle);
-    return info ? info->triggerTime - PInst->TotalTimeMs : 0;
+    return Clock_ToSeconds(PInst->FrameTime - PInst->PrevFrameTime);
 }
 
 static FRenderEventArg *pinst_queue_render_event_arg(UProgramInstance *s, int32_t Layer, FTransform2 const *Tr, bool *retv, bool bAbsolute)
@@ -389,12 +1558,57 @@ EStatus PInst_RQueueImage(struct ProgramInstance *PInst, int32_t Layer, FTransfo
     if (PInst->bRenderingLock)
         return RENDERER_LOCKED;
 
+    if (pinst_resource_use(PInst, Image) == false)
+        return ERROR_INVALID_RESOURCE_PATH;
+
     bool Result;
     FRenderEventArg *ev;
     ev = pinst_queue_render_event_arg(PInst, Layer, Tr, &Result, bAbsolute);
 
     ev->Data.Image.Image = Image;
     ev->Type = ERET_IMAGE;
+    pinst_sign_render_event(PInst, ev);
+
+    return Result ? STATUS_OK : ERROR_FAILED;
+}
+
+EStatus PInst_RQueuePolygon(struct ProgramInstance *PInst, int32_t Layer, FTransform2 const *Tr, struct Resource *Vect, COLORREF rgba, bool bAbsolute)
+{
+    if (PInst->bRenderingLock)
+        return RENDERER_LOCKED;
+
+    if (pinst_resource_use(PInst, Vect) == false)
+        return ERROR_INVALID_RESOURCE_PATH;
+
+    bool Result;
+    FRenderEventArg *ev;
+    ev = pinst_queue_render_event_arg(PInst, Layer, Tr, &Result, bAbsolute);
+
+    ev->Data.Poly.PolyLines = Vect;
+    ev->Data.Poly.rgba = *rgba;
+    ev->Type = ERET_POLY;
+    pinst_sign_render_event(PInst, ev);
+
+    return Result ? STATUS_OK : ERROR_FAILED;
+}
+
+EStatus PInst_RQueueRect(struct ProgramInstance *PInst, int32_t Layer, FTransform2 const *Tr, FVec2int ofst, FVec2int size, COLORREF rgba, bool bAbsolute)
+{
+    if (PInst->bRenderingLock)
+        return RENDERER_LOCKED;
+
+    bool Result;
+    FRenderEventArg *ev;
+    ev = pinst_queue_render_event_arg(PInst, Layer, Tr, &Result, bAbsolute);
+
+    // Rectangle is described in pixels, relative to transformed position.
+    ev->Data.Rect.x0 = ofst.x;
+    ev->Data.Rect.y0 = ofst.y;
+    ev->Data.Rect.x1 = ofst.x + size.x;
+    ev->Data.Rect.y1 = ofst.y + size.y;
+    ev->Data.Rect.rgba = *rgba;
+    ev->Type = ERET_RECT;
+    pinst_sign_render_event(PInst, ev);
 
     return Result ? STATUS_OK : ERROR_FAILED;
 }
@@ -412,6 +1626,9 @@ EStatus PInst_RQueueText(
     if (s->bRenderingLock)
         return RENDERER_LOCKED;
 
+    if (pinst_resource_use(s, Font) == false)
+        return ERROR_INVALID_RESOURCE_PATH;
+
     bool Result;
     FRenderEventArg *ev;
     ev = pinst_queue_render_event_arg(s, Layer, Tr, &Result, bAbsolute);
@@ -435,12 +1652,22 @@ EStatus PInst_RQueueText(
     ev->Data.Text.Font = Font;
     ev->Data.Text.Flags = TextFlags;
     ev->Type = ERET_TEXT;
+    pinst_sign_render_event(s, ev);
 
     return Result ? STATUS_OK : ERROR_FAILED;
 }
 
 EStatus PInst_QueuePlayWave(struct ProgramInstance *PInst, struct Resource *Wav, float Volume)
 {
+    if (pinst_resource_use(PInst, Wav) == false)
+        return ERROR_INVALID_RESOURCE_PATH;
+
     Internal_PInst_PlayWav(PInst->hSound, Wav->data, Volume);
     return STATUS_OK;
 }
+
+EStatus PInst_StopAllSound(UProgramInstance *s)
+{
+    Internal_PInst_StopAllWav(s->hSound);
+    return STATUS_OK;
+}
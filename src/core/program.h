@@ -7,7 +7,8 @@
 #include "common.h"
 #include "types.h"
 #include "uEmbedded/priority_queue.h"
-#include "uEmbedded/timer_logic.h"
+#include "timer-wheel.h"
+#include "clock.h"
 
 //! \brief Miscellaneous constant values
 enum
@@ -35,10 +36,29 @@ struct ProgramInstInitStruct
     //! \brief Frame buffer's device file name.
     //! \details If Set NULL, fb0 will automatically be selected.
     char const *FrameBufferDevFileName;
-    //! Number of maximum timer nodes
+    //! Number of timer nodes to reserve. Grows on demand.
     size_t NumMaxTimer;
-    //! If set true, rendering thread can yield on idling.
+    //! \brief Deprecated, and ignored.
+    //! \details Rendering thread always sleeps until flip, thus it never spins on idling.
     bool bAllowRendererYield;
+    //! If set true, frames are presented on vertical blank where the frame buffer driver supports it.
+    bool bEnableVSync;
+    //! \brief Target time to render one frame, in seconds.
+    //! \details Renderer lowers its internal resolution while frames take longer. Set 0 to always render in full resolution.
+    float TargetFrameTime;
+    //! Lowest internal resolution relative to screen, in range of (0, 1].
+    float MinRenderScale;
+    //! Number of resource loader threads. Set 0 to use one per online processor.
+    size_t NumLoaderThreads;
+    //! \brief Bytes of decoded resources to keep in memory. Set 0 for no limit.
+    //! \details Resources without reference are evicted in least recently used order while over budget. Referenced or atlased ones are pinned.
+    size_t ResourceMemoryBudget;
+    //! \brief Target latency of sound output, in seconds.
+    //! \details Sound device buffer holds this much, split in few periods. Lower value wakes the mixer more often.
+    float SoundLatency;
+    //! \brief If set true, wave files are resampled linearly on load, which is faster but aliases.
+    //! \details Windowed sinc filter is used otherwise. Either resamples into rate the sound device runs in.
+    bool bFastWavResample;
 };
 
 static void PInst_InitializeInitStruct(struct ProgramInstInitStruct *v)
@@ -49,6 +69,13 @@ static void PInst_InitializeInitStruct(struct ProgramInstInitStruct *v)
     v->FrameBufferDevFileName = NULL;
     v->NumMaxTimer = 0x1000;
     v->bAllowRendererYield = false;
+    v->bEnableVSync = false;
+    v->TargetFrameTime = 0.0f;
+    v->MinRenderScale = 0.5f;
+    v->NumLoaderThreads = 0;
+    v->ResourceMemoryBudget = 0;
+    v->SoundLatency = 0.06f;
+    v->bFastWavResample = false;
 }
 
 /*! \brief Create new program instance.
@@ -70,9 +97,13 @@ enum
     LOADRESOURCE_FLAG_FONT_BOLD = 1,
     LOADRESOURCE_FLAG_FONT_ITALIC = 2,
     LOADRESOURCE_IMAGE_DEFAULT = 0,
+    //! \brief Only register image and read its dimensions. Pixels are decoded on first draw, or on prefetch.
+    //! \details Compressed file stays in memory, thus decoded pixels can be evicted and decoded again without file access.
+    LOADRESOURCE_FLAG_LAZY = 0x100,
 };
 
 /*! \brief Load given resource type to given program instance.
+    \details Every successful call adds a reference to the resource, which should be returned by PInst_ReleaseResource.
     \param PInst Instance to load resource
     \param Type Type of resource to load.
     \param Hash Hash value generated by specific algorithm.
@@ -83,44 +114,172 @@ enum
  */
 EStatus PInst_LoadResource(struct ProgramInstance *PInst, EResourceType Type, FHash Hash, char const *Path, LOADRESOURCE_FLAG_T Flag, UResource **out);
 
+/*! \brief Map resource pack built by respack tool.
+    \details
+        Resources found in pack are used in place, without opening or decoding their files.
+        Resources which are not in pack are still loaded from their paths.
+        Should be called before loading any resource. Pack stays mapped until program instance is destroyed.
+    \return STATUS_OK if succeed. ERROR_INVALID_RESOURCE_PATH if there's no valid pack in given path.
+ */
+EStatus PInst_MountResourcePack(struct ProgramInstance *PInst, char const *Path);
+
+/*! \brief Callback of asynchronous resource loading.
+    \param CallbackArg User argument given on PInst_LoadResourceAsync.
+    \param Resource Loaded resource. NULL if loading has failed.
+ */
+typedef void (*PInstLoadCallback)(void *CallbackArg, UResource *Resource);
+
+/*! \brief Load given resource on loader thread.
+    \details
+        Resource is decoded on one of loader threads, then added to the program instance and reported by
+        Callback on the game thread, through timer queue on PInst_UpdateTimer or PInst_WaitAllResourceLoads.
+        Resource is not visible for PInst_GetResource until then.
+        Reported resource holds a reference, same as PInst_LoadResource.
+    \param Callback Called once loading is done. Can be NULL.
+    \return STATUS_OK if queued. STATUS_RESOURCE_ALREADY_EXIST if resource is already loaded or queued,
+        which still reports to callback.
+ */
+EStatus PInst_LoadResourceAsync(struct ProgramInstance *PInst, EResourceType Type, FHash Hash, char const *Path, LOADRESOURCE_FLAG_T Flag, PInstLoadCallback Callback, void *CallbackArg);
+
+/*! \brief Hint that resource will be drawn soon. Data which is not decoded, or has been evicted, is decoded on loader thread.
+    \details Decoded data is installed on PInst_UpdateTimer. Drawing resource before that decodes it on the spot.
+ */
+void PInst_PrefetchResource(struct ProgramInstance *PInst, UResource *Resource);
+
+/*! \brief Get dimensions of image resource in pixels, which are known without decoding.
+    \return false if given resource is not an image.
+ */
+bool PInst_GetImageSize(struct ProgramInstance *PInst, UResource const *Image, FVec2int *Size);
+
+/*! \brief Block until every queued asynchronous load is finished, then deliver their callbacks. */
+void PInst_WaitAllResourceLoads(struct ProgramInstance *PInst);
+
 /*! \brief Queue timer in milliseconds
     \param Callback 
     \param CallbackArg 
     \param delay_ms Delay time in milliseconds
     \return Handle of assigned timer.
  */
-timer_handle_t PInst_QueueTimer(struct ProgramInstance *PInst, void (*Callback)(void *), void *CallbackArg, size_t delay_ms);
+timer_wheel_handle_t PInst_QueueTimer(struct ProgramInstance *PInst, void (*Callback)(void *), void *CallbackArg, size_t delay_ms);
+
+/*! \brief Queue timer in microseconds. Delay is counted from current frame timestamp. */
+timer_wheel_handle_t PInst_QueueTimerUs(struct ProgramInstance *PInst, void (*Callback)(void *), void *CallbackArg, uint64_t delay_us);
 
 /*! \brief Abort timer 
     \param PInst 
     \param handle 
     \return True if given timer handle was valid, and canceled successfully.
  */
-bool PInst_AbortTimer(struct ProgramInstance *PInst, timer_handle_t handle);
+bool PInst_AbortTimer(struct ProgramInstance *PInst, timer_wheel_handle_t handle);
 
 /*! \brief Get Timer Delay Left.
     \param PInst 
     \param handle Timer handle.
     \return Time left in milliseconds.
  */
-size_t PInst_GetTimerDelayLeft(struct ProgramInstance *PInst, timer_handle_t handle);
+size_t PInst_GetTimerDelayLeft(struct ProgramInstance *PInst, timer_wheel_handle_t handle);
+
+//! Time left in microseconds.
+uint64_t PInst_GetTimerDelayLeftUs(struct ProgramInstance *PInst, timer_wheel_handle_t handle);
 
 /*! \brief Find resource by Hash. Returns NULL if no resource exists for given hash.
+    \details Resource never moves once loaded, thus returned pointer can be kept until it is unloaded.
     \param PInst 
     \param Hash 
     \return 
  */
 struct Resource *PInst_GetResource(struct ProgramInstance *PInst, FHash Hash);
 
-//! Will not be implemented for this project.
-void PInst_ReleaseResource(struct ProgramInstance *PInst); // @todo
+/*! \brief Handle of resource, which detects if its slot has been assigned to another resource. Zero is invalid handle. */
+typedef uint32_t FResourceHandle;
+
+/*! \brief Get handle of given resource. Returns zero for NULL. */
+FResourceHandle PInst_GetResourceHandle(struct ProgramInstance *PInst, UResource const *Resource);
+
+/*! \brief Resolve handle into resource in constant time.
+    \return NULL if handle is invalid, or its resource is not alive anymore.
+ */
+UResource *PInst_ResolveResource(struct ProgramInstance *PInst, FResourceHandle Handle);
+
+/*! \brief Accounting information of a resource. */
+typedef struct ResourceInfo
+{
+    UResource *Resource;
+    FHash Hash;
+    EResourceType Type;
+    char const *Path;
+    //! False if data is not decoded yet, or has been evicted.
+    bool bDecoded;
+    //! Decoded size in memory.
+    size_t Bytes;
+    //! Compressed source kept in memory for lazily decoded image.
+    size_t SourceBytes;
+    //! Size of file or packed entry which resource is loaded from. Zero if not a file.
+    size_t FileBytes;
+    //! Wall time of loading, and of last decode after that.
+    uint64_t LoadTimeNs;
+    uint64_t DecodeTimeNs;
+    //! Last frame which has drawn or played resource. Zero if never used.
+    size_t LastUsedFrame;
+    int32_t RefCount;
+} FResourceInfo;
+
+typedef void (*PInstResourceVisitor)(void *VisitorArg, FResourceInfo const *Info);
+
+/*! \brief Visit accounting information of every resource, in order of resource slots.
+    \details
+        Slots freed by PInst_UnloadResource are reused by later loads, thus the order is not load order.
+        Information is copied before visiting, thus Visitor can call any resource API.
+ */
+void PInst_ForEachResource(struct ProgramInstance *PInst, PInstResourceVisitor Visitor, void *VisitorArg);
+
+//! Print resource memory and load time summary to log, with largest and slowest resources.
+void PInst_DumpResources(struct ProgramInstance *PInst);
+
+/*! \brief Pack every loaded image resource into a few large atlas surfaces.
+    \details
+        Each image resource refers a sub-rectangle of its atlas afterwards, which is transparent to
+        PInst_RQueueImage callers. Images loaded after this call stay separated until next call.
+        Images used in place from raw image file or resource pack are left alone, as copying them only doubles memory.
+        Packed images are never evicted. Instead, atlas pages are counted to decoded bytes of images until instance is destroyed.
+        Waits until the frame in progress is rendered.
+    \return Number of atlas pages created.
+ */
+size_t PInst_BuildImageAtlas(struct ProgramInstance *PInst);
+
+/*! \brief Return a reference taken by loading the resource.
+    \details
+        Resource without reference can be evicted when decoded resources exceed memory budget.
+        Evicted resource keeps its slot and handle, and is reloaded from its path when it's drawn or played again.
+ */
+void PInst_ReleaseResource(struct ProgramInstance *PInst, UResource *Resource);
+
+/*! \brief Remove resource from program instance, and free its slot for another resource.
+    \details
+        Resource must hold no reference, and frames using it must have been rendered.
+        Handles of removed resource resolve to NULL from now on, and its pointer must not be used anymore.
+    \return STATUS_OK if removed. ERROR_FAILED if resource is still in use.
+ */
+EStatus PInst_UnloadResource(struct ProgramInstance *PInst, UResource *Resource);
+
+/*! \brief Bytes of decoded resources in memory.
+    \param Type Type of resources to count. RESOURCE_NONE counts every type.
+ */
+size_t PInst_GetResourceBytes(struct ProgramInstance *PInst, EResourceType Type);
 
 /*! \brief Update program instance
     \param PInst 
-    \param DeltaTime Delta time in seconds.
+    \param FrameTime Timestamp of new frame from Clock_Now(). Timers, renderer and game use it as
+        current time throughout the frame.
     \return Current system status. Returns non-zero value for warnings/errors.
  */
-EStatus PInst_UpdateTimer(struct ProgramInstance *PInst, float DeltaTime);
+EStatus PInst_UpdateTimer(struct ProgramInstance *PInst, uint64_t FrameTime);
+
+//! Timestamp of current frame in nanoseconds, given on PInst_UpdateTimer.
+uint64_t PInst_GetFrameTime(struct ProgramInstance *PInst);
+
+//! Seconds elapsed between timestamps of previous and current frame.
+float PInst_GetDeltaTime(struct ProgramInstance *PInst);
 
 // Draw APIs
 /*! \brief   Request draw.           
@@ -128,15 +287,97 @@ EStatus PInst_UpdateTimer(struct ProgramInstance *PInst, float DeltaTime);
     \return STATUS_OK if succeed, else if failed.
     \details 
         Notify ProgramInstance that queueing rendering events are done and readied to render output. Output screen will be refreshed as soon as all of the queue is processed.
+        If queued draw calls are identical to the frame on screen, they are discarded without rendering, and
+        PInst_IsFrameStatic returns true until next flip. Frame on screen rendered in reduced scale is never
+        kept, thus static screen is rendered until it returns to full scale.
  */
 EStatus PInst_Flip(struct ProgramInstance *PInst);
 
+/*! \brief Block until renderer finishes the frame in progress.
+    \details Should be called on game thread, which is the only thread that flips. Call PInst_Flip again afterwards if it returned RENDERER_BUSY.
+ */
+void PInst_WaitRendererIdle(struct ProgramInstance *PInst);
+
+//! Whether last flip was skipped, since its frame was identical to the screen.
+bool PInst_IsFrameStatic(struct ProgramInstance *PInst);
+
+/*! \brief Block until there's something to do.
+    \details
+        Returns on PInst_Wake, or when the next queued timer expires. Returns immediately if a wake
+        has been signaled since last call, or a timer is already due. Without any timer, blocks until woken.
+        Should be called on game thread, when the screen is static and nothing animates.
+ */
+void PInst_WaitForActivity(struct ProgramInstance *PInst);
+
+/*! \brief Wake game thread blocked in PInst_WaitForActivity.
+    \details Can be called from any thread, and from signal handlers.
+ */
+void PInst_Wake(struct ProgramInstance *PInst);
+
 /*! \brief Set camera tranform for next frame. */
 void PInst_SetCameraTransform(struct ProgramInstance *s, FTransform2 const *v);
 
 //! Returns handle of aspect ratio.
 float *PInst_AspectRatio(struct ProgramInstance *s);
 
+/*! \brief Renderer statistics. All counters are accumulated since program start. */
+typedef struct RenderStats
+{
+    //! Number of frames rendered.
+    size_t NumFrames;
+    //! Number of draw calls consumed by renderer.
+    size_t NumDrawCalls;
+    //! Image draw calls processed by software blitter, instead of cairo.
+    size_t NumImageBlits;
+    //! Rectangle fill throughput
+    size_t NumRectFills;
+    uint64_t RectFillPixels;
+    uint64_t RectFillTimeNs;
+    //! Polyline stroke cost
+    size_t NumPolyDraws;
+    uint64_t PolyDrawTimeNs;
+    //! Render context state changes issued to backend, and ones skipped since state was already set.
+    size_t StateChangesEmitted;
+    size_t StateChangesSkipped;
+    //! Time spent from beginning of frame rendering to end of flush, except waiting for back buffer.
+    uint64_t LastFrameTimeNs;
+    uint64_t TotalFrameTimeNs;
+    //! Time spent waiting for vertical blank presenter to release back buffer.
+    uint64_t LastBufferWaitNs;
+    uint64_t TotalBufferWaitNs;
+    //! Time from frame timestamp to end of its flush.
+    uint64_t LastFrameLatencyNs;
+    uint64_t TotalFrameLatencyNs;
+    //! Text layout cache lookups that found cached layout.
+    size_t TextLayoutHit;
+    //! Text layout cache lookups that had to build new layout.
+    size_t TextLayoutMiss;
+    //! Text layouts dropped to make room for new one.
+    size_t TextLayoutEvict;
+    //! Frames copied to screen, and ones replaced or overwritten before vertical blank presenter reached them.
+    size_t NumFramesPresented;
+    size_t NumFramesDropped;
+    //! Measured interval between vertical blanks. Zero if unknown.
+    uint64_t RefreshIntervalNs;
+    //! Internal resolution of last frame relative to screen, and number of times it has changed.
+    float RenderScale;
+    size_t NumRenderScaleChanges;
+} FRenderStats;
+
+/*! \brief Copy renderer statistics.
+    \param s 
+    \param out Destination of copied statistics.
+ */
+void PInst_GetRenderStats(struct ProgramInstance *s, FRenderStats *out);
+
+//! Print renderer statistics to log.
+void PInst_DumpRenderStats(struct ProgramInstance *s);
+
+/*! \brief Measured interval between vertical blanks of the screen.
+    \return Interval in seconds. Zero if frames are not presented on vertical blank.
+ */
+float PInst_GetRefreshInterval(struct ProgramInstance *s);
+
 //! Should be implemented by own way.
 FVec2float PInst_ScreenToWorld(struct ProgramInstance *s, int x, int y);
 FVec2int PInst_WorldToScreen(struct ProgramInstance *s, FVec2float v);
@@ -186,9 +427,16 @@ enum PINST_TEXTFLAG
     PINST_TEXTFLAG_VALIGN_DOWN = 0x08,
 };
 
-//! Will not be implemented.
-EStatus
-PInst_RQueuePolygon(struct ProgramInstance *PInst, int32_t Layer, FTransform2 const *Tr, struct Resource *Vect, COLORREF rgba, bool bAbsolute);
+/*! \brief Queue polyline rendering
+    \param PInst 
+    \param Layer Objects with high layer values are drawn in front.
+    \param Tr Transform. Polyline is rotated, scaled and then placed on position of transform.
+        Stroke width is scaled together with points.
+    \param Vect Line vector resource, loaded as RESOURCE_LINEVECTOR.
+    \param rgba Stroke color
+    \return Request result.
+ */
+EStatus PInst_RQueuePolygon(struct ProgramInstance *PInst, int32_t Layer, FTransform2 const *Tr, struct Resource *Vect, COLORREF rgba, bool bAbsolute);
 
 /*! \brief Queue filled rectangle rendering
     \param Tr   Transform of ractangle.
@@ -215,7 +463,7 @@ EStatus PInst_RQueueImage(struct ProgramInstance *PInst, int32_t Layer, FTransfo
  */
 EStatus PInst_QueuePlayWave(struct ProgramInstance *PInst, struct Resource *Wav, float Volume);
 
-// Should be implemented internally.
+//! Stop every playing and queued wave.
 EStatus PInst_StopAllSound(UProgramInstance *s);
 
 // For library implementations
@@ -227,11 +475,23 @@ void Internal_PInst_DeinitSound(void *hSound);
 void *Internal_PInst_LoadImgInternal(struct ProgramInstance *Inst, char const *Path);
 void *Internal_PInst_LoadFont(struct ProgramInstance *Inst, char const *Path, LOADRESOURCE_FLAG_T FontFlag);
 void *Internal_PInst_LoadWav(struct ProgramInstance *Inst, char const *Path);
-void *Internal_PInst_FreeAllResource(struct Resource *rsrc); // @todo.
+void *Internal_PInst_LoadVector(struct ProgramInstance *Inst, char const *Path);
+void *Internal_PInst_MapImage(struct ProgramInstance *Inst, void const *Data, size_t Size);
+bool Internal_PInst_ProbeImage(void const *Data, size_t Size, int32_t *Width, int32_t *Height);
+void *Internal_PInst_DecodeImage(struct ProgramInstance *Inst, void const *Data, size_t Size);
+void Internal_PInst_GetImageSize(void const *Image, int32_t *Width, int32_t *Height);
+void *Internal_PInst_MapWav(struct ProgramInstance *Inst, void const *Data, size_t Size);
+size_t Internal_PInst_BuildImageAtlas(struct ProgramInstance *Inst, struct Resource **Images, size_t NumImages, size_t *PageBytes);
+size_t Internal_PInst_GraphicResourceBytes(EResourceType Type, void const *Data);
+void Internal_PInst_FreeGraphicResource(EResourceType Type, void *Data);
+size_t Internal_PInst_WavBytes(void const *WavData);
+void Internal_PInst_FreeWav(void *WavData);
+bool Internal_PInst_IsWavPlaying(void *hSound, void const *WavData);
 void Internal_PInst_Predraw(void *hFB, int ActiveBuffer);
 void Internal_PInst_Draw(void *hFB, struct RenderEventArg const *Arg, int ActiveBuffer);
 void Internal_PInst_Flush(void *hFB, int ActiveBuffer);
 void Internal_PInst_PlayWav(void *hSound, void *WavData, float Volume);
+void Internal_PInst_StopAllWav(void *hSound);
 
 //! Program status
 enum ERendererState
@@ -249,4 +509,5 @@ enum EResourceType
     RESOURCE_IMAGE,
     RESOURCE_FONT,
     RESOURCE_WAV,
+    NUM_RESOURCE_TYPE
 };
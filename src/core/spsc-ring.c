@@ -0,0 +1,102 @@
+#include "spsc-ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+bool spsc_ring_init(spsc_ring_t *r, size_t elem_size, size_t min_capacity)
+{
+    memset(r, 0, sizeof *r);
+
+    size_t capacity = 1;
+    while (capacity < min_capacity)
+        capacity <<= 1;
+
+    r->buf = malloc(capacity * elem_size);
+    r->elem_size = elem_size;
+    r->capacity = capacity;
+    return r->buf != NULL;
+}
+
+void spsc_ring_destroy(spsc_ring_t *r)
+{
+    free(r->buf);
+    r->buf = NULL;
+}
+
+//! Copy n elements between ring position and linear buffer, in up to two pieces.
+static void ring_copy(spsc_ring_t *r, size_t index, void *linear, size_t n, bool bToRing)
+{
+    size_t pos = index & (r->capacity - 1);
+    size_t first = r->capacity - pos < n ? r->capacity - pos : n;
+    char *ring = r->buf + pos * r->elem_size;
+    char *lin = linear;
+
+    if (bToRing)
+    {
+        memcpy(ring, lin, first * r->elem_size);
+        memcpy(r->buf, lin + first * r->elem_size, (n - first) * r->elem_size);
+    }
+    else
+    {
+        memcpy(lin, ring, first * r->elem_size);
+        memcpy(lin + first * r->elem_size, r->buf, (n - first) * r->elem_size);
+    }
+}
+
+size_t spsc_ring_write(spsc_ring_t *r, void const *src, size_t n)
+{
+    size_t head = r->head;
+    size_t space = r->capacity - (head - r->cached_tail);
+    if (space < n)
+    {
+        // Space freed by consumer is visible after acquiring its tail.
+        r->cached_tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        space = r->capacity - (head - r->cached_tail);
+    }
+
+    if (space < n)
+    {
+        __atomic_store_n(&r->num_overrun, r->num_overrun + 1, __ATOMIC_RELAXED);
+        n = space;
+    }
+
+    ring_copy(r, head, (void *)src, n, true);
+
+    // Publish written elements.
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+size_t spsc_ring_read(spsc_ring_t *r, void *dst, size_t n)
+{
+    size_t tail = r->tail;
+    size_t avail = r->cached_head - tail;
+    if (avail < n)
+    {
+        r->cached_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        avail = r->cached_head - tail;
+    }
+
+    if (avail < n)
+    {
+        __atomic_store_n(&r->num_underrun, r->num_underrun + 1, __ATOMIC_RELAXED);
+        n = avail;
+    }
+
+    ring_copy(r, tail, dst, n, false);
+
+    // Return space after elements are copied out.
+    __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+size_t spsc_ring_readable(spsc_ring_t *r)
+{
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;
+}
+
+size_t spsc_ring_writable(spsc_ring_t *r)
+{
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    return r->capacity - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+}
@@ -0,0 +1,80 @@
+/*! \brief Lock-free single producer, single consumer ring buffer
+    \file spsc-ring.h
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-09
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        One thread writes and another thread reads, without locks. Producer publishes written
+        elements by release store of its head, which consumer loads with acquire before reading
+        them. Consumer returns space in same way through its tail.
+        Indices run freely and wrap on overflow. Capacity is power of two, thus position in buffer
+        is index masked. Each side caches last seen index of other side, and touches shared cache
+        line only when cached one doesn't tell enough.
+
+        Writes which don't fit, and reads which find less than requested, are counted as overrun
+        and underrun.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SPSC_RING_CACHE_LINE 64
+
+typedef struct spsc_ring
+{
+    // Immutable after init
+    char *buf;
+    size_t elem_size;
+    size_t capacity;
+
+    // Producer side. Padding keeps each side on its own cache line.
+    char pad0[SPSC_RING_CACHE_LINE];
+    size_t head;
+    size_t cached_tail;
+    size_t num_overrun;
+
+    // Consumer side
+    char pad1[SPSC_RING_CACHE_LINE];
+    size_t tail;
+    size_t cached_head;
+    size_t num_underrun;
+    char pad2[SPSC_RING_CACHE_LINE];
+} spsc_ring_t;
+
+/*! \brief Initialize ring.
+    \param min_capacity Number of elements to hold at least. Rounded up to power of two.
+    \return false if out of memory.
+ */
+bool spsc_ring_init(spsc_ring_t *r, size_t elem_size, size_t min_capacity);
+
+void spsc_ring_destroy(spsc_ring_t *r);
+
+/*! \brief Write up to n elements. Producer only.
+    \return Number of elements written. Overrun is counted if less than n.
+ */
+size_t spsc_ring_write(spsc_ring_t *r, void const *src, size_t n);
+
+/*! \brief Read up to n elements. Consumer only.
+    \return Number of elements read. Underrun is counted if less than n.
+ */
+size_t spsc_ring_read(spsc_ring_t *r, void *dst, size_t n);
+
+//! Number of elements ready to read. Exact on consumer. Other threads may still count elements being read.
+size_t spsc_ring_readable(spsc_ring_t *r);
+
+//! Number of elements which can be written. Exact on producer. Other threads may still count space being written.
+size_t spsc_ring_writable(spsc_ring_t *r);
+
+//! Overrun and underrun counters. Can be read from any thread.
+static inline size_t spsc_ring_overruns(spsc_ring_t const *r)
+{
+    return __atomic_load_n(&r->num_overrun, __ATOMIC_RELAXED);
+}
+
+static inline size_t spsc_ring_underruns(spsc_ring_t const *r)
+{
+    return __atomic_load_n(&r->num_underrun, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,353 @@
+#include "timer-wheel.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TW_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TW_LIST_OVERFLOW (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+#define TW_LIST_EXPIRING (TW_LIST_OVERFLOW + 1)
+
+static inline uint32_t tw_list_of(int level, unsigned slot)
+{
+    return level * TIMER_WHEEL_SLOTS + slot;
+}
+
+static inline unsigned tw_slot_of(uint64_t tick, int level)
+{
+    return (tick >> (level * TIMER_WHEEL_BITS)) & TW_MASK;
+}
+
+static void tw_link(timer_wheel_t *w, uint32_t idx, uint32_t list)
+{
+    timer_wheel_node_t *n = w->nodes + idx;
+    n->list = list;
+    n->next = TIMER_WHEEL_NIL;
+    n->prev = w->tail[list];
+
+    if (n->prev == TIMER_WHEEL_NIL)
+        w->head[list] = idx;
+    else
+        w->nodes[n->prev].next = idx;
+    w->tail[list] = idx;
+
+    if (list < TW_LIST_OVERFLOW)
+        w->occupied[list / TIMER_WHEEL_SLOTS] |= 1ull << (list & TW_MASK);
+}
+
+static void tw_unlink(timer_wheel_t *w, uint32_t idx)
+{
+    timer_wheel_node_t *n = w->nodes + idx;
+    uint32_t list = n->list;
+
+    if (n->prev == TIMER_WHEEL_NIL)
+        w->head[list] = n->next;
+    else
+        w->nodes[n->prev].next = n->next;
+
+    if (n->next == TIMER_WHEEL_NIL)
+        w->tail[list] = n->prev;
+    else
+        w->nodes[n->next].prev = n->prev;
+
+    if (list < TW_LIST_OVERFLOW && w->head[list] == TIMER_WHEEL_NIL)
+        w->occupied[list / TIMER_WHEEL_SLOTS] &= ~(1ull << (list & TW_MASK));
+}
+
+//! Hash node into a slot by its distance from next tick. Node of processed tick is expired on next advance.
+static void tw_place(timer_wheel_t *w, uint32_t idx)
+{
+    uint64_t expires = w->nodes[idx].expires;
+    uint64_t delta = expires - w->next;
+
+    if (expires < w->next)
+    {
+        tw_link(w, idx, TW_LIST_EXPIRING);
+        return;
+    }
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+    {
+        if (delta >> ((level + 1) * TIMER_WHEEL_BITS) == 0)
+        {
+            tw_link(w, idx, tw_list_of(level, tw_slot_of(expires, level)));
+            return;
+        }
+    }
+
+    tw_link(w, idx, TW_LIST_OVERFLOW);
+}
+
+//! Detach whole list and hash its nodes again.
+static void tw_rehash(timer_wheel_t *w, uint32_t list)
+{
+    uint32_t idx = w->head[list];
+    w->head[list] = w->tail[list] = TIMER_WHEEL_NIL;
+    if (list < TW_LIST_OVERFLOW)
+        w->occupied[list / TIMER_WHEEL_SLOTS] &= ~(1ull << (list & TW_MASK));
+
+    while (idx != TIMER_WHEEL_NIL)
+    {
+        uint32_t next = w->nodes[idx].next;
+        tw_place(w, idx);
+        idx = next;
+    }
+}
+
+//! Cascade slots of upper levels which begin on given tick.
+static void tw_cascade(timer_wheel_t *w, uint64_t tick)
+{
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; ++level)
+    {
+        unsigned slot = tw_slot_of(tick, level);
+        if (w->occupied[level] & (1ull << slot))
+            tw_rehash(w, tw_list_of(level, slot));
+
+        if (slot != 0)
+            return;
+    }
+
+    tw_rehash(w, TW_LIST_OVERFLOW);
+}
+
+static bool tw_grow(timer_wheel_t *w, uint32_t capacity)
+{
+    timer_wheel_node_t *nodes = realloc(w->nodes, capacity * sizeof *nodes);
+    if (nodes == NULL)
+        return false;
+
+    for (uint32_t i = w->capacity; i < capacity; ++i)
+    {
+        nodes[i].list = TIMER_WHEEL_NIL;
+        nodes[i].generation = 1;
+        nodes[i].next = i + 1 < capacity ? i + 1 : w->free_head;
+    }
+
+    w->free_head = w->capacity;
+    w->nodes = nodes;
+    w->capacity = capacity;
+    return true;
+}
+
+static void tw_release(timer_wheel_t *w, uint32_t idx)
+{
+    timer_wheel_node_t *n = w->nodes + idx;
+    n->list = TIMER_WHEEL_NIL;
+    n->generation = n->generation + 1 ? n->generation + 1 : 1;
+    n->next = w->free_head;
+    w->free_head = idx;
+    --w->count;
+}
+
+static timer_wheel_node_t *tw_lookup(timer_wheel_t const *w, timer_wheel_handle_t handle)
+{
+    uint32_t idx = (uint32_t)handle;
+    if (idx >= w->capacity)
+        return NULL;
+
+    timer_wheel_node_t *n = w->nodes + idx;
+    if (n->list == TIMER_WHEEL_NIL || n->generation != (uint32_t)(handle >> 32))
+        return NULL;
+    return n;
+}
+
+void timer_wheel_init(timer_wheel_t *w, size_t capacity, uint64_t now)
+{
+    memset(w, 0, sizeof *w);
+    w->next = now + 1;
+    w->free_head = TIMER_WHEEL_NIL;
+
+    for (size_t i = 0; i < TIMER_WHEEL_NUM_LISTS; ++i)
+        w->head[i] = w->tail[i] = TIMER_WHEEL_NIL;
+
+    tw_grow(w, capacity > 64 ? capacity : 64);
+}
+
+void timer_wheel_destroy(timer_wheel_t *w)
+{
+    free(w->nodes);
+    memset(w, 0, sizeof *w);
+}
+
+timer_wheel_handle_t timer_wheel_add(timer_wheel_t *w, uint64_t expires, void (*callback)(void *), void *arg)
+{
+    if (w->free_head == TIMER_WHEEL_NIL && !tw_grow(w, w->capacity ? w->capacity * 2 : 64))
+        return 0;
+
+    uint32_t idx = w->free_head;
+    timer_wheel_node_t *n = w->nodes + idx;
+    w->free_head = n->next;
+    ++w->count;
+
+    n->expires = expires;
+    n->callback = callback;
+    n->arg = arg;
+    tw_place(w, idx);
+
+    return (timer_wheel_handle_t)n->generation << 32 | idx;
+}
+
+bool timer_wheel_cancel(timer_wheel_t *w, timer_wheel_handle_t handle)
+{
+    timer_wheel_node_t *n = tw_lookup(w, handle);
+    if (n == NULL)
+        return false;
+
+    uint32_t idx = n - w->nodes;
+    tw_unlink(w, idx);
+    tw_release(w, idx);
+    return true;
+}
+
+bool timer_wheel_expiry(timer_wheel_t const *w, timer_wheel_handle_t handle, uint64_t *expires)
+{
+    timer_wheel_node_t const *n = tw_lookup(w, handle);
+    if (n == NULL)
+        return false;
+
+    *expires = n->expires;
+    return true;
+}
+
+//! Earliest tick from given one, which has level 0 slot to expire or upper level slot to cascade.
+static uint64_t tw_skip(timer_wheel_t const *w, uint64_t tick)
+{
+    if ((tick & TW_MASK) == 0)
+        return tick;
+
+    uint64_t pending = w->occupied[0] >> (tick & TW_MASK);
+    if (pending)
+        return tick + __builtin_ctzll(pending);
+    if (w->occupied[0])
+        return (tick | TW_MASK) + 1;
+
+    // Level 0 is empty. Jump over boundaries which have nothing to cascade.
+    uint64_t earliest = UINT64_MAX;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; ++level)
+    {
+        uint64_t occupied = w->occupied[level];
+        if (occupied == 0)
+            continue;
+
+        uint64_t span = 1ull << (level * TIMER_WHEEL_BITS);
+        uint64_t boundary = (tick + span - 1) & ~(span - 1);
+        unsigned begin = tw_slot_of(boundary, level);
+        uint64_t rotated = begin ? occupied >> begin | occupied << (TIMER_WHEEL_SLOTS - begin) : occupied;
+        uint64_t cascade = boundary + __builtin_ctzll(rotated) * span;
+
+        if (cascade < earliest)
+            earliest = cascade;
+    }
+
+    if (w->head[TW_LIST_OVERFLOW] != TIMER_WHEEL_NIL)
+    {
+        uint64_t period = 1ull << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS);
+        uint64_t cascade = (tick + period - 1) & ~(period - 1);
+
+        if (cascade < earliest)
+            earliest = cascade;
+    }
+
+    return earliest;
+}
+
+//! Call every timer in expiring list.
+static size_t tw_expire(timer_wheel_t *w)
+{
+    size_t num_expired = 0;
+    uint32_t idx;
+
+    // Callbacks may cancel timers still in the list, or grow node pool.
+    while ((idx = w->head[TW_LIST_EXPIRING]) != TIMER_WHEEL_NIL)
+    {
+        void (*callback)(void *) = w->nodes[idx].callback;
+        void *arg = w->nodes[idx].arg;
+
+        tw_unlink(w, idx);
+        tw_release(w, idx);
+        ++num_expired;
+
+        callback(arg);
+    }
+
+    return num_expired;
+}
+
+size_t timer_wheel_advance(timer_wheel_t *w, uint64_t now)
+{
+    // Timers added for ticks already processed
+    size_t num_expired = tw_expire(w);
+
+    for (uint64_t tick = tw_skip(w, w->next); tick <= now; tick = tw_skip(w, w->next))
+    {
+        // Cascaded timers are hashed relative to the tick being processed.
+        w->next = tick;
+        if ((tick & TW_MASK) == 0)
+            tw_cascade(w, tick);
+
+        // Timers added from callbacks below never go into the slot being expired.
+        w->next = tick + 1;
+
+        uint32_t list = tw_list_of(0, tick & TW_MASK);
+        if ((w->occupied[0] & (1ull << (tick & TW_MASK))) == 0)
+            continue;
+
+        for (uint32_t idx = w->head[list], next; idx != TIMER_WHEEL_NIL; idx = next)
+        {
+            next = w->nodes[idx].next;
+            tw_link(w, idx, TW_LIST_EXPIRING);
+        }
+        w->head[list] = w->tail[list] = TIMER_WHEEL_NIL;
+        w->occupied[0] &= ~(1ull << (tick & TW_MASK));
+
+        num_expired += tw_expire(w);
+    }
+
+    if (w->next <= now)
+        w->next = now + 1;
+
+    return num_expired;
+}
+
+bool timer_wheel_next_expiry(timer_wheel_t const *w, uint64_t *expires)
+{
+    bool found = false;
+    uint64_t earliest = UINT64_MAX;
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+    {
+        uint64_t occupied = w->occupied[level];
+        if (occupied == 0)
+            continue;
+
+        // Current slot of level is still pending only if its cascade hasn't happened yet.
+        unsigned begin = tw_slot_of(w->next, level);
+        uint64_t span_mask = (1ull << (level * TIMER_WHEEL_BITS)) - 1;
+        if (w->next & span_mask)
+            begin = (begin + 1) & TW_MASK;
+
+        // Rotate so that first set bit is the nearest slot in time.
+        uint64_t rotated = begin ? occupied >> begin | occupied << (TIMER_WHEEL_SLOTS - begin) : occupied;
+        unsigned slot = (begin + __builtin_ctzll(rotated)) & TW_MASK;
+
+        for (uint32_t idx = w->head[tw_list_of(level, slot)]; idx != TIMER_WHEEL_NIL; idx = w->nodes[idx].next)
+        {
+            if (w->nodes[idx].expires < earliest)
+                earliest = w->nodes[idx].expires;
+        }
+        found = true;
+    }
+
+    uint32_t const unsorted[] = {TW_LIST_OVERFLOW, TW_LIST_EXPIRING};
+    for (size_t i = 0; i < 2; ++i)
+    {
+        for (uint32_t idx = w->head[unsorted[i]]; idx != TIMER_WHEEL_NIL; idx = w->nodes[idx].next)
+        {
+            if (w->nodes[idx].expires < earliest)
+                earliest = w->nodes[idx].expires;
+            found = true;
+        }
+    }
+
+    if (found)
+        *expires = earliest;
+    return found;
+}
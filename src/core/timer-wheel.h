@@ -0,0 +1,101 @@
+/*! \brief Hierarchical timing wheel
+    \file timer-wheel.h
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-07
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Timers are hashed into 64 slots of one of levels by their distance from current tick.
+        Each level covers 64 times longer span than the level below, and its slots are cascaded
+        into lower levels as time reaches them. Timers beyond the top level wait in an overflow list.
+        Adding and canceling timer is O(1). Advancing skips empty slots by occupancy bitmaps, and
+        expires every timer of a slot at once.
+
+        Unit of tick is up to user. Node pool grows on demand.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 6
+// Level slots, then overflow list and list of timers being expired.
+#define TIMER_WHEEL_NUM_LISTS (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS + 2)
+#define TIMER_WHEEL_NIL UINT32_MAX
+
+/*! \brief Handle of timer. Zero is invalid handle. Handle of expired or canceled timer is detected as invalid. */
+typedef uint64_t timer_wheel_handle_t;
+
+typedef struct timer_wheel_node
+{
+    uint64_t expires;
+    void (*callback)(void *);
+    void *arg;
+
+    // Doubly linked list in one of wheel's lists. Indices of nodes.
+    uint32_t next, prev;
+    // List which holds this node. TIMER_WHEEL_NIL if node is free.
+    uint32_t list;
+    // Increased whenever node is released, to invalidate handles.
+    uint32_t generation;
+} timer_wheel_node_t;
+
+typedef struct timer_wheel
+{
+    // Next tick to process. Every tick before it has been processed.
+    uint64_t next;
+
+    timer_wheel_node_t *nodes;
+    uint32_t capacity;
+    uint32_t free_head;
+    size_t count;
+
+    uint32_t head[TIMER_WHEEL_NUM_LISTS];
+    uint32_t tail[TIMER_WHEEL_NUM_LISTS];
+    // Non-empty slots of each level.
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+} timer_wheel_t;
+
+/*! \brief Initialize wheel.
+    \param capacity Number of timer nodes to allocate first.
+    \param now Current tick.
+ */
+void timer_wheel_init(timer_wheel_t *w, size_t capacity, uint64_t now);
+
+//! Release wheel memory. Pending timers are discarded without being called.
+void timer_wheel_destroy(timer_wheel_t *w);
+
+/*! \brief Add timer which expires on given tick. Timer of current or past tick expires on next advance, even if time doesn't change.
+    \return Handle of timer. Zero if out of memory.
+ */
+timer_wheel_handle_t timer_wheel_add(timer_wheel_t *w, uint64_t expires, void (*callback)(void *), void *arg);
+
+/*! \brief Cancel pending timer.
+    \return false if timer has already expired or canceled.
+ */
+bool timer_wheel_cancel(timer_wheel_t *w, timer_wheel_handle_t handle);
+
+//! Tick which wheel has been advanced to.
+static inline uint64_t timer_wheel_now(timer_wheel_t const *w)
+{
+    return w->next - 1;
+}
+
+/*! \brief Find expiry tick of pending timer.
+    \return false if timer has already expired or canceled.
+ */
+bool timer_wheel_expiry(timer_wheel_t const *w, timer_wheel_handle_t handle, uint64_t *expires);
+
+/*! \brief Advance current tick, calling every timer which expires until then in order of expiry.
+    \details Callbacks can add or cancel timers, including ones expiring in same advance.
+    \return Number of expired timers.
+ */
+size_t timer_wheel_advance(timer_wheel_t *w, uint64_t now);
+
+/*! \brief Find tick of earliest pending timer, without advancing.
+    \return false if there's no pending timer.
+ */
+bool timer_wheel_next_expiry(timer_wheel_t const *w, uint64_t *expires);
@@ -19,11 +19,11 @@
 #include <stdbool.h>
 #include <signal.h>
 #include "core/program.h"
-#include <time.h>
-#include <sys/time.h>
+#include "core/frame-pacer.h"
 
 #define DESIRED_DELTA_TIME (1.0 / 120.0)
 #define RENDERING_PERIOD 5
+#define PATH_RESOURCE_PACK "../resource.pak"
 
 bool g_bRun = true;
 static double g_TimeInSeconds;
@@ -38,16 +38,21 @@ void sigint_handler(int signo)
 {
     lvlog(LOGLEVEL_INFO, "SIG %d RECV\n", signo);
     g_bRun = false;
+    if (g_pInst)
+        PInst_Wake(g_pInst);
 }
 
-static inline uint64_t time_in_100usec(struct timeval const *v)
+/*! \brief Rendering period in updates, rounded up to whole number of refresh intervals.
+    Frame which finishes between vertical blanks would wait for next one anyway.
+ */
+static size_t CalcRenderingPeriod(float RefreshInterval)
 {
-    return v->tv_sec * 10000ull + v->tv_usec / 100;
-}
+    if (RefreshInterval <= 0.0f)
+        return RENDERING_PERIOD;
 
-static inline double time_100usec_to_sec(uint64_t usec)
-{
-    return usec / 10000.0;
+    int numRefresh = (int)(RENDERING_PERIOD * DESIRED_DELTA_TIME / RefreshInterval + 0.999);
+    size_t period = (size_t)(numRefresh * RefreshInterval / DESIRED_DELTA_TIME + 0.5);
+    return period ? period : 1;
 }
 
 int main(int argc, char *argv[])
@@ -68,56 +73,66 @@ int main(int argc, char *argv[])
         init.NumMaxDrawCall = 0x8000;
         init.NumMaxResource = 0x2000;
         init.RenderStringPoolSize = 0x4000;
+        init.bEnableVSync = true;
+        init.TargetFrameTime = RENDERING_PERIOD * DESIRED_DELTA_TIME;
 
         g_pInst = program = PInst_Create(&init);
     }
     uassert(g_pInst);
 
-    // Timer to elapse delta time.
-    struct timeval tv;
-    double prev_tick, curtime;
-    float delta;
-    gettimeofday(&tv, NULL);
-    curtime = prev_tick = time_100usec_to_sec(time_in_100usec(&tv));
+    // Pre-decoded resources built by resource_pack target. Resources are loaded from files without it.
+    PInst_MountResourcePack(program, PATH_RESOURCE_PACK);
+
+    // Paces updates to delta time.
+    FFramePacer pacer;
+    uint64_t curtime;
 
     void OnUpdate(float DeltaTime);
+    bool OnQueryIdle(void);
     void OnDestroyGameInstance();
     OnInitGame();
 
-    const size_t render_period_add[2] = {1, 1 - RENDERING_PERIOD};
+    size_t render_period = RENDERING_PERIOD;
     size_t render_period_counter = 0;
+    FramePacer_Init(&pacer, Clock_FromSeconds(DESIRED_DELTA_TIME));
 
     // Main program loop
     while (g_bRun)
     {
         PInst_SetRenderingLock(g_pInst, render_period_counter != 0);
-        render_period_counter += render_period_add[render_period_counter == (RENDERING_PERIOD - 1)];
-        // Wait until delta seconds
-        for (; (delta = curtime - prev_tick) < DESIRED_DELTA_TIME;)
+        if (++render_period_counter >= render_period)
         {
-            gettimeofday(&tv, NULL);
-            curtime = time_100usec_to_sec(time_in_100usec(&tv));
-            // pthread_yield(NULL);
+            render_period_counter = 0;
+            render_period = CalcRenderingPeriod(PInst_GetRefreshInterval(program));
         }
-        prev_tick = curtime;
-        g_TimeInSeconds = curtime;
+        // Wait until delta seconds
+        curtime = FramePacer_Wait(&pacer);
+        g_TimeInSeconds = Clock_ToSeconds(curtime);
 
-        // Update program timer
-        PInst_UpdateTimer(program, delta);
+        // Every module sees same timestamp during the frame
+        PInst_UpdateTimer(program, curtime);
 
         // Update game state
-        OnUpdate(delta);
+        OnUpdate(PInst_GetDeltaTime(program));
 
         // Flip Buffer
         EStatus flip_result;
-        while (g_bRun && (flip_result = PInst_Flip(program)) != STATUS_OK)
+        while ((flip_result = PInst_Flip(program)) == RENDERER_BUSY && g_bRun)
+            PInst_WaitRendererIdle(program);
+
+        // Nothing changed on screen and nothing animates. Sleep until input or timer.
+        if (g_bRun && flip_result == STATUS_OK && PInst_IsFrameStatic(program) && OnQueryIdle())
         {
-            if (flip_result == RENDERER_LOCKED)
-                break;
+            PInst_WaitForActivity(program);
+            FramePacer_Resync(&pacer);
+
+            // Draw response on next frame
+            render_period_counter = 0;
         }
 
-        lvlog(LOGLEVEL_VERBOSE + 1000, "Update() called. Cur time is %f\n", curtime);
+        lvlog(LOGLEVEL_VERBOSE + 1000, "Update() called. Cur time is %f\n", g_TimeInSeconds);
     }
+    FramePacer_DumpStats(&pacer);
     OnDestroyGameInstance();
     PInst_Destroy(program);
 
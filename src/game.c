@@ -1,6 +1,8 @@
 #include "game.h"
 #include "uEmbedded/algorithm.h"
 #include <cairo.h>
+#include <time.h>
+#include <sys/ioctl.h>
 
 // #### DECLARATIONS ####
 // -- INPUT PROCEDURE
@@ -82,7 +84,7 @@ void OnInitGame()
     // Load Background Image
     gBackgroundSurface = cairo_image_surface_create_from_png("../resource/image/Background_image.png");
 
-    // Load resources
+    // Load resources. Font is used on every screen, thus its reference is kept to pin it.
     PInst_LoadResource(
         g_pInst,
         RESOURCE_FONT,
@@ -207,6 +209,22 @@ void OnUpdate(float DeltaTime)
     }
 }
 
+/*! \brief Whether main loop may sleep until input or timer.
+    Screens without game update method change only on input and timers, unless a widget animates.
+ */
+bool OnQueryIdle(void)
+{
+    if (internal__update_game__)
+        return false;
+
+    for (size_t i = 0; i < gWidgetTop; i++)
+    {
+        if (gWidgets[i].Update)
+            return false;
+    }
+    return true;
+}
+
 static inline void *GameData() { return internal__game_data; }
 
 static void *ChangeGameState(void (*UpdateMethod)(float), void (*OnChangeOut)(), size_t ModDataSize)
@@ -240,6 +258,11 @@ static void *InputProcedure(void *dev)
         g_bRun = false;
     }
 
+    // Event timestamps are wall clock by default.
+    int clockid = CLOCK_MONOTONIC;
+    if (ioctl(fd, EVIOCSCLOCKID, &clockid) == -1)
+        lvlog(LOGLEVEL_WARNING, "Failed to set input clock. Touch timestamps are unreliable.\n");
+
     // Input event array
     struct input_event ev[Max_Input_Event];
     struct input_event *ph;
@@ -298,6 +321,7 @@ static void *InputProcedure(void *dev)
                 break;
             }
         }
+        input.time = ev[numRead].input_event_sec * CLOCK_NS_PER_SEC + ev[numRead].input_event_usec * CLOCK_NS_PER_US;
 
         // static char const *ABS_MSG[] = {"ABS_MT_RESERVED", "ABS_MT_SLOT", "ABS_MT_TOUCH_MAJOR", "ABS_MT_TOUCH_MINOR", "ABS_MT_WIDTH_MAJOR", "ABS_MT_WIDTH_MINOR", "ABS_MT_ORIENTATION", "ABS_MT_POSITION_X", "ABS_MT_POSITION_Y", "ABS_MT_TOOL_TYPE", "ABS_MT_BLOB_ID", "ABS_MT_TRACKING_ID", "ABS_MT_PRESSURE", "ABS_MT_DISTANCE", "ABS_MT_TOOL_X", "ABS_MT_TOOL_Y"};
 
@@ -410,6 +434,7 @@ void EnqueueInputEvent(struct touchinput const *ev)
     // logprintf("slot %d - %s, [%d, %d] \n", ev->slot, TOUCHEV_STR[ev->type], ev->x, ev->y);
     gInputEventQueue[gInputEventSubmitIdx] = *ev;
     gInputEventSubmitIdx += idx_add[gInputEventSubmitIdx == countof(gInputEventQueue) - 1];
+    PInst_Wake(g_pInst);
 }
 
 size_t DequeueInputEvent(struct touchinput *ev, size_t max)
@@ -452,6 +477,8 @@ static UResource *LoadImagePath(char const *Path)
           v == STATUS_OK ? "Loaded" : "Find",
           Path, hash, ret);
 
+    // Handle stays valid after eviction, thus images are left unpinned to be counted to memory budget.
+    PInst_ReleaseResource(g_pInst, ret);
     return ret;
 }
 
@@ -507,6 +534,13 @@ static void RefindDigitImage()
     }
 }
 
+static void OnImageLoaded(void *Path, UResource *Image)
+{
+    if (Image == NULL)
+        lvlog(LOGLEVEL_WARNING, "Failed to load image %s\n", Path ? (char const *)Path : "(digit)");
+    PInst_ReleaseResource(g_pInst, Image);
+}
+
 static void LoadAllImage()
 {
     static char const *IMGPATHS[] =
@@ -530,24 +564,57 @@ static void LoadAllImage()
             PATH_IMG_EFFECT_SLASH_02,
             PATH_IMG_EFFECT_SLASH_03,
             PATH_IMG_EFFECT_SLASH_04,
-            PATH_IMG_GAMEOVER,
             PATH_IMG_EFFECT_BOMB,
             PATH_IMG_KEY_BTN_UP,
             PATH_IMG_KEY_BTN_DN,
+        };
+
+    // Images shown on a single screen are decoded when the screen is drawn first.
+    static char const *LAZYPATHS[] =
+        {
+            PATH_IMG_GAMEOVER,
             PATH_IMG_RANKINGS,
         };
 
+    uint64_t begin = Clock_Now();
+
+    // Decode every image on loader threads
     for (size_t i = 0; i < countof(IMGPATHS); i++)
     {
-        LoadImagePath(IMGPATHS[i]);
+        PInst_LoadResourceAsync(
+            g_pInst, RESOURCE_IMAGE, hash_djb2(IMGPATHS[i]), IMGPATHS[i],
+            LOADRESOURCE_IMAGE_DEFAULT, OnImageLoaded, (void *)IMGPATHS[i]);
+    }
+
+    char buff[1024];
+    for (size_t i = 0; i < countof(rsrcDigit); i++)
+    {
+        sprintf(buff, "../resource/image/num/Num_%d.png", i);
+        PInst_LoadResourceAsync(
+            g_pInst, RESOURCE_IMAGE, hash_djb2(buff), buff,
+            LOADRESOURCE_IMAGE_DEFAULT, OnImageLoaded, NULL);
+    }
+    PInst_WaitAllResourceLoads(g_pInst);
+
+    lvlog(LOGLEVEL_INFO, "Loaded %zu images in %.1f ms\n",
+          countof(IMGPATHS) + countof(rsrcDigit),
+          (Clock_Now() - begin) * 1e-6);
+
+    for (size_t i = 0; i < countof(LAZYPATHS); i++)
+    {
+        UResource *rs;
+        PInst_LoadResource(
+            g_pInst, RESOURCE_IMAGE, hash_djb2(LAZYPATHS[i]), LAZYPATHS[i],
+            LOADRESOURCE_FLAG_LAZY, &rs);
+        PInst_ReleaseResource(g_pInst, rs);
     }
 
-    // Generate Digits
-    RefindDigitImage(); // Generate
+    // Locate digits
+    RefindDigitImage();
 
-    // Load invalidated references again
-    RefindDigitImage(); // Locate
-    rsrcDefaultFont = PInst_GetResource(g_pInst, FONT_HASH);
+    // Pack all images loaded so far into atlases
+    PInst_BuildImageAtlas(g_pInst);
+    PInst_DumpResources(g_pInst);
 }
 
 //=====================================================================//
@@ -671,6 +738,10 @@ static void PreStartGame_Timer(void *v)
 #define MIN_SLASH_VELOCITY_SQUARE (1.0f * 1.0f)
 #define GRAVITY_CONSTANT_Y 0.7f
 #define MAX_INTERVAL 1.0f
+// Simulation steps per second. Zero simulates once per frame by frame delta instead.
+#define SIMULATION_RATE 120
+// Steps simulated in a single frame at most. Time beyond it is dropped, rather than falling behind further.
+#define MAX_SIMULATION_STEPS 8
 
 enum
 {
@@ -705,6 +776,8 @@ typedef struct obj
     // In Game Coordinate
     FVec2float Position;
     FVec2float Velocity;
+    // Position before last simulation step. Drawn position is interpolated between two.
+    FVec2float PrevPosition;
     UResource *Display;
     // If type is positive value, it means point.
     int Type;
@@ -727,6 +800,8 @@ typedef struct gameplayinfo
     float Interval;
     float IntervalAcc;
     float LifeSpan;
+    // Frame time not simulated yet, less than a step.
+    float StepAcc;
     char buffScore[256];
 
     FWidget *wtime[3];
@@ -749,6 +824,9 @@ static bool Trigger_Pause(FWidget *w)
 
 static void InitGameplay(void)
 {
+    // Game over screen follows this session.
+    PInst_PrefetchResource(g_pInst, PInst_GetResource(g_pInst, hash_djb2(PATH_IMG_GAMEOVER)));
+
     ClearAllWidgetObject();
     FGameInfo *s = ChangeGameState(UpdateGame, NULL, sizeof(FGameInfo));
     memset(s, 0, sizeof(FGameInfo));
@@ -820,6 +898,7 @@ static FObj *Game_SpawnObj(FGameInfo *s, int Layer, float Lifespan, FVec2float P
     }
     FObj *ret = &s->objects[s->objectTop++];
     ret->Position = Pos;
+    ret->PrevPosition = Pos;
     ret->Layer = Layer;
     ret->Velocity = Vel;
     ret->Type = Type;
@@ -837,10 +916,11 @@ static float randf(float scale)
 static void InitGameOverScreen(int Score);
 
 #define SLASH_EFFECT_VELOCITY_SCALE 0.33f
-static void UpdateGame(float delta)
+/*! \brief Slash objects under touch.
+    \return false if session has ended.
+ */
+static bool Game_HandleTouch(FGameInfo *s, float delta)
 {
-    FGameInfo *s = GameData();
-
     // Update touch ...
     // - Determine collisions
     // - Update scores
@@ -891,7 +971,7 @@ static void UpdateGame(float delta)
                     {
                         // Spawn bomb effect object
                         InitGameOverScreen(s->Score);
-                        return;
+                        return false;
                     }
                     else if (obj->Type < 0)
                     {
@@ -910,6 +990,16 @@ static void UpdateGame(float delta)
             }
         }
     }
+    return true;
+}
+
+/*! \brief Advance game by a simulation step.
+    \return false if session has ended.
+ */
+static bool Game_Simulate(FGameInfo *s, float delta)
+{
+    for (size_t i = 0; i < s->objectTop; i++)
+        s->objects[i].PrevPosition = s->objects[i].Position;
 
     // Randomly spawn object on every interval returns.
     s->IntervalAcc += delta;
@@ -979,6 +1069,31 @@ static void UpdateGame(float delta)
             --i;
             continue;
         }
+    }
+
+    // Update time
+    s->TimeLeft -= delta;
+
+    // If game is over ...
+    if (s->TimeLeft < 0)
+    {
+        // @todo. Game Over;
+        InitGameOverScreen(s->Score);
+        return false;
+    }
+
+    return true;
+}
+
+/*! \brief Draw objects between previous and current simulation step.
+    \param Alpha Progress from previous step to current one.
+ */
+static void Game_Draw(FGameInfo *s, float Alpha)
+{
+    FTransform2 tr = FTransform2_Zero();
+    for (size_t i = 0; i < s->objectTop; i++)
+    {
+        FObj *obj = s->objects + i;
 
         // Draw object
         if (obj->Display == NULL)
@@ -986,12 +1101,11 @@ static void UpdateGame(float delta)
             lvlog(LOGLEVEL_WARNING, "Object resource is not loaded correctly!\n");
             continue;
         }
-        PInst_RQueueImage(g_pInst, obj->Layer, &obj->Position, obj->Display, true);
+        FVec2float Travel = VEC2_SUB(float, obj->Position, obj->PrevPosition);
+        tr.P = VEC2_ADD(float, obj->PrevPosition, VEC2_SCALE(float, Travel, Alpha));
+        PInst_RQueueImage(g_pInst, obj->Layer, &tr, obj->Display, true);
     }
 
-    // Update time
-    s->TimeLeft -= delta;
-
     // Update fancies
     sprintf(s->buffScore, "SCORE %15d", s->Score);
     int left = (int)(s->TimeLeft * 10.f);
@@ -1000,13 +1114,35 @@ static void UpdateGame(float delta)
         s->wtime[i]->ImageDefault = rsrcDigit[left % 10];
         left /= 10;
     }
+}
 
-    // If game is over ...
-    if (s->TimeLeft < 0)
+static void UpdateGame(float delta)
+{
+    FGameInfo *s = GameData();
+
+    if (Game_HandleTouch(s, delta) == false)
+        return;
+
+    if (SIMULATION_RATE <= 0)
     {
-        // @todo. Game Over;
-        InitGameOverScreen(s->Score);
+        if (Game_Simulate(s, delta))
+            Game_Draw(s, 1.0f);
+        return;
     }
+
+    // Simulate in fixed steps as much time as passed.
+    float const step = 1.0f / SIMULATION_RATE;
+    s->StepAcc += delta;
+    if (s->StepAcc > step * MAX_SIMULATION_STEPS)
+        s->StepAcc = step * MAX_SIMULATION_STEPS;
+
+    for (; s->StepAcc >= step; s->StepAcc -= step)
+    {
+        if (Game_Simulate(s, step) == false)
+            return;
+    }
+
+    Game_Draw(s, s->StepAcc / step);
 }
 
 //=====================================================================//
@@ -36,6 +36,8 @@ typedef struct touchinput
     int16_t x, y;
     int8_t type;
     int8_t slot;
+    // Timestamp of event, on same clock as frame timestamp.
+    uint64_t time;
 } touchinput_t;
 
 typedef struct widget
@@ -0,0 +1,505 @@
+/*! \brief Software pixel kernels
+    \file program-blit.c
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-02
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+ */
+#include "program-blit.h"
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BLIT_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BLIT_SSE2 1
+#endif
+
+#define ALPHA_MASK 0xff000000u
+
+//! x * a / 255 for each channel, rounded in same way pixman does.
+static inline uint32_t px_mul_un8(uint32_t x, uint32_t a)
+{
+    uint32_t rb = (x & 0x00ff00ff) * a + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+    uint32_t ag = ((x >> 8) & 0x00ff00ff) * a + 0x00800080;
+    ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+    return rb | ag;
+}
+
+//! Saturated addition for each channel.
+static inline uint32_t px_add_un8(uint32_t x, uint32_t y)
+{
+    uint32_t rb = (x & 0x00ff00ff) + (y & 0x00ff00ff);
+    rb = (rb | (0x01000100 - ((rb >> 8) & 0x00010001))) & 0x00ff00ff;
+    uint32_t ag = ((x >> 8) & 0x00ff00ff) + ((y >> 8) & 0x00ff00ff);
+    ag = (ag | (0x01000100 - ((ag >> 8) & 0x00010001))) & 0x00ff00ff;
+    return rb | (ag << 8);
+}
+
+static inline uint32_t px_over(uint32_t s, uint32_t d)
+{
+    uint32_t ia = ~s >> 24;
+    if (ia == 0)
+        return s;
+    if (ia == 0xff)
+        return d;
+    return px_add_un8(s, px_mul_un8(d, ia));
+}
+
+static void span_over(uint32_t *d, uint32_t const *s, int n)
+{
+#if defined(BLIT_NEON)
+    for (; n >= 8; n -= 8, s += 8, d += 8)
+    {
+        uint8x8x4_t vs = vld4_u8((uint8_t const *)s);
+        uint8x8x4_t vd = vld4_u8((uint8_t const *)d);
+        uint8x8_t ia = vmvn_u8(vs.val[3]);
+
+        for (int c = 0; c < 4; c++)
+        {
+            uint16x8_t t = vmull_u8(vd.val[c], ia);
+            vd.val[c] = vqadd_u8(vs.val[c], vraddhn_u16(t, vrshrq_n_u16(t, 8)));
+        }
+        vst4_u8((uint8_t *)d, vd);
+    }
+#elif defined(BLIT_SSE2)
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const amask = _mm_set1_epi32(ALPHA_MASK);
+    __m128i const c0080 = _mm_set1_epi16(0x0080);
+    __m128i const c0101 = _mm_set1_epi16(0x0101);
+    __m128i const c00ff = _mm_set1_epi16(0x00ff);
+
+    for (; n >= 4; n -= 4, s += 4, d += 4)
+    {
+        __m128i vs = _mm_loadu_si128((__m128i const *)s);
+        __m128i a = _mm_and_si128(vs, amask);
+
+        // Skip fully transparent, copy fully opaque
+        int m = _mm_movemask_epi8(_mm_cmpeq_epi32(a, zero));
+        if (m == 0xffff)
+            continue;
+        m = _mm_movemask_epi8(_mm_cmpeq_epi32(a, amask));
+        if (m == 0xffff)
+        {
+            _mm_storeu_si128((__m128i *)d, vs);
+            continue;
+        }
+
+        __m128i vd = _mm_loadu_si128((__m128i const *)d);
+        __m128i slo = _mm_unpacklo_epi8(vs, zero);
+        __m128i shi = _mm_unpackhi_epi8(vs, zero);
+        __m128i dlo = _mm_unpacklo_epi8(vd, zero);
+        __m128i dhi = _mm_unpackhi_epi8(vd, zero);
+
+        // Broadcast inverse alpha to every channel of each pixel
+        __m128i ialo = _mm_xor_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xff), 0xff), c00ff);
+        __m128i iahi = _mm_xor_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xff), 0xff), c00ff);
+
+        dlo = _mm_mulhi_epu16(_mm_adds_epu16(_mm_mullo_epi16(dlo, ialo), c0080), c0101);
+        dhi = _mm_mulhi_epu16(_mm_adds_epu16(_mm_mullo_epi16(dhi, iahi), c0080), c0101);
+
+        _mm_storeu_si128((__m128i *)d, _mm_adds_epu8(vs, _mm_packus_epi16(dlo, dhi)));
+    }
+#endif
+
+    for (; n; --n)
+    {
+        *d = px_over(*s++, *d);
+        ++d;
+    }
+}
+
+static void span_copy_opaque(uint32_t *d, uint32_t const *s, int n)
+{
+#if defined(BLIT_NEON)
+    uint32x4_t const amask = vdupq_n_u32(ALPHA_MASK);
+    for (; n >= 4; n -= 4, s += 4, d += 4)
+        vst1q_u32(d, vorrq_u32(vld1q_u32(s), amask));
+#elif defined(BLIT_SSE2)
+    __m128i const amask = _mm_set1_epi32(ALPHA_MASK);
+    for (; n >= 4; n -= 4, s += 4, d += 4)
+        _mm_storeu_si128((__m128i *)d, _mm_or_si128(_mm_loadu_si128((__m128i const *)s), amask));
+#endif
+
+    for (; n; --n)
+        *d++ = *s++ | ALPHA_MASK;
+}
+
+static void span_fill(uint32_t *d, uint32_t c, int n)
+{
+#if defined(BLIT_NEON)
+    uint32x4_t const vc = vdupq_n_u32(c);
+    for (; n >= 4; n -= 4, d += 4)
+        vst1q_u32(d, vc);
+#elif defined(BLIT_SSE2)
+    __m128i const vc = _mm_set1_epi32(c);
+    for (; n >= 4; n -= 4, d += 4)
+        _mm_storeu_si128((__m128i *)d, vc);
+#endif
+
+    for (; n; --n)
+        *d++ = c;
+}
+
+static void span_fill_over(uint32_t *d, uint32_t c, int n)
+{
+    uint32_t ia = ~c >> 24;
+
+#if defined(BLIT_NEON)
+    uint8x8x4_t vc;
+    for (int i = 0; i < 4; i++)
+        vc.val[i] = vdup_n_u8((c >> (8 * i)) & 0xff);
+    uint8x8_t const via = vdup_n_u8(ia);
+
+    for (; n >= 8; n -= 8, d += 8)
+    {
+        uint8x8x4_t vd = vld4_u8((uint8_t const *)d);
+        for (int i = 0; i < 4; i++)
+        {
+            uint16x8_t t = vmull_u8(vd.val[i], via);
+            vd.val[i] = vqadd_u8(vc.val[i], vraddhn_u16(t, vrshrq_n_u16(t, 8)));
+        }
+        vst4_u8((uint8_t *)d, vd);
+    }
+#elif defined(BLIT_SSE2)
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const vc = _mm_set1_epi32(c);
+    __m128i const via = _mm_set1_epi16(ia);
+    __m128i const c0080 = _mm_set1_epi16(0x0080);
+    __m128i const c0101 = _mm_set1_epi16(0x0101);
+
+    for (; n >= 4; n -= 4, d += 4)
+    {
+        __m128i vd = _mm_loadu_si128((__m128i const *)d);
+        __m128i dlo = _mm_unpacklo_epi8(vd, zero);
+        __m128i dhi = _mm_unpackhi_epi8(vd, zero);
+
+        dlo = _mm_mulhi_epu16(_mm_adds_epu16(_mm_mullo_epi16(dlo, via), c0080), c0101);
+        dhi = _mm_mulhi_epu16(_mm_adds_epu16(_mm_mullo_epi16(dhi, via), c0080), c0101);
+
+        _mm_storeu_si128((__m128i *)d, _mm_adds_epu8(vc, _mm_packus_epi16(dlo, dhi)));
+    }
+#endif
+
+    for (; n; --n, ++d)
+        *d = px_add_un8(c, px_mul_un8(*d, ia));
+}
+
+void fill_rect(pixel_plane_t const *dst, pixel_rect_t const *clip, pixel_rect_t const *rect, uint32_t color)
+{
+    pixel_rect_t r = {0, 0, dst->w, dst->h};
+    if (clip && !rect_intersect(&r, clip))
+        return;
+    if (!rect_intersect(&r, rect))
+        return;
+
+    // Fully transparent color does nothing.
+    if ((color & ALPHA_MASK) == 0)
+        return;
+
+    void (*span)(uint32_t *, uint32_t, int) = (color & ALPHA_MASK) == ALPHA_MASK ? span_fill : span_fill_over;
+    char *d = (char *)dst->data + r.y0 * dst->stride + r.x0 * 4;
+    for (int row = r.y0; row < r.y1; ++row, d += dst->stride)
+        span((uint32_t *)d, color, r.x1 - r.x0);
+}
+
+void blit_over(pixel_plane_t const *dst, pixel_rect_t const *clip, pixel_plane_t const *src, int x, int y, bool bOpaque)
+{
+    pixel_rect_t r = {0, 0, dst->w, dst->h};
+    pixel_rect_t const srect = {x, y, x + src->w, y + src->h};
+    if (clip && !rect_intersect(&r, clip))
+        return;
+    if (!rect_intersect(&r, &srect))
+        return;
+
+    int n = r.x1 - r.x0;
+    char *d = (char *)dst->data + r.y0 * dst->stride + r.x0 * 4;
+    char const *s = (char const *)src->data + (r.y0 - y) * src->stride + (r.x0 - x) * 4;
+
+    for (int row = r.y0; row < r.y1; ++row, d += dst->stride, s += src->stride)
+    {
+        if (bOpaque)
+            span_copy_opaque((uint32_t *)d, (uint32_t const *)s, n);
+        else
+            span_over((uint32_t *)d, (uint32_t const *)s, n);
+    }
+}
+
+// 4x4 Bayer matrix. Scaled to quantization step of each channel when applied.
+static uint8_t const bayer4x4[4][4] = {
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5},
+};
+
+static inline uint16_t px_to_565(uint32_t p, bool bSwapRB)
+{
+    uint32_t r = (p >> 19) & 0x1f, g = (p >> 10) & 0x3f, b = (p >> 3) & 0x1f;
+    return bSwapRB ? b << 11 | g << 5 | r : r << 11 | g << 5 | b;
+}
+
+static void span_rgb565_dither(uint16_t *d, uint32_t const *s, int n, int y, bool bSwapRB)
+{
+    uint8_t const *row = bayer4x4[y & 3];
+
+    // Dither offsets of 4 consecutive pixels, in pixel layout. 5 bit channels quantize by 8, 6 bit by 4.
+    uint32_t dither[4];
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t d5 = row[i] >> 1, d6 = row[i] >> 2;
+        dither[i] = d5 << 16 | d6 << 8 | d5;
+    }
+
+    int x = 0;
+#if defined(BLIT_NEON)
+    uint8x8_t vd5, vd6;
+    {
+        uint8_t d5[8], d6[8];
+        for (int i = 0; i < 8; i++)
+            d5[i] = row[i & 3] >> 1, d6[i] = row[i & 3] >> 2;
+        vd5 = vld1_u8(d5);
+        vd6 = vld1_u8(d6);
+    }
+
+    for (; x + 8 <= n; x += 8)
+    {
+        uint8x8x4_t v = vld4_u8((uint8_t const *)(s + x));
+        uint8x8_t b = vqadd_u8(v.val[0], vd5);
+        uint8x8_t g = vqadd_u8(v.val[1], vd6);
+        uint8x8_t r = vqadd_u8(v.val[2], vd5);
+        if (bSwapRB)
+        {
+            uint8x8_t t = r;
+            r = b;
+            b = t;
+        }
+
+        uint16x8_t o = vshll_n_u8(r, 8);
+        o = vsriq_n_u16(o, vshll_n_u8(g, 8), 5);
+        o = vsriq_n_u16(o, vshll_n_u8(b, 8), 11);
+        vst1q_u16(d + x, o);
+    }
+#elif defined(BLIT_SSE2)
+    __m128i const vdither = _mm_loadu_si128((__m128i const *)dither);
+    __m128i const mr = _mm_set1_epi32(0xf800);
+    __m128i const mg = _mm_set1_epi32(0x07e0);
+    __m128i const mb = _mm_set1_epi32(0x001f);
+
+    for (; x + 8 <= n; x += 8)
+    {
+        __m128i v[2];
+        for (int k = 0; k < 2; k++)
+        {
+            __m128i p = _mm_adds_epu8(_mm_loadu_si128((__m128i const *)(s + x + 4 * k)), vdither);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), mg);
+            __m128i rb = bSwapRB
+                             ? _mm_or_si128(_mm_and_si128(_mm_slli_epi32(p, 8), mr), _mm_and_si128(_mm_srli_epi32(p, 19), mb))
+                             : _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 8), mr), _mm_and_si128(_mm_srli_epi32(p, 3), mb));
+
+            // Sign extend, so signed saturating pack keeps every 16 bit value.
+            v[k] = _mm_srai_epi32(_mm_slli_epi32(_mm_or_si128(g, rb), 16), 16);
+        }
+        _mm_storeu_si128((__m128i *)(d + x), _mm_packs_epi32(v[0], v[1]));
+    }
+#endif
+
+    // Vector loops consume multiple of 4 pixels, thus dither phase is continued from x.
+    for (; x < n; x++)
+    {
+        uint32_t p = s[x];
+        uint32_t t = dither[x & 3];
+        p = px_add_un8(p & 0x00ffffff, t);
+        d[x] = px_to_565(p, bSwapRB);
+    }
+}
+
+void convert_rgb565_dither(uint16_t *dst, int dst_stride, pixel_plane_t const *src, bool bSwapRB)
+{
+    char const *s = (char const *)src->data;
+    char *d = (char *)dst;
+    for (int y = 0; y < src->h; ++y, s += src->stride, d += dst_stride)
+        span_rgb565_dither((uint16_t *)d, (uint32_t const *)s, src->w, y, bSwapRB);
+}
+
+// Bilinear weights have 7 bits of precision, so weighted sum of two 8 bit values fits in 16 bits.
+#define BILINEAR_BITS 7
+#define BILINEAR_ONE (1 << BILINEAR_BITS)
+
+//! Blend two rows with weight of b, for each channel.
+static void span_lerp_rows(uint32_t *d, uint32_t const *a, uint32_t const *b, int f, int n)
+{
+#if defined(BLIT_NEON)
+    uint8x8_t const wa = vdup_n_u8(BILINEAR_ONE - f);
+    uint8x8_t const wb = vdup_n_u8(f);
+    for (; n >= 2; n -= 2, a += 2, b += 2, d += 2)
+    {
+        uint16x8_t t = vmull_u8(vld1_u8((uint8_t const *)a), wa);
+        t = vmlal_u8(t, vld1_u8((uint8_t const *)b), wb);
+        vst1_u8((uint8_t *)d, vrshrn_n_u16(t, BILINEAR_BITS));
+    }
+#elif defined(BLIT_SSE2)
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const wa = _mm_set1_epi16(BILINEAR_ONE - f);
+    __m128i const wb = _mm_set1_epi16(f);
+    __m128i const round = _mm_set1_epi16(BILINEAR_ONE / 2);
+    for (; n >= 4; n -= 4, a += 4, b += 4, d += 4)
+    {
+        __m128i va = _mm_loadu_si128((__m128i const *)a);
+        __m128i vb = _mm_loadu_si128((__m128i const *)b);
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa), _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa), _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), BILINEAR_BITS);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), BILINEAR_BITS);
+        _mm_storeu_si128((__m128i *)d, _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; n; --n)
+    {
+        uint32_t x = *a++, y = *b++;
+        uint32_t rb = ((x & 0x00ff00ff) * (BILINEAR_ONE - f) + (y & 0x00ff00ff) * f + 0x00400040) >> BILINEAR_BITS;
+        uint32_t ag = (((x >> 8) & 0x00ff00ff) * (BILINEAR_ONE - f) + ((y >> 8) & 0x00ff00ff) * f + 0x00400040) >> BILINEAR_BITS;
+        *d++ = (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+    }
+}
+
+/*! \brief Source coordinate and weight of next sample for each destination index.
+    \param idx Receives index of first source sample. Second one is idx + 1, which never exceeds n_src - 1.
+    \param frac Receives weight of second sample.
+ */
+static void bilinear_table(int *idx, int *frac, int n_dst, int n_src)
+{
+    // 16.16 fixed point, mapping pixel centers.
+    int64_t step = ((int64_t)n_src << 16) / n_dst;
+    int64_t pos = step / 2 - (1 << 15);
+    for (int i = 0; i < n_dst; i++, pos += step)
+    {
+        int64_t p = pos < 0 ? 0 : pos;
+        int s = (int)(p >> 16);
+        int f = (int)((p & 0xffff) >> (16 - BILINEAR_BITS));
+        if (s >= n_src - 1)
+        {
+            s = n_src > 1 ? n_src - 2 : 0;
+            f = n_src > 1 ? BILINEAR_ONE : 0;
+        }
+        idx[i] = s;
+        frac[i] = f;
+    }
+}
+
+//! Blend each pair of neighboring row pixels at idx by packed weights of destination pixel.
+static void span_lerp_pairs(uint32_t *d, uint32_t const *row, int const *idx, uint32_t const *w, int n)
+{
+#if defined(BLIT_NEON)
+    for (; n >= 2; n -= 2, idx += 2, w += 2, d += 2)
+    {
+        // Pair is loaded as one vector, first pixel on low half, and weighted by (1 - f) and f halves.
+        uint8x8_t w0 = vcreate_u8((uint64_t)((w[0] >> 16) * 0x01010101u) << 32 | (w[0] & 0xffff) * 0x01010101u);
+        uint8x8_t w1 = vcreate_u8((uint64_t)((w[1] >> 16) * 0x01010101u) << 32 | (w[1] & 0xffff) * 0x01010101u);
+        uint16x8_t p0 = vmull_u8(vld1_u8((uint8_t const *)(row + idx[0])), w0);
+        uint16x8_t p1 = vmull_u8(vld1_u8((uint8_t const *)(row + idx[1])), w1);
+        uint16x4_t s0 = vadd_u16(vget_low_u16(p0), vget_high_u16(p0));
+        uint16x4_t s1 = vadd_u16(vget_low_u16(p1), vget_high_u16(p1));
+        vst1_u8((uint8_t *)d, vrshrn_n_u16(vcombine_u16(s0, s1), BILINEAR_BITS));
+    }
+#elif defined(BLIT_SSE2)
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const round = _mm_set1_epi32(BILINEAR_ONE / 2);
+    for (; n >= 4; n -= 4, idx += 4, w += 4, d += 4)
+    {
+        __m128i sum[4];
+        for (int i = 0; i < 4; i++)
+        {
+            // Channels of pair are interleaved, so that madd sums p * (1 - f) + q * f for each channel.
+            __m128i pq = _mm_loadl_epi64((__m128i const *)(row + idx[i]));
+            pq = _mm_unpacklo_epi8(_mm_unpacklo_epi8(pq, _mm_srli_si128(pq, 4)), zero);
+            sum[i] = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(pq, _mm_set1_epi32(w[i])), round), BILINEAR_BITS);
+        }
+        __m128i lo = _mm_packs_epi32(sum[0], sum[1]);
+        __m128i hi = _mm_packs_epi32(sum[2], sum[3]);
+        _mm_storeu_si128((__m128i *)d, _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    // Two channels at a time
+    for (; n; --n)
+    {
+        uint32_t p = row[*idx], q = row[*idx + 1];
+        uint32_t f = *w >> 16, g = *w & 0xffff;
+        uint32_t rb = ((p & 0x00ff00ff) * g + (q & 0x00ff00ff) * f + 0x00400040) >> BILINEAR_BITS;
+        uint32_t ag = (((p >> 8) & 0x00ff00ff) * g + ((q >> 8) & 0x00ff00ff) * f + 0x00400040) >> BILINEAR_BITS;
+        *d++ = (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+        idx++, w++;
+    }
+}
+
+//! Rebuild sampling tables of scaler for given plane sizes.
+static bool bilinear_scaler_build(bilinear_scaler_t *sc, pixel_plane_t const *dst, pixel_plane_t const *src)
+{
+    bilinear_scaler_free(sc);
+    sc->xi = malloc(sizeof(int) * (dst->w + dst->h * 2));
+    sc->xw = malloc(sizeof(uint32_t) * dst->w);
+    sc->row = malloc(sizeof(uint32_t) * (src->w + 1));
+    if (sc->xi == NULL || sc->xw == NULL || sc->row == NULL)
+    {
+        bilinear_scaler_free(sc);
+        return false;
+    }
+
+    sc->yi = sc->xi + dst->w;
+    sc->yf = sc->yi + dst->h;
+    bilinear_table(sc->xi, (int *)sc->xw, dst->w, src->w);
+    bilinear_table(sc->yi, sc->yf, dst->h, src->h);
+    for (int x = 0; x < dst->w; x++)
+        sc->xw[x] = (BILINEAR_ONE - sc->xw[x]) | sc->xw[x] << 16;
+
+    // Single column source has no second sample.
+    sc->row[src->w] = 0;
+
+    sc->src_w = src->w, sc->src_h = src->h;
+    sc->dst_w = dst->w, sc->dst_h = dst->h;
+    return true;
+}
+
+void bilinear_scaler_free(bilinear_scaler_t *sc)
+{
+    free(sc->xi);
+    free(sc->xw);
+    free(sc->row);
+    *sc = (bilinear_scaler_t){0};
+}
+
+bool scale_bilinear(bilinear_scaler_t *sc, pixel_plane_t const *dst, pixel_plane_t const *src)
+{
+    if (src->w <= 0 || src->h <= 0)
+        return true;
+
+    bool bSameSize = sc->src_w == src->w && sc->src_h == src->h && sc->dst_w == dst->w && sc->dst_h == dst->h;
+    if (bSameSize == false && bilinear_scaler_build(sc, dst, src) == false)
+        return false;
+
+    // Source is new on every call, so blended row is valid only within the call.
+    sc->row_yi = -1;
+
+    for (int y = 0; y < dst->h; y++)
+    {
+        // Vertical pass over source row pair, skipped if previous row blended same pair by same weight.
+        if (sc->yi[y] != sc->row_yi || sc->yf[y] != sc->row_yf)
+        {
+            uint32_t const *a = (uint32_t const *)((char const *)src->data + sc->yi[y] * src->stride);
+            uint32_t const *b = src->h > 1 ? (uint32_t const *)((char const *)a + src->stride) : a;
+            span_lerp_rows(sc->row, a, b, sc->yf[y], src->w);
+            sc->row_yi = sc->yi[y];
+            sc->row_yf = sc->yf[y];
+        }
+
+        // Horizontal pass
+        uint32_t *d = (uint32_t *)((char *)dst->data + y * dst->stride);
+        span_lerp_pairs(d, sc->row, sc->xi, sc->xw, dst->w);
+    }
+    return true;
+}
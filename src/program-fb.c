@@ -6,6 +6,7 @@
     
     \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
  */
+#define _POSIX_C_SOURCE 199309L
 #include "core/program.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,12 +19,103 @@
 #include <string.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "core/internal/program-types.h"
+#include "core/internal/raw-image.h"
+#include "program-blit.h"
 
 // -- Resource descriptors
-// Image descriptors
 typedef struct cairo_font_face_t rsrc_font_t;
-typedef struct cairo_surface_t rsrc_image_t;
+
+// Image descriptor. Image is a sub-rectangle of its surface, which may be shared with other images as an atlas.
+typedef struct rsrc_image
+{
+    cairo_surface_t *surface;
+    int x, y;
+    int w, h;
+    bool bAtlas;
+    // Pixels are used in place from mapped file or memory, thus atlas doesn't copy them.
+    bool bMapped;
+} rsrc_image_t;
+
+// Line vector descriptor. Path is built once on load, and replayed on every draw.
+typedef struct rsrc_vector
+{
+    cairo_path_t *path;
+    double line_width;
+} rsrc_vector_t;
+
+// -- Text layout cache
+// Set associative cache. Each string is mapped to one set, and least recently used way of set is evicted.
+#define TEXT_LAYOUT_CACHE_NUM_SETS 64
+#define TEXT_LAYOUT_CACHE_NUM_WAYS 4
+#define TEXT_LAYOUT_MAX_STRING 128
+
+typedef struct text_layout
+{
+    // Key
+    FHash hash;
+    cairo_font_face_t *font;
+    float size;
+    char str[TEXT_LAYOUT_MAX_STRING];
+
+    // Layout of string when its origin is (0, 0)
+    cairo_text_extents_t ext;
+    cairo_glyph_t *glyphs;
+    int num_glyphs;
+
+    // Frame number of last reference. Zero if this entry is empty.
+    size_t last_used;
+} text_layout_t;
+
+// -- Shadow of cairo context state.
+// Draw calls only emit state which differs from current context state.
+typedef struct render_state
+{
+    cairo_matrix_t matrix;
+
+    // Source is either solid color or surface.
+    bool bSolidSource;
+    FColor color;
+    cairo_surface_t *source_surface;
+    double source_x, source_y;
+    // Surface source is locked to the matrix in effect when it was set.
+    cairo_matrix_t source_matrix;
+
+    cairo_font_face_t *font;
+    float font_size;
+    double line_width;
+    cairo_line_join_t line_join;
+} render_state_t;
+
+// -- Vertical blank presenter
+typedef struct vsync_presenter
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int fd;
+
+    // Presenter thread is running, and renderer hands frames over to it while bActive is set.
+    bool bThread;
+    bool bRunning;
+    bool bActive;
+
+    // Back buffer waiting for next vertical blank, and one being copied to screen. -1 if none.
+    int pending;
+    int presenting;
+
+    // Smoothed interval between vertical blanks
+    uint64_t interval_ns;
+
+    // Frames presented and dropped since renderer last folded them into its statistics.
+    size_t num_presented;
+    size_t num_dropped;
+} vsync_presenter_t;
 
 typedef struct
 {
@@ -32,42 +124,438 @@ typedef struct
     cairo_surface_t *backbuffer[RENDERER_NUM_MAX_BUFFER];
 
     float w, h;
+
+    // Dynamic render scale. Back buffers are created in reduced size over their memory, then upscaled on present.
+    float target_frame_ns;
+    float min_scale;
+    float render_scale;
+    float buffer_scale[RENDERER_NUM_MAX_BUFFER];
+    double frame_time_ema;
+    int scale_cooldown;
+    void *upscale_memory;
+    bilinear_scaler_t upscaler;
+
+    // Effective scale of frame being rendered, and pixels per world unit of it.
+    float scale;
+    float unit;
+
+    // Screen is 16 bit RGB565, whose red channel is on low bits if bSwapRB is set.
+    bool bRGB565;
+    bool bSwapRB;
+
+    // Long-lived contexts of each back buffer, and their state shadows
+    cairo_t *contexts[RENDERER_NUM_MAX_BUFFER];
+    render_state_t states[RENDERER_NUM_MAX_BUFFER];
+
+    // Context and state of active back buffer
     cairo_t *context;
+    render_state_t *state;
+
+    vsync_presenter_t vsync;
+
+    // Statistics of owner program instance
+    FRenderStats *stats;
+    size_t frame;
+
+    text_layout_t text_layouts[TEXT_LAYOUT_CACHE_NUM_SETS][TEXT_LAYOUT_CACHE_NUM_WAYS];
 } program_cairo_wrapper_t;
 
+typedef struct _cairo_linuxfb_device
+{
+    int fb_fd;
+    char *fb_data;
+    long fb_screensize;
+    struct fb_var_screeninfo fb_vinfo;
+    struct fb_fix_screeninfo fb_finfo;
+} cairo_linuxfb_device_t;
+
+static cairo_user_data_key_t const cairo_linuxfb_device_key;
+
 static cairo_surface_t *cairo_linuxfb_surface_create(const char *fb_name);
 
+/*! \brief (Re)create context of given back buffer, and reset its shadow state to cairo's defaults. */
+static void render_context_reset(program_cairo_wrapper_t *v, int idx)
+{
+    if (v->contexts[idx])
+        cairo_destroy(v->contexts[idx]);
+    v->contexts[idx] = cairo_create(v->backbuffer[idx]);
+
+    render_state_t *st = &v->states[idx];
+    memset(st, 0, sizeof(*st));
+    cairo_matrix_init_identity(&st->matrix);
+    st->bSolidSource = true;
+    st->color = (FColor){.A = 1, .R = 0, .G = 0, .B = 0};
+    st->font = NULL;
+    st->font_size = 10.0f;
+    st->line_width = 2.0;
+    st->line_join = CAIRO_LINE_JOIN_MITER;
+}
+
+static inline void state_set_matrix(program_cairo_wrapper_t *fb, cairo_matrix_t const *m)
+{
+    if (memcmp(&fb->state->matrix, m, sizeof(*m)) == 0)
+    {
+        fb->stats->StateChangesSkipped++;
+        return;
+    }
+
+    fb->state->matrix = *m;
+    cairo_set_matrix(fb->context, m);
+    fb->stats->StateChangesEmitted++;
+}
+
+static inline void state_set_color(program_cairo_wrapper_t *fb, FColor c)
+{
+    render_state_t *st = fb->state;
+    if (st->bSolidSource && memcmp(&st->color, &c, sizeof(c)) == 0)
+    {
+        fb->stats->StateChangesSkipped++;
+        return;
+    }
+
+    st->bSolidSource = true;
+    st->color = c;
+    st->source_surface = NULL;
+    cairo_set_source_rgba(fb->context, c.R, c.G, c.B, c.A);
+    fb->stats->StateChangesEmitted++;
+}
+
+static inline void state_set_source_surface(program_cairo_wrapper_t *fb, cairo_surface_t *surf, double x, double y)
+{
+    render_state_t *st = fb->state;
+    if (!st->bSolidSource && st->source_surface == surf && st->source_x == x && st->source_y == y &&
+        memcmp(&st->source_matrix, &st->matrix, sizeof(st->matrix)) == 0)
+    {
+        fb->stats->StateChangesSkipped++;
+        return;
+    }
+
+    st->bSolidSource = false;
+    st->source_surface = surf;
+    st->source_x = x;
+    st->source_y = y;
+    st->source_matrix = st->matrix;
+    cairo_set_source_surface(fb->context, surf, x, y);
+    fb->stats->StateChangesEmitted++;
+}
+
+static inline void state_set_font(program_cairo_wrapper_t *fb, cairo_font_face_t *font, float size)
+{
+    render_state_t *st = fb->state;
+    if (st->font != font)
+    {
+        st->font = font;
+        cairo_set_font_face(fb->context, font);
+        fb->stats->StateChangesEmitted++;
+    }
+    else
+        fb->stats->StateChangesSkipped++;
+
+    if (st->font_size != size)
+    {
+        st->font_size = size;
+        cairo_set_font_size(fb->context, size);
+        fb->stats->StateChangesEmitted++;
+    }
+    else
+        fb->stats->StateChangesSkipped++;
+}
+
+static inline void state_set_stroke(program_cairo_wrapper_t *fb, double width, cairo_line_join_t join)
+{
+    render_state_t *st = fb->state;
+    if (st->line_width != width)
+    {
+        st->line_width = width;
+        cairo_set_line_width(fb->context, width);
+        fb->stats->StateChangesEmitted++;
+    }
+    else
+        fb->stats->StateChangesSkipped++;
+
+    if (st->line_join != join)
+    {
+        st->line_join = join;
+        cairo_set_line_join(fb->context, join);
+        fb->stats->StateChangesEmitted++;
+    }
+    else
+        fb->stats->StateChangesSkipped++;
+}
+
+static inline pixel_plane_t image_plane(cairo_surface_t *surf)
+{
+    return (pixel_plane_t){
+        .data = (uint32_t *)cairo_image_surface_get_data(surf),
+        .w = cairo_image_surface_get_width(surf),
+        .h = cairo_image_surface_get_height(surf),
+        .stride = cairo_image_surface_get_stride(surf)};
+}
+
+//! Pixel plane of image's sub-rectangle.
+static inline pixel_plane_t image_sub_plane(rsrc_image_t const *img)
+{
+    pixel_plane_t p = image_plane(img->surface);
+    p.data = (uint32_t *)((char *)p.data + img->y * p.stride + img->x * 4);
+    p.w = img->w;
+    p.h = img->h;
+    return p;
+}
+
+/*! \brief Copy back buffer to screen. */
+static void present(program_cairo_wrapper_t *fb, int ActiveBuffer)
+{
+    // Copy value to frame buffer
+    pixel_plane_t src = image_plane(fb->backbuffer[ActiveBuffer]);
+
+    // Frame rendered in reduced resolution is upscaled first.
+    if (src.h != (int)fb->h)
+    {
+        pixel_plane_t full = {
+            .data = fb->upscale_memory,
+            .w = fb->w,
+            .h = fb->h,
+            .stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, fb->w)};
+        if (scale_bilinear(&fb->upscaler, &full, &src) == false)
+        {
+            lvlog(LOGLEVEL_WARNING, "Out of memory on upscaling frame. Frame is not presented.\n");
+            return;
+        }
+        src = full;
+    }
+
+    if (fb->bRGB565)
+    {
+        convert_rgb565_dither((uint16_t *)cairo_image_surface_get_data(fb->screen),
+                              cairo_image_surface_get_stride(fb->screen), &src, fb->bSwapRB);
+        return;
+    }
+
+    char *dst = cairo_image_surface_get_data(fb->screen);
+    char *sp = (char *)src.data;
+    int dst_strd = cairo_image_surface_get_stride(fb->screen);
+
+    // For each pxls ... Screen rows may be padded.
+    for (int y = 0; y < src.h; ++y, dst += dst_strd, sp += src.stride)
+    {
+        for (char *p = dst, *s = sp, *e = sp + src.w * 4; s != e; p += 4, s += 4)
+        {
+            p[2] = s[0];
+            p[1] = s[1];
+            p[0] = s[2];
+            p[3] = s[3];
+        }
+    }
+}
+
+/*! \brief Presents pending frame on each vertical blank, and measures refresh interval. */
+static void *vsync_procedure(void *arg)
+{
+    program_cairo_wrapper_t *fb = arg;
+    vsync_presenter_t *vs = &fb->vsync;
+    uint64_t prev = Clock_Now();
+
+    for (;;)
+    {
+        uint32_t screen = 0;
+        bool bOk = ioctl(vs->fd, FBIO_WAITFORVSYNC, &screen) != -1;
+        uint64_t now = Clock_Now();
+
+        pthread_mutex_lock(&vs->lock);
+        if (vs->bRunning == false || bOk == false)
+        {
+            if (bOk == false)
+                lvlog(LOGLEVEL_WARNING, "Waiting for vertical blank failed. Frames are presented immediately from now.\n");
+
+            // Renderer presents by itself from now on. Frame left behind is presented here.
+            int idx = vs->pending;
+            vs->pending = -1;
+            vs->presenting = idx;
+            vs->bActive = false;
+            pthread_mutex_unlock(&vs->lock);
+
+            if (idx != -1)
+                present(fb, idx);
+
+            pthread_mutex_lock(&vs->lock);
+            vs->num_presented += idx != -1;
+            vs->presenting = -1;
+            pthread_cond_broadcast(&vs->cond);
+            pthread_mutex_unlock(&vs->lock);
+            break;
+        }
+
+        // Missed vertical blanks are not counted as refresh interval.
+        uint64_t dt = now - prev;
+        prev = now;
+        if (vs->interval_ns == 0 || dt < vs->interval_ns * 3 / 2)
+            vs->interval_ns = vs->interval_ns ? (vs->interval_ns * 7 + dt) / 8 : dt;
+
+        int idx = vs->pending;
+        vs->pending = -1;
+        vs->presenting = idx;
+        pthread_mutex_unlock(&vs->lock);
+
+        if (idx == -1)
+            continue;
+
+        present(fb, idx);
+
+        pthread_mutex_lock(&vs->lock);
+        vs->num_presented++;
+        vs->presenting = -1;
+        pthread_cond_broadcast(&vs->cond);
+        pthread_mutex_unlock(&vs->lock);
+    }
+
+    return NULL;
+}
+
+/*! \brief Start vertical blank presenter if the driver supports waiting for vertical blank. */
+static void vsync_init(program_cairo_wrapper_t *fb)
+{
+    vsync_presenter_t *vs = &fb->vsync;
+    cairo_linuxfb_device_t const *dev = cairo_surface_get_user_data(fb->screen, &cairo_linuxfb_device_key);
+    vs->fd = dev->fb_fd;
+    vs->pending = -1;
+    vs->presenting = -1;
+
+    uint32_t screen = 0;
+    if (ioctl(vs->fd, FBIO_WAITFORVSYNC, &screen) == -1)
+    {
+        lvlog(LOGLEVEL_WARNING, "Frame buffer does not support FBIO_WAITFORVSYNC. Frames are presented immediately.\n");
+        return;
+    }
+
+    pthread_mutex_init(&vs->lock, NULL);
+    pthread_cond_init(&vs->cond, NULL);
+    vs->bRunning = true;
+    vs->bActive = true;
+    pthread_create(&vs->thread, NULL, vsync_procedure, fb);
+    vs->bThread = true;
+    lvlog(LOGLEVEL_INFO, "Frames are presented on vertical blank.\n");
+}
+
+static void vsync_deinit(program_cairo_wrapper_t *fb)
+{
+    vsync_presenter_t *vs = &fb->vsync;
+    if (vs->bThread == false)
+        return;
+
+    pthread_mutex_lock(&vs->lock);
+    vs->bRunning = false;
+    pthread_mutex_unlock(&vs->lock);
+
+    // Returns on next vertical blank
+    pthread_join(vs->thread, NULL);
+    pthread_mutex_destroy(&vs->lock);
+    pthread_cond_destroy(&vs->cond);
+}
+
+/*! \brief Wait until presenter finishes reading given back buffer.
+    \details Presenter's counters are folded into renderer statistics here, as only renderer writes them.
+        Time spent waiting is recorded apart, so it does not count as rendering cost of the frame.
+ */
+static void vsync_acquire_buffer(program_cairo_wrapper_t *fb, int idx)
+{
+    vsync_presenter_t *vs = &fb->vsync;
+    if (vs->bThread == false)
+        return;
+
+    uint64_t begin = Clock_Now();
+    pthread_mutex_lock(&vs->lock);
+    while (vs->presenting == idx)
+        pthread_cond_wait(&vs->cond, &vs->lock);
+    fb->stats->LastBufferWaitNs = Clock_Now() - begin;
+    fb->stats->TotalBufferWaitNs += fb->stats->LastBufferWaitNs;
+
+    // Pending frame can't be presented once renderer begins to overwrite it.
+    if (vs->pending == idx)
+    {
+        vs->pending = -1;
+        vs->num_dropped++;
+    }
+
+    fb->stats->NumFramesPresented += vs->num_presented;
+    fb->stats->NumFramesDropped += vs->num_dropped;
+    fb->stats->RefreshIntervalNs = vs->interval_ns;
+    vs->num_presented = 0;
+    vs->num_dropped = 0;
+    pthread_mutex_unlock(&vs->lock);
+}
+
+float PInst_GetRefreshInterval(struct ProgramInstance *s)
+{
+    program_cairo_wrapper_t *fb = s->hFB;
+    vsync_presenter_t *vs = &fb->vsync;
+    if (vs->bThread == false)
+        return 0.0f;
+
+    pthread_mutex_lock(&vs->lock);
+    float interval = vs->bActive ? vs->interval_ns * 1e-9f : 0.0f;
+    pthread_mutex_unlock(&vs->lock);
+    return interval;
+}
+
 void *Internal_PInst_InitFB(UProgramInstance *s, char const *fb)
 {
-    program_cairo_wrapper_t *v = malloc(sizeof(program_cairo_wrapper_t));
+    program_cairo_wrapper_t *v = calloc(1, sizeof(program_cairo_wrapper_t));
+    v->stats = &s->RenderStatsWork;
     v->screen = cairo_linuxfb_surface_create(fb);
 
     size_t w = cairo_image_surface_get_width(v->screen);
     size_t h = cairo_image_surface_get_height(v->screen);
-    size_t strd = cairo_image_surface_get_stride(v->screen);
     size_t fmt = cairo_image_surface_get_format(v->screen);
     v->w = w;
     v->h = h;
 
+    // Back buffers are always rendered in 32 bit, then converted on flush.
+    size_t strd = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, w);
+    if (fmt == CAIRO_FORMAT_RGB16_565)
+    {
+        cairo_linuxfb_device_t const *dev = cairo_surface_get_user_data(v->screen, &cairo_linuxfb_device_key);
+        v->bRGB565 = true;
+        v->bSwapRB = dev->fb_vinfo.red.offset < dev->fb_vinfo.blue.offset;
+    }
+
     lvlog(LOGLEVEL_INFO,
           "Image info: \n"
-          "w, h= [%d, %d] \n[strd: %d], fmt: %d\n",
-          w, h, strd, fmt);
+          "w, h= [%d, %d] \n[strd: %d], fmt: %d%s\n",
+          w, h, strd, fmt, v->bRGB565 ? (v->bSwapRB ? " (BGR565, dithered)" : " (RGB565, dithered)") : "");
 
     for (size_t i = 0; i < RENDERER_NUM_MAX_BUFFER; i++)
     {
         v->backbuffer_memory[i] = malloc(h * strd);
-        v->backbuffer[i] = cairo_image_surface_create_for_data(v->backbuffer_memory[i], fmt, w, h, strd);
+        v->backbuffer[i] = cairo_image_surface_create_for_data(v->backbuffer_memory[i], CAIRO_FORMAT_ARGB32, w, h, strd);
+        v->buffer_scale[i] = 1.0f;
+        render_context_reset(v, i);
+    }
+
+    v->render_scale = 1.0f;
+    v->scale = 1.0f;
+    v->unit = h;
+    if (s->TargetFrameTime > 0.0f)
+    {
+        v->target_frame_ns = s->TargetFrameTime * 1e9f;
+        v->min_scale = s->MinRenderScale > 0.0f && s->MinRenderScale < 1.0f ? s->MinRenderScale : 1.0f;
+        v->upscale_memory = malloc(h * strd);
+        lvlog(LOGLEVEL_INFO, "Dynamic render scale is enabled, down to %.0f%% for %.1f ms frame\n",
+              v->min_scale * 100.0f, s->TargetFrameTime * 1e3f);
     }
 
     *PInst_AspectRatio(s) = (float)w / h;
 
+    if (s->bEnableVSync)
+        vsync_init(v);
+
     return v;
 }
 
 void Internal_PInst_DeinitFB(struct ProgramInstance *Inst, void *hFB)
 {
     program_cairo_wrapper_t *v = hFB;
+    vsync_deinit(v);
+
     // Erase screen
     void *d = cairo_image_surface_get_data(v->screen);
     uint32_t strd = cairo_image_surface_get_stride(v->screen);
@@ -77,22 +565,409 @@ void Internal_PInst_DeinitFB(struct ProgramInstance *Inst, void *hFB)
     // Release memory
     for (size_t i = 0; i < RENDERER_NUM_MAX_BUFFER; i++)
     {
+        cairo_destroy(v->contexts[i]);
         cairo_surface_destroy(v->backbuffer[i]);
         free(v->backbuffer_memory[i]);
     }
+    free(v->upscale_memory);
+    bilinear_scaler_free(&v->upscaler);
     cairo_surface_destroy(v->screen);
+
+    for (size_t i = 0; i < TEXT_LAYOUT_CACHE_NUM_SETS; i++)
+        for (size_t k = 0; k < TEXT_LAYOUT_CACHE_NUM_WAYS; k++)
+            cairo_glyph_free(v->text_layouts[i][k].glyphs);
+    free(v);
     lvlog(LOGLEVEL_INFO, "Frame buffer has successfully deinitialized.\n");
 }
 
+typedef struct raw_image_mapping
+{
+    void *addr;
+    size_t len;
+} raw_image_mapping_t;
+
+static cairo_user_data_key_t const raw_image_mapping_key;
+
+static void raw_image_unmap(void *v)
+{
+    raw_image_mapping_t *m = v;
+    munmap(m->addr, m->len);
+    free(m);
+}
+
+/*! \brief Wrap raw image in memory as image surface, without copying pixels.
+    \details Memory is mapped read-only, thus surface must only be used as source.
+    \return NULL if given memory is not a valid raw image.
+ */
+static cairo_surface_t *raw_image_wrap(void const *addr, size_t len, char const *Name)
+{
+    if (len < sizeof(struct RawImageHeader))
+        return NULL;
+
+    struct RawImageHeader const *h = addr;
+    cairo_format_t fmt = h->Format == RAW_IMAGE_RGB24 ? CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32;
+    bool bValid =
+        h->Magic == RAW_IMAGE_MAGIC &&
+        h->Version == RAW_IMAGE_VERSION &&
+        (h->Format == RAW_IMAGE_ARGB32 || h->Format == RAW_IMAGE_RGB24) &&
+        h->Stride == cairo_format_stride_for_width(fmt, h->Width) &&
+        h->DataOffset % 16 == 0 &&
+        h->DataOffset + (uint64_t)h->Stride * h->Height <= (uint64_t)len;
+
+    if (bValid == false)
+    {
+        lvlog(LOGLEVEL_WARNING, "%s is not a valid raw image\n", Name);
+        return NULL;
+    }
+
+    return cairo_image_surface_create_for_data(
+        (unsigned char *)addr + h->DataOffset, fmt, h->Width, h->Height, h->Stride);
+}
+
+/*! \brief Map raw image file into memory, and wrap it as image surface without any decoding.
+    \return NULL if there's no valid raw image file for given path.
+ */
+static cairo_surface_t *raw_image_load(char const *Path)
+{
+    int fd = open(Path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= sizeof(struct RawImageHeader))
+        addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    cairo_surface_t *surf = raw_image_wrap(addr, st.st_size, Path);
+    if (surf == NULL)
+    {
+        munmap(addr, st.st_size);
+        return NULL;
+    }
+
+    // Mapping is released along with surface.
+    raw_image_mapping_t *m = malloc(sizeof(raw_image_mapping_t));
+    m->addr = addr;
+    m->len = st.st_size;
+    cairo_surface_set_user_data(surf, &raw_image_mapping_key, m, raw_image_unmap);
+    return surf;
+}
+
+static rsrc_image_t *image_new(cairo_surface_t *surf, bool bMapped)
+{
+    rsrc_image_t *img = malloc(sizeof(rsrc_image_t));
+    img->surface = surf;
+    img->x = 0;
+    img->y = 0;
+    img->w = cairo_image_surface_get_width(surf);
+    img->h = cairo_image_surface_get_height(surf);
+    img->bAtlas = false;
+    img->bMapped = bMapped;
+    return img;
+}
+
 void *Internal_PInst_LoadImgInternal(struct ProgramInstance *Inst, char const *Path)
 {
-    // Check if file exists.
-    FILE *fp = fopen(Path, "r");
-    if (fp == NULL)
+    // Prefer pre-decoded raw image which is placed next to png file.
+    char RawPath[1024];
+    size_t len = strlen(Path);
+    if (len > 4 && len + sizeof(RAW_IMAGE_EXTENSION) < sizeof(RawPath) && strcmp(Path + len - 4, ".png") == 0)
+    {
+        memcpy(RawPath, Path, len - 4);
+        strcpy(RawPath + len - 4, RAW_IMAGE_EXTENSION);
+
+        cairo_surface_t *raw = raw_image_load(RawPath);
+        if (raw)
+            return image_new(raw, true);
+    }
+
+    cairo_surface_t *png = cairo_image_surface_create_from_png(Path);
+    if (cairo_surface_status(png) != CAIRO_STATUS_SUCCESS)
+    {
+        cairo_surface_destroy(png);
         return NULL;
+    }
+    return image_new(png, false);
+}
 
-    fclose(fp);
-    return cairo_image_surface_create_from_png(Path);
+void *Internal_PInst_MapImage(struct ProgramInstance *Inst, void const *Data, size_t Size)
+{
+    // Pack outlives every resource, thus mapping needs no release.
+    cairo_surface_t *surf = raw_image_wrap(Data, Size, "Packed image");
+    return surf ? image_new(surf, true) : NULL;
+}
+
+bool Internal_PInst_ProbeImage(void const *Data, size_t Size, int32_t *Width, int32_t *Height)
+{
+    static unsigned char const png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    unsigned char const *p = Data;
+
+    if (Size >= sizeof(struct RawImageHeader) && ((struct RawImageHeader const *)Data)->Magic == RAW_IMAGE_MAGIC)
+    {
+        *Width = ((struct RawImageHeader const *)Data)->Width;
+        *Height = ((struct RawImageHeader const *)Data)->Height;
+        return true;
+    }
+
+    // IHDR is always the first chunk, which begins with big endian width and height.
+    if (Size >= 24 && memcmp(p, png_signature, 8) == 0 && memcmp(p + 12, "IHDR", 4) == 0)
+    {
+        *Width = (int32_t)((uint32_t)p[16] << 24 | p[17] << 16 | p[18] << 8 | p[19]);
+        *Height = (int32_t)((uint32_t)p[20] << 24 | p[21] << 16 | p[22] << 8 | p[23]);
+        return true;
+    }
+    return false;
+}
+
+typedef struct png_stream
+{
+    unsigned char const *data;
+    size_t left;
+} png_stream_t;
+
+static cairo_status_t png_stream_read(void *closure, unsigned char *data, unsigned int length)
+{
+    png_stream_t *st = closure;
+    if (length > st->left)
+        return CAIRO_STATUS_READ_ERROR;
+
+    memcpy(data, st->data, length);
+    st->data += length;
+    st->left -= length;
+    return CAIRO_STATUS_SUCCESS;
+}
+
+void *Internal_PInst_DecodeImage(struct ProgramInstance *Inst, void const *Data, size_t Size)
+{
+    // Raw image stays valid as long as its source does.
+    if (Size >= sizeof(struct RawImageHeader) && ((struct RawImageHeader const *)Data)->Magic == RAW_IMAGE_MAGIC)
+    {
+        cairo_surface_t *raw = raw_image_wrap((void *)Data, Size, "Image source");
+        return raw ? image_new(raw, true) : NULL;
+    }
+
+    png_stream_t st = {.data = Data, .left = Size};
+    cairo_surface_t *png = cairo_image_surface_create_from_png_stream(png_stream_read, &st);
+    if (cairo_surface_status(png) != CAIRO_STATUS_SUCCESS)
+    {
+        cairo_surface_destroy(png);
+        return NULL;
+    }
+    return image_new(png, false);
+}
+
+void Internal_PInst_GetImageSize(void const *Image, int32_t *Width, int32_t *Height)
+{
+    rsrc_image_t const *img = Image;
+    *Width = img->w;
+    *Height = img->h;
+}
+
+// -- Atlas packing
+#define ATLAS_PAGE_SIZE 2048
+// Transparent gutter on right and bottom of each packed image, so filtered edges never sample neighbors.
+#define ATLAS_PADDING 1
+
+typedef struct skyline_node
+{
+    int x, y, w;
+} skyline_node_t;
+
+/*! \brief Skyline bin packer. Nodes describe top edge of packed area from left to right. */
+typedef struct skyline
+{
+    skyline_node_t *nodes;
+    int num;
+    int w, h;
+    int used_w, used_h;
+} skyline_t;
+
+static void skyline_init(skyline_t *s, skyline_node_t *nodes, int w, int h)
+{
+    s->nodes = nodes;
+    s->num = 1;
+    s->w = w;
+    s->h = h;
+    s->used_w = 0;
+    s->used_h = 0;
+    nodes[0] = (skyline_node_t){0, 0, w};
+}
+
+/*! \brief Lowest y where rectangle fits when its left edge is on node idx. -1 if it does not fit. */
+static int skyline_fit(skyline_t const *s, int idx, int w, int h)
+{
+    if (s->nodes[idx].x + w > s->w)
+        return -1;
+
+    int y = 0;
+    for (int left = w; left > 0; left -= s->nodes[idx].w, idx++)
+    {
+        if (s->nodes[idx].y > y)
+            y = s->nodes[idx].y;
+        if (y + h > s->h)
+            return -1;
+    }
+    return y;
+}
+
+/*! \brief Place rectangle where its bottom edge becomes lowest. Ties are broken by narrower node.
+    \details Node buffer must have room for one more node than number of inserted rectangles.
+ */
+static bool skyline_insert(skyline_t *s, int w, int h, int *ox, int *oy)
+{
+    int best = -1, best_bottom = INT32_MAX, best_w = INT32_MAX;
+    for (int i = 0; i < s->num; i++)
+    {
+        int y = skyline_fit(s, i, w, h);
+        if (y < 0)
+            continue;
+        if (y + h < best_bottom || (y + h == best_bottom && s->nodes[i].w < best_w))
+        {
+            best = i;
+            best_bottom = y + h;
+            best_w = s->nodes[i].w;
+        }
+    }
+
+    if (best < 0)
+        return false;
+
+    skyline_node_t *n = s->nodes;
+    int x = n[best].x;
+    memmove(n + best + 1, n + best, (s->num - best) * sizeof(*n));
+    n[best] = (skyline_node_t){x, best_bottom, w};
+    s->num++;
+
+    // Shrink or remove nodes shadowed by new one
+    for (int i = best + 1; i < s->num;)
+    {
+        int shrink = x + w - n[i].x;
+        if (shrink <= 0)
+            break;
+        if (n[i].w > shrink)
+        {
+            n[i].x += shrink;
+            n[i].w -= shrink;
+            break;
+        }
+        memmove(n + i, n + i + 1, (s->num - i - 1) * sizeof(*n));
+        s->num--;
+    }
+
+    // Merge neighbors on same level
+    for (int i = 0; i + 1 < s->num;)
+    {
+        if (n[i].y != n[i + 1].y)
+        {
+            i++;
+            continue;
+        }
+        n[i].w += n[i + 1].w;
+        memmove(n + i + 1, n + i + 2, (s->num - i - 2) * sizeof(*n));
+        s->num--;
+    }
+
+    if (x + w > s->used_w)
+        s->used_w = x + w;
+    if (best_bottom > s->used_h)
+        s->used_h = best_bottom;
+    *ox = x;
+    *oy = best_bottom - h;
+    return true;
+}
+
+static int atlas_image_cmp(void const *va, void const *vb)
+{
+    rsrc_image_t const *a = *(rsrc_image_t *const *)va;
+    rsrc_image_t const *b = *(rsrc_image_t *const *)vb;
+    return a->h != b->h ? b->h - a->h : b->w - a->w;
+}
+
+size_t Internal_PInst_BuildImageAtlas(struct ProgramInstance *Inst, struct Resource **Images, size_t NumImages, size_t *PageBytes)
+{
+    // Images already in an atlas, mapped in place, or too large for an atlas page are left alone.
+    rsrc_image_t **imgs = malloc(NumImages * sizeof(*imgs));
+    size_t num = 0;
+    for (size_t i = 0; i < NumImages; i++)
+    {
+        rsrc_image_t *img = Images[i]->data;
+        cairo_format_t fmt = cairo_image_surface_get_format(img->surface);
+        if (img->bAtlas || img->bMapped || (fmt != CAIRO_FORMAT_ARGB32 && fmt != CAIRO_FORMAT_RGB24) ||
+            img->w + ATLAS_PADDING > ATLAS_PAGE_SIZE || img->h + ATLAS_PADDING > ATLAS_PAGE_SIZE)
+            continue;
+        imgs[num++] = img;
+    }
+
+    // Tall images first gives flatter skyline.
+    qsort(imgs, num, sizeof(*imgs), atlas_image_cmp);
+
+    rsrc_image_t **page = malloc(num * sizeof(*page));
+    int(*pos)[2] = malloc(num * sizeof(*pos));
+    skyline_node_t *nodes = malloc((num + 1) * sizeof(skyline_node_t));
+    size_t numPages = 0, numPacked = 0, numBytes = 0;
+
+    while (num)
+    {
+        skyline_t sky;
+        skyline_init(&sky, nodes, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+
+        // Images which don't fit on this page are carried over to next page.
+        size_t numPlaced = 0, numLeft = 0;
+        for (size_t i = 0; i < num; i++)
+        {
+            int *p = pos[numPlaced];
+            if (skyline_insert(&sky, imgs[i]->w + ATLAS_PADDING, imgs[i]->h + ATLAS_PADDING, p, p + 1))
+                page[numPlaced++] = imgs[i];
+            else
+                imgs[numLeft++] = imgs[i];
+        }
+        num = numLeft;
+
+        cairo_surface_t *atlas = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, sky.used_w, sky.used_h);
+        if (numPlaced == 0 || cairo_surface_status(atlas) != CAIRO_STATUS_SUCCESS)
+        {
+            lvlog(LOGLEVEL_WARNING, "Failed to create atlas page of %d x %d\n", sky.used_w, sky.used_h);
+            cairo_surface_destroy(atlas);
+            break;
+        }
+
+        // Copy images into page, then let each image refer its place in the page.
+        cairo_surface_flush(atlas);
+        pixel_plane_t dst = image_plane(atlas);
+        for (size_t i = 0; i < numPlaced; i++)
+        {
+            rsrc_image_t *img = page[i];
+            pixel_plane_t src = image_sub_plane(img);
+            bool bOpaque = cairo_image_surface_get_format(img->surface) == CAIRO_FORMAT_RGB24;
+            cairo_surface_flush(img->surface);
+            blit_over(&dst, NULL, &src, pos[i][0], pos[i][1], bOpaque);
+
+            cairo_surface_destroy(img->surface);
+            img->surface = cairo_surface_reference(atlas);
+            img->x = pos[i][0];
+            img->y = pos[i][1];
+            img->bAtlas = true;
+        }
+        cairo_surface_mark_dirty(atlas);
+
+        // Page is released along with its last image.
+        cairo_surface_destroy(atlas);
+        numPages++;
+        numPacked += numPlaced;
+        numBytes += (size_t)dst.stride * dst.h;
+    }
+
+    lvlog(LOGLEVEL_INFO, "Packed %zu images into %zu atlas pages, %zu KiB\n", numPacked, numPages, numBytes >> 10);
+    free(nodes);
+    free(pos);
+    free(page);
+    free(imgs);
+    *PageBytes = numBytes;
+    return numPages;
 }
 
 void *Internal_PInst_LoadFont(struct ProgramInstance *Inst, char const *Path, LOADRESOURCE_FLAG_T Flag)
@@ -104,14 +979,132 @@ void *Internal_PInst_LoadFont(struct ProgramInstance *Inst, char const *Path, LO
     return f;
 }
 
-typedef struct _cairo_linuxfb_device
+/*! \brief Load line vector file.
+    \details
+        Line vector file is plain text. Each line is one of below;
+            x y     Point of polyline, in pixels at unit scale.
+            w width Stroke width of lines, in same unit as points. Scaled by draw transform along with them.
+            c       Close current polyline.
+            # ...   Comment
+        Empty line separates polylines.
+ */
+void *Internal_PInst_LoadVector(struct ProgramInstance *Inst, char const *Path)
 {
-    int fb_fd;
-    char *fb_data;
-    long fb_screensize;
-    struct fb_var_screeninfo fb_vinfo;
-    struct fb_fix_screeninfo fb_finfo;
-} cairo_linuxfb_device_t;
+    FILE *fp = fopen(Path, "r");
+    if (fp == NULL)
+        return NULL;
+
+    rsrc_vector_t *v = malloc(sizeof(rsrc_vector_t));
+    v->line_width = 1.0;
+
+    // Record path on scratch context, which has identity matrix.
+    cairo_surface_t *scratch = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+    cairo_t *cr = cairo_create(scratch);
+    bool bNewLine = true;
+    size_t numPoints = 0;
+    char line[256];
+
+    for (int lineno = 1; fgets(line, sizeof(line), fp); lineno++)
+    {
+        char *p = line;
+        double x, y;
+        while (*p == ' ' || *p == '\t')
+            ++p;
+
+        switch (*p)
+        {
+        case '#':
+            continue;
+        case '\r':
+        case '\n':
+        case '\0':
+            bNewLine = true;
+            continue;
+        case 'w':
+            sscanf(p + 1, "%lf", &v->line_width);
+            continue;
+        case 'c':
+            cairo_close_path(cr);
+            bNewLine = true;
+            continue;
+        }
+
+        if (sscanf(p, "%lf %lf", &x, &y) != 2)
+        {
+            lvlog(LOGLEVEL_WARNING, "%s:%d is not a valid line vector statement\n", Path, lineno);
+            continue;
+        }
+
+        if (bNewLine)
+            cairo_move_to(cr, x, y);
+        else
+            cairo_line_to(cr, x, y);
+        bNewLine = false;
+        numPoints++;
+    }
+    fclose(fp);
+
+    v->path = cairo_copy_path(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(scratch);
+
+    if (v->path->status != CAIRO_STATUS_SUCCESS || numPoints == 0)
+    {
+        lvlog(LOGLEVEL_WARNING, "Failed to build line vector %s\n", Path);
+        cairo_path_destroy(v->path);
+        free(v);
+        return NULL;
+    }
+
+    return v;
+}
+
+size_t Internal_PInst_GraphicResourceBytes(EResourceType Type, void const *Data)
+{
+    switch (Type)
+    {
+    case RESOURCE_IMAGE:
+    {
+        // Freeing packed image only drops its reference to shared atlas page, thus it is never evicted.
+        rsrc_image_t const *img = Data;
+        if (img->bAtlas)
+            return 0;
+        return (size_t)cairo_image_surface_get_stride(img->surface) * img->h;
+    }
+    case RESOURCE_LINEVECTOR:
+    {
+        rsrc_vector_t const *v = Data;
+        return sizeof(rsrc_vector_t) + sizeof(cairo_path_t) + v->path->num_data * sizeof(cairo_path_data_t);
+    }
+    default:
+        // Font faces are owned by cairo's font cache, and never evicted.
+        return 0;
+    }
+}
+
+void Internal_PInst_FreeGraphicResource(EResourceType Type, void *Data)
+{
+    switch (Type)
+    {
+    case RESOURCE_IMAGE:
+    {
+        rsrc_image_t *img = Data;
+        cairo_surface_destroy(img->surface);
+        free(img);
+        break;
+    }
+    case RESOURCE_LINEVECTOR:
+    {
+        rsrc_vector_t *v = Data;
+        cairo_path_destroy(v->path);
+        free(v);
+        break;
+    }
+    case RESOURCE_FONT:
+        cairo_font_face_destroy(Data);
+        break;
+    }
+}
 
 static void cairo_linuxfb_surface_destroy(void *device)
 {
@@ -153,48 +1146,173 @@ static cairo_surface_t *cairo_linuxfb_surface_create(const char *fb_name)
         exit(3);
     }
 
+    // Get fixed screen information
+    if (ioctl(device->fb_fd, FBIOGET_FSCREENINFO, &device->fb_finfo) == -1)
+    {
+        perror("Error reading fixed information");
+        exit(2);
+    }
+
+    // Pixel format is selected by depth of screen. Rows may be padded, thus stride comes from the driver.
+    cairo_format_t fmt = device->fb_vinfo.bits_per_pixel == 16 ? CAIRO_FORMAT_RGB16_565 : CAIRO_FORMAT_ARGB32;
+    int stride = device->fb_finfo.line_length;
+    if (stride == 0)
+        stride = cairo_format_stride_for_width(fmt, device->fb_vinfo.xres);
+
     // Figure out the size of the screen in bytes
-    device->fb_screensize = device->fb_vinfo.xres * device->fb_vinfo.yres * device->fb_vinfo.bits_per_pixel / 8;
+    device->fb_screensize = (long)stride * device->fb_vinfo.yres;
 
     // Map the device to memory
     device->fb_data = (char *)mmap(0, device->fb_screensize,
                                    PROT_READ | PROT_WRITE, MAP_SHARED,
                                    device->fb_fd, 0);
-    memset(device->fb_data, 0, device->fb_screensize);
 
-    if ((int)device->fb_data == -1)
+    if (device->fb_data == MAP_FAILED)
     {
         perror("Error: failed to map framebuffer device to memory");
         exit(4);
     }
-
-    // Get fixed screen information
-    if (ioctl(device->fb_fd, FBIOGET_FSCREENINFO, &device->fb_finfo) == -1)
-    {
-        perror("Error reading fixed information");
-        exit(2);
-    }
+    memset(device->fb_data, 0, device->fb_screensize);
 
     surface = cairo_image_surface_create_for_data(device->fb_data,
-                                                  CAIRO_FORMAT_ARGB32,
+                                                  fmt,
                                                   device->fb_vinfo.xres,
                                                   device->fb_vinfo.yres,
-                                                  cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32,
-                                                                                device->fb_vinfo.xres));
+                                                  stride);
 
-    logprintf("xres: %u, yres: %u, bpp: %d\n",
+    logprintf("xres: %u, yres: %u, bpp: %d, stride: %d\n",
               device->fb_vinfo.xres,
               device->fb_vinfo.yres,
-              device->fb_vinfo.bits_per_pixel);
-    cairo_surface_set_user_data(surface, NULL, device,
+              device->fb_vinfo.bits_per_pixel,
+              stride);
+    cairo_surface_set_user_data(surface, &cairo_linuxfb_device_key, device,
                                 &cairo_linuxfb_surface_destroy);
 
     return surface;
 }
 
+/*! \brief Find layout of given string from cache. Builds new layout on cache miss.
+    \param fb 
+    \param cr Context which font face and size is already selected.
+    \return Layout of string whose origin is (0, 0). NULL if failed to build layout.
+ */
+static text_layout_t const *text_layout_get(program_cairo_wrapper_t *fb, cairo_t *cr, char const *str, cairo_font_face_t *font, float size)
+{
+    FHash hash = hash_djb2(str);
+    uint32_t size_bits;
+    memcpy(&size_bits, &size, sizeof(size_bits));
+    uint32_t key = hash ^ (uint32_t)(uintptr_t)font ^ size_bits;
+    text_layout_t *set = fb->text_layouts[(key ^ (key >> 16)) % TEXT_LAYOUT_CACHE_NUM_SETS];
+    text_layout_t *victim = set;
+
+    for (size_t i = 0; i < TEXT_LAYOUT_CACHE_NUM_WAYS; i++)
+    {
+        text_layout_t *e = set + i;
+        if (e->last_used && e->hash == hash && e->font == font && e->size == size && strcmp(e->str, str) == 0)
+        {
+            e->last_used = fb->frame;
+            fb->stats->TextLayoutHit++;
+            return e;
+        }
+
+        if (e->last_used < victim->last_used)
+            victim = e;
+    }
+
+    // Strings that does not fit in key buffer are never cached.
+    fb->stats->TextLayoutMiss++;
+    size_t len = strlen(str);
+    if (len >= TEXT_LAYOUT_MAX_STRING)
+        victim = NULL;
+    else if (victim->last_used)
+        fb->stats->TextLayoutEvict++;
+
+    // Build glyph layout of string
+    static text_layout_t uncached;
+    text_layout_t *e = victim ? victim : &uncached;
+    cairo_glyph_free(e->glyphs);
+    e->glyphs = NULL;
+    e->num_glyphs = 0;
+    e->last_used = 0;
+
+    cairo_scaled_font_t *sf = cairo_get_scaled_font(cr);
+    if (cairo_scaled_font_text_to_glyphs(sf, 0, 0, str, len, &e->glyphs, &e->num_glyphs, NULL, NULL, NULL) != CAIRO_STATUS_SUCCESS)
+        return NULL;
+    cairo_scaled_font_glyph_extents(sf, e->glyphs, e->num_glyphs, &e->ext);
+
+    if (victim)
+    {
+        e->hash = hash;
+        e->font = font;
+        e->size = size;
+        memcpy(e->str, str, len + 1);
+        e->last_used = fb->frame;
+    }
+
+    return e;
+}
+
+// Render scale changes in steps, so back buffers are not recreated on every small change of frame time.
+#define RENDER_SCALE_STEP (1.0f / 16.0f)
+// Frames to wait after scale change, until frame time of new scale is measured.
+#define RENDER_SCALE_COOLDOWN 8
+
+/*! \brief Select scale of next frame from measured frame time.
+    \details Cost of frame is assumed to be proportional to number of pixels. Scale is raised only if
+        predicted frame time of next step is well within target, to avoid oscillation.
+ */
+static void render_scale_update(program_cairo_wrapper_t *fb)
+{
+    if (fb->target_frame_ns <= 0.0f || fb->stats->NumFrames == 0)
+        return;
+
+    double t = fb->stats->LastFrameTimeNs;
+    fb->frame_time_ema = fb->frame_time_ema > 0.0 ? fb->frame_time_ema * 0.75 + t * 0.25 : t;
+    if (fb->scale_cooldown > 0)
+    {
+        fb->scale_cooldown--;
+        return;
+    }
+
+    float s = fb->render_scale;
+    float up = s + RENDER_SCALE_STEP;
+    if (fb->frame_time_ema > fb->target_frame_ns && s > fb->min_scale)
+        s = s - RENDER_SCALE_STEP < fb->min_scale ? fb->min_scale : s - RENDER_SCALE_STEP;
+    else if (s < 1.0f && fb->frame_time_ema * (up * up) / (s * s) < fb->target_frame_ns * 0.85)
+        s = up > 1.0f ? 1.0f : up;
+
+    if (s != fb->render_scale)
+    {
+        fb->render_scale = s;
+        fb->frame_time_ema = 0.0;
+        fb->scale_cooldown = RENDER_SCALE_COOLDOWN;
+        fb->stats->NumRenderScaleChanges++;
+    }
+}
+
+/*! \brief Recreate back buffer surface in given scale, over same memory. */
+static void backbuffer_resize(program_cairo_wrapper_t *fb, int idx, float scale)
+{
+    int h = (int)lrintf(fb->h * scale);
+    int w = (int)lrintf(fb->w * h / fb->h);
+    int strd = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, w);
+
+    cairo_surface_destroy(fb->backbuffer[idx]);
+    fb->backbuffer[idx] = cairo_image_surface_create_for_data(fb->backbuffer_memory[idx], CAIRO_FORMAT_ARGB32, w, h, strd);
+    fb->buffer_scale[idx] = scale;
+    render_context_reset(fb, idx);
+}
+
 void Internal_PInst_Predraw(void *hFB, int ActiveBuffer)
 {
     program_cairo_wrapper_t *fb = hFB;
+    fb->frame++;
+    vsync_acquire_buffer(fb, ActiveBuffer);
+
+    render_scale_update(fb);
+    if (fb->buffer_scale[ActiveBuffer] != fb->render_scale)
+        backbuffer_resize(fb, ActiveBuffer, fb->render_scale);
+
     cairo_surface_t *surf_bck = fb->backbuffer[ActiveBuffer];
 
     // Clear back buffer
@@ -202,13 +1320,28 @@ void Internal_PInst_Predraw(void *hFB, int ActiveBuffer)
     size_t strd = cairo_image_surface_get_stride(surf_bck);
     size_t h = cairo_image_surface_get_height(surf_bck);
 
-    // Create context for buff
-    fb->context = cairo_create(surf_bck);
+    // Coordinates are in pixels of screen, thus scaled down to pixels of back buffer.
+    fb->unit = h;
+    fb->scale = h / fb->h;
+    fb->stats->RenderScale = fb->scale;
+
+    // Select context of buffer. Context which went into error state can't be used anymore.
+    if (cairo_status(fb->contexts[ActiveBuffer]) != CAIRO_STATUS_SUCCESS)
+    {
+        lvlog(LOGLEVEL_WARNING, "Render context of buffer %d is in error state: %s\n",
+              ActiveBuffer, cairo_status_to_string(cairo_status(fb->contexts[ActiveBuffer])));
+        render_context_reset(fb, ActiveBuffer);
+    }
+    fb->context = fb->contexts[ActiveBuffer];
+    fb->state = &fb->states[ActiveBuffer];
 
     extern cairo_surface_t *gBackgroundSurface;
     if (gBackgroundSurface)
     {
-        cairo_set_source_surface(fb->context, gBackgroundSurface, 0, 0);
+        cairo_matrix_t m;
+        cairo_matrix_init_scale(&m, fb->scale, fb->scale);
+        state_set_matrix(fb, &m);
+        state_set_source_surface(fb, gBackgroundSurface, 0, 0);
         cairo_paint(fb->context);
     }
     else
@@ -217,34 +1350,129 @@ void Internal_PInst_Predraw(void *hFB, int ActiveBuffer)
     }
 }
 
+/*! \brief Draw image without cairo, if the draw call is unscaled, unrotated, and placed on whole pixel.
+    \details Cairo filters image on subpixel position or scale, thus such draw calls are left to cairo.
+    \return true if the image was drawn.
+ */
+static bool draw_image_fast(program_cairo_wrapper_t *fb, struct RenderEventArg const *Arg, int ActiveBuffer)
+{
+    rsrc_image_t const *img = Arg->Data.Image.Image->data;
+    cairo_format_t fmt = cairo_image_surface_get_format(img->surface);
+    if (fmt != CAIRO_FORMAT_ARGB32 && fmt != CAIRO_FORMAT_RGB24)
+        return false;
+
+    // Rotation, scale, and reduced render scale disable fast path.
+#if defined(PINST_RENDER_ALLOW_ROTATION)
+    if (Arg->Transform.R != 0.0f)
+        return false;
+#endif
+    if (fb->scale != 1.0f || Arg->Transform.S.x != 1.0f || Arg->Transform.S.y != 1.0f)
+        return false;
+
+    // Image is placed as cairo path places it, which must be on whole pixel.
+    pixel_plane_t src = image_sub_plane(img);
+    double left = Arg->Transform.P.x * fb->unit - src.w / 2;
+    double top = Arg->Transform.P.y * fb->unit - src.h / 2;
+    if (left != floor(left) || top != floor(top) || fabs(left) > INT_MAX / 2 || fabs(top) > INT_MAX / 2)
+        return false;
+
+    cairo_surface_t *bck = fb->backbuffer[ActiveBuffer];
+    cairo_surface_flush(bck);
+    pixel_plane_t dst = image_plane(bck);
+
+    int x = (int)left, y = (int)top;
+    blit_over(&dst, NULL, &src, x, y, fmt == CAIRO_FORMAT_RGB24);
+
+    cairo_surface_mark_dirty_rectangle(bck, x, y, src.w, src.h);
+    fb->stats->NumImageBlits++;
+    return true;
+}
+
+//! Convert color to premultiplied ARGB32 pixel.
+static inline uint32_t color_to_pixel(FColor c)
+{
+    float a = c.A < 0 ? 0 : c.A > 1 ? 1 : c.A;
+    uint32_t A = (uint32_t)(a * 255.0f + 0.5f);
+    uint32_t R = (uint32_t)((c.R < 0 ? 0 : c.R > 1 ? 1 : c.R) * a * 255.0f + 0.5f);
+    uint32_t G = (uint32_t)((c.G < 0 ? 0 : c.G > 1 ? 1 : c.G) * a * 255.0f + 0.5f);
+    uint32_t B = (uint32_t)((c.B < 0 ? 0 : c.B > 1 ? 1 : c.B) * a * 255.0f + 0.5f);
+    return A << 24 | R << 16 | G << 8 | B;
+}
+
+static void draw_rect(program_cairo_wrapper_t *fb, struct RenderEventArg const *Arg, int ActiveBuffer)
+{
+    struct RenderEventData_Rectangle const *p = &Arg->Data.Rect;
+    int x = (int)lrintf(Arg->Transform.P.x * fb->unit);
+    int y = (int)lrintf(Arg->Transform.P.y * fb->unit);
+    float sc = fb->scale;
+    pixel_rect_t r = {
+        x + (int)lrintf(p->x0 * sc), y + (int)lrintf(p->y0 * sc),
+        x + (int)lrintf(p->x1 * sc), y + (int)lrintf(p->y1 * sc)};
+
+    cairo_surface_t *bck = fb->backbuffer[ActiveBuffer];
+    cairo_surface_flush(bck);
+    pixel_plane_t dst = image_plane(bck);
+
+    // Dirty region and statistics cover only pixels actually filled.
+    fb->stats->NumRectFills++;
+    if (!rect_intersect(&r, &(pixel_rect_t){0, 0, dst.w, dst.h}))
+        return;
+
+    uint64_t begin = Clock_Now();
+    fill_rect(&dst, NULL, &r, color_to_pixel(p->rgba));
+    fb->stats->RectFillTimeNs += Clock_Now() - begin;
+
+    cairo_surface_mark_dirty_rectangle(bck, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0);
+    fb->stats->RectFillPixels += (uint64_t)(r.x1 - r.x0) * (r.y1 - r.y0);
+}
+
 void Internal_PInst_Draw(void *hFB, struct RenderEventArg const *Arg, int ActiveBuffer)
 {
     program_cairo_wrapper_t *fb = hFB;
     cairo_t *cr = fb->context;
-    cairo_save(cr);
+
+    if (Arg->Type == ERET_IMAGE && draw_image_fast(fb, Arg, ActiveBuffer))
+        return;
+
+    if (Arg->Type == ERET_RECT)
+    {
+        draw_rect(fb, Arg, ActiveBuffer);
+        return;
+    }
 
     // Translate location
     FTransform2 tr = Arg->Transform;
-    tr.P.x *= fb->h;
-    tr.P.y *= fb->h;
+    tr.P.x *= fb->unit;
+    tr.P.y *= fb->unit;
+
+    // Every draw call sets its whole matrix, instead of save/restore pair.
+    cairo_matrix_t m;
 
     switch (Arg->Type)
     {
     case ERET_IMAGE:
     {
-        cairo_translate(cr, tr.P.x, tr.P.y);
+        cairo_matrix_init_translate(&m, tr.P.x, tr.P.y);
 
-        cairo_surface_t *rsrc = Arg->Data.Image.Image->data;
-        int w = cairo_image_surface_get_width(rsrc);
-        int h = cairo_image_surface_get_height(rsrc);
+        rsrc_image_t const *img = Arg->Data.Image.Image->data;
 
         // @todo. Scale
 
 #if defined(PINST_RENDER_ALLOW_ROTATION)
-        cairo_rotate(cr, tr.R);
+        cairo_matrix_rotate(&m, tr.R);
 #endif
-        cairo_set_source_surface(cr, rsrc, -w / 2, -h / 2);
-        cairo_paint(cr);
+        cairo_matrix_scale(&m, fb->scale, fb->scale);
+        state_set_matrix(fb, &m);
+        state_set_source_surface(fb, img->surface, -img->w / 2 - img->x, -img->h / 2 - img->y);
+
+        // Image in atlas must not bleed its neighbors.
+        if (img->bAtlas)
+        {
+            cairo_rectangle(cr, -img->w / 2, -img->h / 2, img->w, img->h);
+            cairo_fill(cr);
+        }
+        else
+            cairo_paint(cr);
     }
     break;
 
@@ -253,17 +1481,27 @@ void Internal_PInst_Draw(void *hFB, struct RenderEventArg const *Arg, int Active
         // Select font
         struct RenderEventData_Text p = Arg->Data.Text;
         cairo_font_face_t *font = p.Font->data;
-        cairo_set_font_face(cr, font);
-        FColor c = p.rgba;
-        cairo_set_source_rgba(cr, c.R, c.G, c.B, c.A);
-        cairo_set_font_size(cr, (tr.S.x + tr.S.y) * .5f);
+        float size = (tr.S.x + tr.S.y) * .5f * fb->scale;
+        state_set_font(fb, font, size);
+        state_set_color(fb, p.rgba);
+
+        // Scaled font depends on linear part of matrix. Drop rotation or scale left by previous draw.
+        render_state_t const *st = fb->state;
+        if (st->matrix.xx != 1.0 || st->matrix.xy != 0.0 || st->matrix.yx != 0.0 || st->matrix.yy != 1.0)
+        {
+            cairo_matrix_init_identity(&m);
+            state_set_matrix(fb, &m);
+        }
+
+        text_layout_t const *layout = text_layout_get(fb, cr, p.Str, font, size);
+        if (layout == NULL)
+            break;
 
 #if defined(PINST_RENDER_ALLOW_ROTATION)
-        cairo_translate(...); // @todo.
-        cairo_rotate(cr, tr.R);
+        cairo_matrix_init_translate(&m, ...); // @todo.
+        cairo_matrix_rotate(&m, tr.R);
 #else
-        cairo_text_extents_t ext;
-        cairo_text_extents(cr, p.Str, &ext);
+        cairo_text_extents_t ext = layout->ext;
         const bool bHC = ((bool)p.Flags & PINST_TEXTFLAG_HALIGN_CENTER);
         const bool bHR = ((bool)p.Flags & PINST_TEXTFLAG_HALIGN_RIGHT);
         const bool bVC = ((bool)p.Flags & PINST_TEXTFLAG_VALIGN_CENTER);
@@ -274,50 +1512,72 @@ void Internal_PInst_Draw(void *hFB, struct RenderEventArg const *Arg, int Active
 
         tr.P.x += xadd;
         tr.P.y += yadd;
-        cairo_move_to(cr, tr.P.x, tr.P.y);
+        cairo_matrix_init_translate(&m, tr.P.x, tr.P.y);
 #endif
+        state_set_matrix(fb, &m);
 
-        cairo_show_text(cr, Arg->Data.Text.Str);
+        // Cached glyphs are laid out on origin.
+        cairo_show_glyphs(cr, layout->glyphs, layout->num_glyphs);
+    }
+    break;
+
+    case ERET_POLY:
+    {
+        struct RenderEventData_Polylines const *p = &Arg->Data.Poly;
+        rsrc_vector_t const *v = p->PolyLines->data;
+
+        // Degenerated matrix would put context into error state.
+        if (tr.S.x == 0.0f || tr.S.y == 0.0f)
+            break;
+
+        uint64_t begin = Clock_Now();
+        cairo_matrix_init_translate(&m, tr.P.x, tr.P.y);
+        cairo_matrix_rotate(&m, tr.R);
+        cairo_matrix_scale(&m, tr.S.x * fb->scale, tr.S.y * fb->scale);
+        state_set_matrix(fb, &m);
+
+        cairo_new_path(cr);
+        cairo_append_path(cr, v->path);
+        state_set_stroke(fb, v->line_width, CAIRO_LINE_JOIN_ROUND);
+        state_set_color(fb, p->rgba);
+        cairo_stroke(cr);
+
+        fb->stats->PolyDrawTimeNs += Clock_Now() - begin;
+        fb->stats->NumPolyDraws++;
     }
     break;
 
     default:
         break;
     }
-
-    cairo_restore(cr);
 }
 
 void Internal_PInst_Flush(void *hFB, int ActiveBuffer)
 {
     program_cairo_wrapper_t *fb = hFB;
+    vsync_presenter_t *vs = &fb->vsync;
 
-    // Finalize buffer context
-    cairo_destroy(fb->context);
+    if (vs->bThread)
+    {
+        // Hand the frame over to presenter. Newer frame replaces one which is still waiting.
+        pthread_mutex_lock(&vs->lock);
+        if (vs->bActive)
+        {
+            // Presenter counts the frame once it reaches the screen.
+            vs->num_dropped += vs->pending != -1;
+            vs->pending = ActiveBuffer;
+            pthread_mutex_unlock(&vs->lock);
+            return;
+        }
 
-    // Copy value to frame buffer
-    cairo_surface_t *surf_bck = fb->backbuffer[ActiveBuffer];
-    //     cairo_t *frame = cairo_create(fb->screen);
-    //     cairo_set_source_surface(frame, surf_bck, 0, 0);
-    //     cairo_paint(frame);
-    //     cairo_destroy(frame);
-
-    uint32_t *dst = cairo_image_surface_get_data(fb->screen);
-    uint32_t *src = cairo_image_surface_get_data(surf_bck);
-    int x = cairo_image_surface_get_width(fb->screen);
-    int h = cairo_image_surface_get_height(fb->screen);
-    int sz = x * h;
-
-    // For each pxls ...
-    for (char *p, *s; sz--; ++dst, ++src)
-    {
-        p = dst;
-        s = src;
-        p[2] = s[0];
-        p[1] = s[1];
-        p[0] = s[2];
-        p[3] = s[3];
+        // Presenter may still be copying frame it left behind, with same upscaler.
+        while (vs->presenting != -1)
+            pthread_cond_wait(&vs->cond, &vs->lock);
+        pthread_mutex_unlock(&vs->lock);
     }
+
+    present(fb, ActiveBuffer);
+    fb->stats->NumFramesPresented++;
 }
 
 FVec2float PInst_ScreenToWorld(struct ProgramInstance *s, int x, int y)
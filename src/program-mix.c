@@ -0,0 +1,197 @@
+/*! \brief Sound mixing kernels
+    \file program-mix.c
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-09
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+ */
+#include "program-mix.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIX_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MIX_SSE2 1
+#endif
+
+#if defined(MIX_SSE2) && defined(__GNUC__)
+#include <immintrin.h>
+#define MIX_AVX2 1
+#define MIX_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static inline int16_t mix_sat16(int32_t v)
+{
+    return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+}
+
+static void accum_scalar(int32_t *acc, int16_t const *src, int32_t gain, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        acc[i] += src[i] * gain;
+}
+
+static void store_scalar(int16_t *dst, int32_t const *acc, int shift, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = mix_sat16(acc[i] >> shift);
+}
+
+static mix_kernels_t const g_mix_scalar = {"scalar", accum_scalar, store_scalar};
+
+#if defined(MIX_NEON)
+static void accum_neon(int32_t *acc, int16_t const *src, int32_t gain, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        int16x8_t s = vld1q_s16(src + i);
+        vst1q_s32(acc + i, vmlal_n_s16(vld1q_s32(acc + i), vget_low_s16(s), gain));
+        vst1q_s32(acc + i + 4, vmlal_n_s16(vld1q_s32(acc + i + 4), vget_high_s16(s), gain));
+    }
+    accum_scalar(acc + i, src + i, gain, n - i);
+}
+
+static void store_neon(int16_t *dst, int32_t const *acc, int shift, size_t n)
+{
+    // Shift by negative count is arithmetic shift right, same as scalar.
+    int32x4_t const vshift = vdupq_n_s32(-shift);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        int16x4_t lo = vqmovn_s32(vshlq_s32(vld1q_s32(acc + i), vshift));
+        int16x4_t hi = vqmovn_s32(vshlq_s32(vld1q_s32(acc + i + 4), vshift));
+        vst1q_s16(dst + i, vcombine_s16(lo, hi));
+    }
+    store_scalar(dst + i, acc + i, shift, n - i);
+}
+
+static mix_kernels_t const g_mix_neon = {"neon", accum_neon, store_neon};
+#endif
+
+#if defined(MIX_SSE2)
+static void accum_sse2(int32_t *acc, int16_t const *src, int32_t gain, size_t n)
+{
+    __m128i const vg = _mm_set1_epi16(gain);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        // 32 bit products from low and high halves of 16 bit multiplication
+        __m128i s = _mm_loadu_si128((__m128i const *)(src + i));
+        __m128i pl = _mm_mullo_epi16(s, vg);
+        __m128i ph = _mm_mulhi_epi16(s, vg);
+        __m128i *a = (__m128i *)(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), _mm_unpacklo_epi16(pl, ph)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_unpackhi_epi16(pl, ph)));
+    }
+    accum_scalar(acc + i, src + i, gain, n - i);
+}
+
+static void store_sse2(int16_t *dst, int32_t const *acc, int shift, size_t n)
+{
+    __m128i const vshift = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i lo = _mm_sra_epi32(_mm_loadu_si128((__m128i const *)(acc + i)), vshift);
+        __m128i hi = _mm_sra_epi32(_mm_loadu_si128((__m128i const *)(acc + i + 4)), vshift);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(lo, hi));
+    }
+    store_scalar(dst + i, acc + i, shift, n - i);
+}
+
+static mix_kernels_t const g_mix_sse2 = {"sse2", accum_sse2, store_sse2};
+#endif
+
+#if defined(MIX_AVX2)
+MIX_TARGET_AVX2 static void accum_avx2(int32_t *acc, int16_t const *src, int32_t gain, size_t n)
+{
+    __m256i const vg = _mm256_set1_epi32(gain);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i s0 = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i const *)(src + i)));
+        __m256i s1 = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i const *)(src + i + 8)));
+        __m256i *a = (__m256i *)(acc + i);
+        _mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), _mm256_mullo_epi32(s0, vg)));
+        _mm256_storeu_si256(a + 1, _mm256_add_epi32(_mm256_loadu_si256(a + 1), _mm256_mullo_epi32(s1, vg)));
+    }
+
+    // Leave no dirty upper state to SSE code, which would stall on transition.
+    _mm256_zeroupper();
+    accum_sse2(acc + i, src + i, gain, n - i);
+}
+
+MIX_TARGET_AVX2 static void store_avx2(int16_t *dst, int32_t const *acc, int shift, size_t n)
+{
+    __m128i const vshift = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i lo = _mm256_sra_epi32(_mm256_loadu_si256((__m256i const *)(acc + i)), vshift);
+        __m256i hi = _mm256_sra_epi32(_mm256_loadu_si256((__m256i const *)(acc + i + 8)), vshift);
+
+        // Pack works in each 128 bit lane. Restore sample order across lanes.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8);
+        _mm256_storeu_si256((__m256i *)(dst + i), packed);
+    }
+    _mm256_zeroupper();
+    store_sse2(dst + i, acc + i, shift, n - i);
+}
+
+static mix_kernels_t const g_mix_avx2 = {"avx2", accum_avx2, store_avx2};
+#endif
+
+static mix_kernels_t const *g_mix_best;
+
+static mix_kernels_t const *mix_select(void)
+{
+    if (g_mix_best)
+        return g_mix_best;
+
+    mix_kernels_t const *best = &g_mix_scalar;
+#if defined(MIX_NEON)
+    best = &g_mix_neon;
+#elif defined(MIX_SSE2)
+    best = &g_mix_sse2;
+#endif
+#if defined(MIX_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+        best = &g_mix_avx2;
+#endif
+
+    // Every thread selects same one. Race is harmless.
+    return g_mix_best = best;
+}
+
+void mix_accum_s16(int32_t *acc, int16_t const *src, int32_t gain, size_t n)
+{
+    mix_select()->accum(acc, src, gain, n);
+}
+
+void mix_store_s16(int16_t *dst, int32_t const *acc, int shift, size_t n)
+{
+    mix_select()->store(dst, acc, shift, n);
+}
+
+size_t mix_get_kernels(mix_kernels_t const *out[], size_t max)
+{
+    mix_kernels_t const *all[4];
+    size_t num = 0;
+
+    all[num++] = &g_mix_scalar;
+#if defined(MIX_NEON)
+    all[num++] = &g_mix_neon;
+#elif defined(MIX_SSE2)
+    all[num++] = &g_mix_sse2;
+#endif
+#if defined(MIX_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+        all[num++] = &g_mix_avx2;
+#endif
+
+    for (size_t i = 0; i < num && i < max; i++)
+        out[i] = all[i];
+    return num;
+}
@@ -0,0 +1,43 @@
+/*! \brief Sound mixing kernels for 16 bit PCM.
+    \file program-mix.h
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-09
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Voices are accumulated with their gain into 32 bit buffer, which is converted into 16 bit
+        output once per period with saturation. Accumulation never clips, so result doesn't depend
+        on order of voices.
+        Kernels are vectorized with NEON on ARM, and SSE2 or AVX2 on x86. AVX2 is selected on run time.
+        Every variant produces output identical to scalar reference.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/*! \brief Set of mixing kernels for one instruction set. */
+typedef struct mix_kernels
+{
+    char const *name;
+
+    //! acc[i] += src[i] * gain. Gain should be in range of int16.
+    void (*accum)(int32_t *acc, int16_t const *src, int32_t gain, size_t n);
+
+    //! dst[i] = acc[i] >> shift, saturated to int16.
+    void (*store)(int16_t *dst, int32_t const *acc, int shift, size_t n);
+} mix_kernels_t;
+
+/*! \brief Accumulate voice into mix buffer, with best kernel for this CPU.
+    \details With gain of Q8, 256 full scale voices fit in accumulator without overflow.
+ */
+void mix_accum_s16(int32_t *acc, int16_t const *src, int32_t gain, size_t n);
+
+//! Convert mix buffer into output samples, with best kernel for this CPU.
+void mix_store_s16(int16_t *dst, int32_t const *acc, int shift, size_t n);
+
+/*! \brief Every kernel set runnable on this CPU. Scalar reference comes first, the one in use comes last.
+    \param out Receives up to max kernel sets.
+    \return Number of kernel sets.
+ */
+size_t mix_get_kernels(mix_kernels_t const *out[], size_t max);
@@ -6,28 +6,40 @@
     \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
     
     \details
+        Mixer thread mixes active voices a period at a time into lock-free ring, keeping it filled
+        up to its share of output latency. Output thread sleeps in snd_pcm_wait until device buffer
+        has room for a period, then moves a period from the ring to the device. Output thread never
+        waits for mixer or locks, thus a late mix eats into ring instead of causing device xrun.
+        Once every voice has ended and the device has played out, the device is stopped and both
+        threads sleep until next play request.
  */
 #include <alsa/asoundlib.h>
 #include <alsa/pcm.h>
 #include "core/program.h"
-
-#define CHUNK_SIZE 1024
+#include "core/internal/program-types.h"
+#include "core/internal/resource-pack.h"
+#include "core/spsc-ring.h"
+#include "program-mix.h"
+#include "program-wav.h"
+#include <semaphore.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Rate to request from device. Device may run in nearest one it supports natively.
 #define STANDARD_SAMPLE_RATE 11000
-#define MAX_WAV_QUEUE_SECONDS 600 // 10 minutes
-#define NUM_CHUNKS ((STANDARD_SAMPLE_RATE * MAX_WAV_QUEUE_SECONDS - 1) / CHUNK_SIZE + 1)
 #define MAX_QUEABLE_WAV_SOURCE 16
 #define PCM_DEVICE "default"
 #define DEFAULT_CHANNEL_NUMB 1
+// Output latency is divided into periods of device buffer, and periods mixed ahead in ring.
+#define SOUND_DEVICE_PERIODS 2
+#define SOUND_RING_PERIODS 2
+// Device which doesn't consume samples within this time is considered stalled.
+#define SOUND_WAIT_TIMEOUT_MS 1000
 
 #define countof(arr) (sizeof(arr) / sizeof(*arr))
 typedef int16_t sample_t;
-#define SAMPLE_MAXV 32767
-#define SAMPLE_MINV -32768
-
-typedef struct wavchunk
-{
-    sample_t pcm[CHUNK_SIZE];
-} wavchunk_t;
 
 typedef struct wavequeuearg
 {
@@ -36,78 +48,79 @@ typedef struct wavequeuearg
     uint32_t volume;
 } wavequeuearg_t;
 
-typedef struct sound
+typedef struct voice
 {
-    // Wave circular queue properties.
-    size_t queue_playidx;
-    size_t queue_lastidx;
+    struct wav_rsrc const *wav;
+    size_t pos;
+    int32_t volume;
+} voice_t;
 
-    // Sound output thread
+typedef struct sound
+{
+    // Device data
+    snd_pcm_t *PCM;
+    unsigned Rate;
+    snd_pcm_uframes_t PeriodFrames;
+    snd_pcm_uframes_t BufferFrames;
+
+    // Mixer thread. Sleeps on condition while silent, and on semaphore while ring is full.
+    pthread_t hMixThr;
+    pthread_mutex_t Lock;
+    pthread_cond_t Cond;
+    sem_t SpaceSem;
+    bool bMixerWaiting;
+    // Set while mixer has no voice. Every period it has mixed is in the ring then.
+    bool bMixerIdle;
+
+    // Output thread. Sleeps on semaphore while device is stopped.
     pthread_t hOutpThr;
+    sem_t DataSem;
+    bool bOutputWaiting;
 
-    // Sound process thread
-    pthread_t hProcThr;
-    wavequeuearg_t WavData[MAX_QUEABLE_WAV_SOURCE];
+    // Mixed samples, from mixer to output thread.
+    spsc_ring_t Ring;
+    // Frames mixer keeps in ring.
+    size_t RingFrames;
 
     // Deactivation notifier.
     bool bActive;
+    bool bStopAll;
 
-    // Place in tail because of its huge size.
-    wavchunk_t queue[NUM_CHUNKS];
-
-    // Device data
-    snd_pcm_t *PCM;
+    // Play requests, taken by mixer thread before next period.
+    wavequeuearg_t WavData[MAX_QUEABLE_WAV_SOURCE];
+    size_t NumWavData;
+
+    // Voices being mixed. Changed by mixer thread only, under lock.
+    voice_t Voices[MAX_QUEABLE_WAV_SOURCE];
+    size_t NumVoices;
+
+    // One period of mixing accumulator and output, and of output thread.
+    int32_t *Accum;
+    sample_t *Period;
+    sample_t *OutPeriod;
+
+    // Statistics
+    size_t NumMixed;
+    size_t NumPeriods;
+    size_t NumXruns;
+    size_t NumVoicesPlayed;
+    size_t NumVoicesDropped;
+    uint64_t MixTimeNs;
 } sound_t;
 
-/*! \brief Wave header 
- */
-#pragma pack(push, 4)
-typedef struct RIFF
-{
-    char RIFF[4];
-    uint32_t riff_chunkSz;
-    char riff_format[4];
-} RIFF_t;
-
-typedef struct FMT
-{
-    char fmt_[4];
-    uint32_t fmt_chunkSz;
-    uint16_t fmt_audioFmt;
-    uint16_t fmt_numCh;
-    uint32_t fmt_sampleRate;
-    uint32_t fmt_byteRate;
-    uint16_t fmt_blkAlign;
-    uint16_t fmt_bitsPerSmpl;
-} FMT_t;
-
-typedef struct DATA
-{
-    char data[4];
-    uint32_t data_chunkSz;
-} DATA_t;
-#pragma pack(pop)
-
+// Samples either follow descriptor, or are placed in resource pack.
 typedef struct wav_rsrc
 {
     size_t numSamples;
-    intptr_t ptr[0];
+    sample_t const *samples;
+    sample_t data[];
 } wav_rsrc_t;
 
-static inline void
-idx_next(size_t *idx)
-{
-    static const size_t next_add[2] = {1, (size_t)(1 - NUM_CHUNKS)};
-    *idx += next_add[*idx == 1 - NUM_CHUNKS];
-}
-
-static void *sound_procedure(void *hSound);
+static void *sound_mixer(void *hSound);
 static void *sound_output(void *hSound);
 
 void *Internal_PInst_InitSound(struct ProgramInstance *Inst)
 {
-    return NULL;
-
     sound_t *s = calloc(1, sizeof(sound_t));
     if (s == NULL)
     {
@@ -115,111 +128,78 @@ void *Internal_PInst_InitSound(struct ProgramInstance *Inst)
         return NULL;
     }
 
-    s->bActive = true;
-
     // Init PCM Drive
-    unsigned int pcm, tmp, dir;
-    int rate, channels, seconds;
+    int err;
     snd_pcm_hw_params_t *params;
-    snd_pcm_uframes_t frames;
-    char *buff;
-    int buff_size, loops;
-
-    rate = STANDARD_SAMPLE_RATE;
-    channels = DEFAULT_CHANNEL_NUMB;
-    seconds = 0;
+    snd_pcm_sw_params_t *swparams;
+    unsigned channels = DEFAULT_CHANNEL_NUMB;
+    unsigned periods = SOUND_DEVICE_PERIODS;
 
     /* Open the PCM device in playback mode */
-    if (pcm = snd_pcm_open(&s->PCM, PCM_DEVICE,
-                           SND_PCM_STREAM_PLAYBACK, 0) < 0)
-        lvlog(LOGLEVEL_INFO, "ERROR: Can't open \"%s\" PCM device. %s\n",
-              PCM_DEVICE, snd_strerror(pcm));
+    if ((err = snd_pcm_open(&s->PCM, PCM_DEVICE, SND_PCM_STREAM_PLAYBACK, 0)) < 0)
+    {
+        lvlog(LOGLEVEL_ERROR, "Can't open \"%s\" PCM device. %s\n", PCM_DEVICE, snd_strerror(err));
+        free(s);
+        return NULL;
+    }
 
     /* Allocate parameters object and fill it with default values*/
     snd_pcm_hw_params_alloca(&params);
-
     snd_pcm_hw_params_any(s->PCM, params);
 
-    /* Set parameters */
-    if (pcm = snd_pcm_hw_params_set_access(s->PCM, params,
-                                           SND_PCM_ACCESS_RW_INTERLEAVED) < 0)
-        lvlog(LOGLEVEL_INFO, "ERROR: Can't set interleaved mode. %s\n", snd_strerror(pcm));
-
-    if (pcm = snd_pcm_hw_params_set_format(s->PCM, params,
-                                           SND_PCM_FORMAT_S16_LE) < 0)
-        lvlog(LOGLEVEL_INFO, "ERROR: Can't set format. %s\n", snd_strerror(pcm));
-
-    if (pcm = snd_pcm_hw_params_set_channels(s->PCM, params, channels) < 0)
-        lvlog(LOGLEVEL_INFO, "ERROR: Can't set channels number. %s\n", snd_strerror(pcm));
-
-    if (pcm = snd_pcm_hw_params_set_rate_near(s->PCM, params, &rate, 0) < 0)
-        lvlog(LOGLEVEL_INFO, "ERROR: Can't set rate. %s\n", snd_strerror(pcm));
+    /* Set parameters. Period is fraction of target latency. */
+    s->Rate = STANDARD_SAMPLE_RATE;
+    s->PeriodFrames = s->Rate * Inst->SoundLatency / (SOUND_DEVICE_PERIODS + SOUND_RING_PERIODS);
+    if (s->PeriodFrames == 0)
+        s->PeriodFrames = 1;
+
+    if ((err = snd_pcm_hw_params_set_access(s->PCM, params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0
+        || (err = snd_pcm_hw_params_set_format(s->PCM, params, SND_PCM_FORMAT_S16_LE)) < 0
+        || (err = snd_pcm_hw_params_set_channels(s->PCM, params, channels)) < 0
+        || (err = snd_pcm_hw_params_set_rate_resample(s->PCM, params, 0)) < 0
+        || (err = snd_pcm_hw_params_set_rate_near(s->PCM, params, &s->Rate, 0)) < 0
+        || (err = snd_pcm_hw_params_set_period_size_near(s->PCM, params, &s->PeriodFrames, 0)) < 0
+        || (err = snd_pcm_hw_params_set_periods_near(s->PCM, params, &periods, 0)) < 0
+        || (err = snd_pcm_hw_params(s->PCM, params)) < 0)
+    {
+        lvlog(LOGLEVEL_ERROR, "Can't set hardware parameters. %s\n", snd_strerror(err));
+        snd_pcm_close(s->PCM);
+        free(s);
+        return NULL;
+    }
+    snd_pcm_hw_params_get_period_size(params, &s->PeriodFrames, 0);
+    snd_pcm_hw_params_get_buffer_size(params, &s->BufferFrames);
 
-    /* Write parameters */
-    if (pcm = snd_pcm_hw_params(s->PCM, params) < 0)
-        lvlog(LOGLEVEL_INFO, "ERROR: Can't set harware parameters. %s\n", snd_strerror(pcm));
+    /* Start on first period, and wake up whenever a period is free */
+    snd_pcm_sw_params_alloca(&swparams);
+    snd_pcm_sw_params_current(s->PCM, swparams);
+    if ((err = snd_pcm_sw_params_set_start_threshold(s->PCM, swparams, s->PeriodFrames)) < 0
+        || (err = snd_pcm_sw_params_set_avail_min(s->PCM, swparams, s->PeriodFrames)) < 0
+        || (err = snd_pcm_sw_params(s->PCM, swparams)) < 0)
+        lvlog(LOGLEVEL_WARNING, "Can't set software parameters. %s\n", snd_strerror(err));
 
     /* Resume information */
     lvlog(LOGLEVEL_INFO, "PCM name: '%s'\n", snd_pcm_name(s->PCM));
-
     lvlog(LOGLEVEL_INFO, "PCM state: %s\n", snd_pcm_state_name(snd_pcm_state(s->PCM)));
+    lvlog(LOGLEVEL_INFO, "rate: %u Hz, period: %lu frames, buffer: %lu frames (%.1f ms)\n",
+          s->Rate, s->PeriodFrames, s->BufferFrames, s->BufferFrames * 1e3 / s->Rate);
 
-    snd_pcm_hw_params_get_channels(params, &tmp);
-    lvlog(LOGLEVEL_INFO, "channels: %i \n", tmp);
-
-    if (tmp == 1)
-    {
-        lvlog(LOGLEVEL_INFO, "\t(mono)\n");
-    }
-    else if (tmp == 2)
-    {
-        lvlog(LOGLEVEL_INFO, "\t(stereo)\n");
-    }
-
-    snd_pcm_hw_params_get_rate(params, &tmp, 0);
-    lvlog(LOGLEVEL_INFO, "rate: %d bps\n", tmp);
-    lvlog(LOGLEVEL_INFO, "seconds: %d\n", seconds);
-
-    // /* Allocate buffer to hold single period */
-    // snd_pcm_hw_params_get_period_size(params, &frames, 0);
-
-    // buff_size = frames * channels * 2 /* 2 -> sample size */;
-    // s->buff = (char *)malloc(buff_size);
+    s->Accum = malloc(s->PeriodFrames * sizeof(int32_t));
+    s->Period = malloc(s->PeriodFrames * DEFAULT_CHANNEL_NUMB * sizeof(sample_t));
+    s->OutPeriod = malloc(s->PeriodFrames * DEFAULT_CHANNEL_NUMB * sizeof(sample_t));
 
-    // snd_pcm_hw_params_get_period_time(params, &tmp, NULL);
+    // Ring holds rest of latency
+    s->RingFrames = s->PeriodFrames * SOUND_RING_PERIODS;
+    spsc_ring_init(&s->Ring, DEFAULT_CHANNEL_NUMB * sizeof(sample_t), s->RingFrames);
 
-    // for (loops = (seconds * 1000000) / tmp; loops > 0; loops--)
-    // {
-
-    //     if ((pcm = read(0, s->buff, buff_size)) == 0)
-    //     {
-    //         printf("Early end of file.\n");
-    //         return 0;
-    //     }
-
-    //     if ((pcm = snd_pcm_writei(s->pcm_handle, s->buff, frames)) == -EPIPE)
-    //     {
-    //         printf("XRUN.\n");
-    //         snd_pcm_prepare(s->pcm_handle);
-    //     }
-    //     else if (pcm < 0)
-    //     {
-    //         printf("ERROR. Can't write to PCM device. %s\n", snd_strerror(pcm));
-    //     }
-    // }
-
-    // Init queue
-    s->queue_playidx = 0;
-    s->queue_lastidx = 0;
-
-    // Init procedure thread
-    for (size_t i = 0; i < MAX_QUEABLE_WAV_SOURCE; i++)
-    {
-        s->WavData[i].data = NULL;
-    }
-    pthread_create(&s->hProcThr, NULL, sound_procedure, s);
-
-    // Init output thread
+    // Init mixer and output thread
+    s->bActive = true;
+    s->bMixerIdle = true;
+    pthread_mutex_init(&s->Lock, NULL);
+    pthread_cond_init(&s->Cond, NULL);
+    sem_init(&s->SpaceSem, 0, 0);
+    sem_init(&s->DataSem, 0, 0);
+    pthread_create(&s->hMixThr, NULL, sound_mixer, s);
     pthread_create(&s->hOutpThr, NULL, sound_output, s);
 
     lvlog(LOGLEVEL_INFO, "Sound device has successfully initialized. ... \n");
@@ -229,269 +209,434 @@ void *Internal_PInst_InitSound(struct ProgramInstance *Inst)
 
 void Internal_PInst_DeinitSound(void *hSound)
 {
-    return NULL;
-
     lvlog(LOGLEVEL_INFO, "Beginning Sound deinitialization ... \n");
     sound_t *s = hSound;
     if (s == NULL)
         return;
 
-    s->bActive = false;
-
-    pthread_join(s->hProcThr, NULL);
+    pthread_mutex_lock(&s->Lock);
+    __atomic_store_n(&s->bActive, false, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&s->Cond);
+    pthread_mutex_unlock(&s->Lock);
+    sem_post(&s->SpaceSem);
+    sem_post(&s->DataSem);
+    pthread_join(s->hMixThr, NULL);
     pthread_join(s->hOutpThr, NULL);
 
-    snd_pcm_drain(s->PCM);
     snd_pcm_close(s->PCM);
 
+    lvlog(LOGLEVEL_INFO,
+          "Sound stats: %u periods, %u xruns, %u voices played, %u dropped, %.1f us per period mixing\n"
+          "\tRing: %u frames, %u underruns, %u overruns\n",
+          s->NumPeriods, s->NumXruns, s->NumVoicesPlayed, s->NumVoicesDropped,
+          s->NumMixed ? s->MixTimeNs * 1e-3 / s->NumMixed : 0.0,
+          s->Ring.capacity, spsc_ring_underruns(&s->Ring), spsc_ring_overruns(&s->Ring));
+
+    pthread_cond_destroy(&s->Cond);
+    pthread_mutex_destroy(&s->Lock);
+    sem_destroy(&s->SpaceSem);
+    sem_destroy(&s->DataSem);
+    spsc_ring_destroy(&s->Ring);
+    free(s->Accum);
+    free(s->Period);
+    free(s->OutPeriod);
     free(hSound);
     lvlog(LOGLEVEL_INFO, "Sound deinitialized. \n");
 }
 
-void *Internal_PInst_LoadWav(struct ProgramInstance *Inst, char const *Path)
+/*! \brief Import wave in rate of the device, into descriptor followed by samples.
+    \return NULL if out of memory.
+ */
+static wav_rsrc_t *sound_import_wav(struct ProgramInstance *Inst, wav_info_t const *Info)
 {
-    return NULL;
+    sound_t const *s = Inst->hSound;
+    uint32_t rate = s ? s->Rate : STANDARD_SAMPLE_RATE;
+    wav_quality_t quality = Inst->bFastWavResample ? WAV_RESAMPLE_LINEAR : WAV_RESAMPLE_SINC;
 
-    // Read wave header
-    FILE *fp = fopen(Path, "rb");
-    if (fp == NULL) // Not a file.
+    size_t numSamples = wav_import_length(Info, rate);
+    wav_rsrc_t *v = malloc(sizeof(wav_rsrc_t) + numSamples * sizeof(sample_t));
+    if (v == NULL || wav_import(Info, rate, quality, v->data) == false)
     {
-        lvlog(LOGLEVEL_WARNING, "%s is not a file\n", Path);
+        free(v);
         return NULL;
     }
 
-    bool bDATA = false;
-    FMT_t f;
-    DATA_t d;
+    v->numSamples = numSamples;
+    v->samples = v->data;
+    return v;
+}
 
-    struct chunkhead
+void *Internal_PInst_LoadWav(struct ProgramInstance *Inst, char const *Path)
+{
+    int fd = open(Path, O_RDONLY);
+    if (fd == -1) // Not a file.
     {
-        char fmt[4];
-        uint32_t sz;
-    } head;
+        lvlog(LOGLEVEL_WARNING, "%s is not a file\n", Path);
+        return NULL;
+    }
 
-    while (true)
-    {
-        size_t rdcnt = fread(&head, sizeof(head), 1, fp);
-        if (rdcnt != 1)
-        {
-            lvlog("warning: Invalid wave file. %s\n", Path);
-            return NULL;
-        }
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
 
-        lvlog(LOGLEVEL_INFO, "Reading chunk [%c%c%c%c] ... %d bytes\n",
-              head.fmt[0],
-              head.fmt[1],
-              head.fmt[2],
-              head.fmt[3],
-              head.sz);
+    if (addr == MAP_FAILED)
+    {
+        lvlog(LOGLEVEL_WARNING, "Can't read wave file %s\n", Path);
+        return NULL;
+    }
 
-        if (memcmp(head.fmt, "RIFF", 4) == 0)
-        {
-            // discard
-            head.sz = sizeof(RIFF_t) - sizeof(head);
-        }
+    wav_info_t info;
+    wav_rsrc_t *v = NULL;
+    if (wav_parse(addr, st.st_size, &info) == false)
+    {
+        lvlog(LOGLEVEL_WARNING, "Invalid or unsupported wave file. %s\n", Path);
+    }
+    else if ((v = sound_import_wav(Inst, &info)) == NULL)
+    {
+        lvlog(LOGLEVEL_ERROR, "Failed to allocate memory for wave file %s\n", Path);
+    }
+    else
+    {
+        lvlog(LOGLEVEL_INFO, "Loaded wave file %s: %u Hz, %u bits, %u channels into %zu samples\n",
+              Path, info.rate, info.bits, info.channels, v->numSamples);
+    }
 
-        if (memcmp(head.fmt, "fmt ", 4) == 0)
-        {
-            memcpy(&f, &head, sizeof(head));
-            void *dst = &f.fmt_chunkSz + 1;
-            rdcnt = fread(dst, head.sz, 1, fp);
-            uassert(rdcnt == 1);
-            continue;
-        }
+    munmap(addr, st.st_size);
+    return v;
+}
 
-        if (memcmp(head.fmt, "data", 4) == 0)
-        {
-            memcpy(&d, &head, sizeof(head));
-            break;
-        }
+void *Internal_PInst_MapWav(struct ProgramInstance *Inst, void const *Data, size_t Size)
+{
+    struct PackedWaveHeader const *h = Data;
+    if (Size < sizeof(*h) || Size - sizeof(*h) < h->NumSamples * sizeof(sample_t) || h->SampleRate == 0)
+        return NULL;
 
-        // Discard rest of unused chunk data
-        fseek(fp, head.sz, SEEK_CUR);
+    // Packed for another rate. Samples are resampled from pack instead of mapped.
+    sound_t const *s = Inst->hSound;
+    uint32_t rate = s ? s->Rate : STANDARD_SAMPLE_RATE;
+    if (h->SampleRate != rate)
+    {
+        wav_info_t info = {1, 1, 16, h->SampleRate, (unsigned char const *)(h + 1), h->NumSamples};
+        lvlog(LOGLEVEL_DISPLAY, "Resampling packed wave from %u Hz into %u Hz ...\n", h->SampleRate, rate);
+        return sound_import_wav(Inst, &info);
     }
 
-    // Map to system sound format
-    float length = d.data_chunkSz / (double)f.fmt_byteRate;
-    size_t numSample = length * sizeof(sample_t) * STANDARD_SAMPLE_RATE;
-    wav_rsrc_t *v = malloc(numSample * sizeof(sample_t) + sizeof(wav_rsrc_t));
-    sample_t *dst = v->ptr; // Mono channel
-
-    // Read and cache
-    char *source = malloc(d.data_chunkSz);
-    int bytePerSmpl = f.fmt_bitsPerSmpl / 8;
-    uint64_t ByteMask = (1ull << f.fmt_bitsPerSmpl) - 1;
-    int step = bytePerSmpl * f.fmt_numCh;
-    int rd = fread(source, 1, d.data_chunkSz, fp);
-    uassert(source && dst && rd == d.data_chunkSz);
-
-    lvlog(LOGLEVEL_INFO, "Beginning mapping operation ... %s\n", Path);
-
-    // Map to system buffer
-    uint64_t loc, sum, chval;
-    for (size_t i = 0, ch; i < numSample; i++)
-    {
-        // Map to source index
-        loc = i * f.fmt_sampleRate / STANDARD_SAMPLE_RATE;
-        char *beg = source + loc * step;
+    wav_rsrc_t *v = malloc(sizeof(wav_rsrc_t));
+    v->numSamples = h->NumSamples;
+    v->samples = (sample_t const *)(h + 1);
+    return v;
+}
 
-        // Add all values of channel
-        sum = 0;
+void Internal_PInst_StopAllWav(void *hSound)
+{
+    sound_t *s = hSound;
+    if (s == NULL)
+        return;
 
-        for (ch = 0; ch < f.fmt_numCh; ch++)
-        {
-            chval = *(uint64_t *)beg & ByteMask;
-            sum += chval;
-            beg += bytePerSmpl;
-        }
+    pthread_mutex_lock(&s->Lock);
+    s->NumWavData = 0;
+    s->bStopAll = true;
+    pthread_mutex_unlock(&s->Lock);
+}
 
-        // Assign to local
-        dst[i] = sum > SAMPLE_MAXV ? SAMPLE_MAXV : sum < SAMPLE_MINV ? SAMPLE_MINV : sum;
-    }
+void Internal_PInst_PlayWav(void *hSound, void *WavData, float Volume)
+{
+    uassert(WavData);
 
-    free(source);
-    fclose(fp);
+    sound_t *s = hSound;
+    if (s == NULL)
+        return;
 
-    lvlog(LOGLEVEL_INFO, "Successfully loaded wave file %s\n", Path);
+    Volume = Volume < 0 ? 0 : Volume > 1 ? 1 : Volume;
 
-    return v;
+    pthread_mutex_lock(&s->Lock);
+    if (s->bActive && s->NumWavData < MAX_QUEABLE_WAV_SOURCE)
+    {
+        lvlog(LOGLEVEL_DISPLAY, "Queueing wave play for volume %f... \n", Volume);
+        s->WavData[s->NumWavData].data = WavData;
+        s->WavData[s->NumWavData].volume = (int)(Volume * 256.0f);
+        s->NumWavData++;
+        pthread_cond_signal(&s->Cond);
+    }
+    else
+        s->NumVoicesDropped++;
+    pthread_mutex_unlock(&s->Lock);
 }
 
-EStatus PInst_StopAllSound(UProgramInstance *s)
+size_t Internal_PInst_WavBytes(void const *WavData)
 {
+    wav_rsrc_t const *v = WavData;
+    return sizeof(wav_rsrc_t) + v->numSamples * sizeof(sample_t);
 }
 
-void Internal_PInst_PlayWav(void *hSound, void *WavData, float Volume)
+void Internal_PInst_FreeWav(void *WavData)
 {
-    return;
-    uassert(hSound && WavData);
+    free(WavData);
+}
 
+bool Internal_PInst_IsWavPlaying(void *hSound, void const *WavData)
+{
     sound_t *s = hSound;
-    Volume = Volume < 0 ? 0 : Volume > 1 ? 1 : Volume;
+    if (s == NULL)
+        return false;
+
+    bool bPlaying = false;
+    pthread_mutex_lock(&s->Lock);
+    for (size_t i = 0; i < s->NumWavData && !bPlaying; i++)
+        bPlaying = s->WavData[i].data == WavData;
+    for (size_t i = 0; i < s->NumVoices && !bPlaying; i++)
+        bPlaying = s->Voices[i].wav == WavData;
+    pthread_mutex_unlock(&s->Lock);
+    return bPlaying;
+}
+
+//! Start requested voices. Called by mixer thread under lock.
+static void sound_take_requests(sound_t *s)
+{
+    if (s->bStopAll)
+    {
+        s->NumVoices = 0;
+        s->bStopAll = false;
+    }
 
-    // Find empty queue.
-    for (size_t i = 0; i < MAX_QUEABLE_WAV_SOURCE; i++)
+    for (size_t i = 0; i < s->NumWavData; i++)
     {
-        if (s->WavData[i].data == NULL)
+        if (s->NumVoices == MAX_QUEABLE_WAV_SOURCE)
         {
-            lvlog(LOGLEVEL_DISPLAY, "Queueing wave play for volume %f... \n", Volume);
-            s->WavData[i].data = WavData;
-            s->WavData[i].volume = (int)(Volume * 256.0f);
+            s->NumVoicesDropped += s->NumWavData - i;
             break;
         }
+
+        voice_t *v = s->Voices + s->NumVoices++;
+        v->wav = s->WavData[i].data;
+        v->volume = s->WavData[i].volume;
+        v->pos = 0;
+        s->NumVoicesPlayed++;
     }
+    s->NumWavData = 0;
 }
 
-static inline size_t next_chunk(size_t i)
+//! Remove voices which reached their end. Called by mixer thread under lock.
+static void sound_retire_voices(sound_t *s)
+{
+    for (size_t i = 0; i < s->NumVoices;)
+    {
+        if (s->Voices[i].pos < s->Voices[i].wav->numSamples)
+            i++;
+        else
+            s->Voices[i] = s->Voices[--s->NumVoices];
+    }
+}
+
+//! Mix one period of active voices. Voices are read without lock, since only mixer thread changes them.
+static void sound_mix_period(sound_t *s)
+{
+    int32_t *acc = s->Accum;
+    size_t frames = s->PeriodFrames;
+    memset(acc, 0, frames * sizeof(int32_t));
+
+    for (size_t v = 0; v < s->NumVoices; v++)
+    {
+        voice_t *vc = s->Voices + v;
+        sample_t const *src = vc->wav->samples + vc->pos;
+        size_t num = vc->wav->numSamples - vc->pos;
+        num = num < frames ? num : frames;
+
+        mix_accum_s16(acc, src, vc->volume, num);
+        vc->pos += num;
+    }
+
+    // Volume is in 1/256 units.
+    mix_store_s16(s->Period, acc, 8, frames);
+}
+
+/*! \brief Sleep on semaphore while condition holds.
+    \details Waiting flag is raised before condition is checked again, thus the other side which
+        changes condition and then calls sound_notify never misses a sleeping thread.
+ */
+#define SOUND_SLEEP_WHILE(cond, bWaiting, sem)                     \
+    do                                                             \
+    {                                                              \
+        __atomic_store_n(bWaiting, true, __ATOMIC_SEQ_CST);        \
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);                   \
+        if (cond)                                                  \
+            sem_wait(sem);                                         \
+        __atomic_store_n(bWaiting, false, __ATOMIC_SEQ_CST);       \
+    } while (0)
+
+//! Wake the other thread, if it sleeps.
+static inline void sound_notify(bool *bWaiting, sem_t *sem)
 {
-    static const size_t toAdd[] = {1, 1 - NUM_CHUNKS};
-    return i += toAdd[i == NUM_CHUNKS - 1];
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(bWaiting, false, __ATOMIC_SEQ_CST))
+        sem_post(sem);
 }
 
-static void *sound_procedure(void *hSound)
+static inline bool sound_active(sound_t *s)
 {
+    return __atomic_load_n(&s->bActive, __ATOMIC_ACQUIRE);
+}
 
+static void *sound_mixer(void *hSound)
+{
     sound_t *s = hSound;
-    size_t wav_in_idx = 0;
-    static const size_t wav_next_add[2] = {1, 1 - MAX_QUEABLE_WAV_SOURCE};
-    size_t queue_check = 0;
-    wav_rsrc_t *processing;
 
+    pthread_mutex_lock(&s->Lock);
     while (s->bActive)
     {
-        // Look for new wav to proceed ...
-        if ((processing = s->WavData[queue_check].data) == NULL)
+        sound_retire_voices(s);
+        sound_take_requests(s);
+
+        if (s->NumVoices == 0)
         {
-            queue_check += wav_next_add[queue_check == MAX_QUEABLE_WAV_SOURCE - 1];
+            // Every mixed period is in the ring. Output plays them out and stops.
+            __atomic_store_n(&s->bMixerIdle, true, __ATOMIC_RELEASE);
+            sound_notify(&s->bOutputWaiting, &s->DataSem);
+            pthread_cond_wait(&s->Cond, &s->Lock);
             continue;
         }
+        pthread_mutex_unlock(&s->Lock);
 
-        int32_t volume = s->WavData[queue_check].volume;
-        s->WavData[queue_check].data = NULL;
+        // Keep ring filled up to its share of latency.
+        while (sound_active(s) && spsc_ring_readable(&s->Ring) + s->PeriodFrames > s->RingFrames)
+        {
+            sound_notify(&s->bOutputWaiting, &s->DataSem);
+            SOUND_SLEEP_WHILE(sound_active(s) && spsc_ring_readable(&s->Ring) + s->PeriodFrames > s->RingFrames,
+                              &s->bMixerWaiting, &s->SpaceSem);
+        }
 
-        // Process wave ...
-        size_t chunkIdx = s->queue_playidx;
-        sample_t *chnk = &s->queue[chunkIdx].pcm;
-        sample_t *src = processing->ptr;
-        size_t i = 0, num = processing->numSamples;
+        uint64_t begin = Clock_Now();
+        sound_mix_period(s);
+        spsc_ring_write(&s->Ring, s->Period, s->PeriodFrames);
+        s->MixTimeNs += Clock_Now() - begin;
+        s->NumMixed++;
 
-        for (; num--; i++, ++src)
-        {
-            if (i == 1024)
-            {
-                if (chunkIdx == s->queue_lastidx)
-                    s->queue_lastidx = next_chunk(s->queue_lastidx);
-                chunkIdx = next_chunk(chunkIdx);
-                chnk = (s->queue + chunkIdx)->pcm;
-            }
+        // Cleared after the period is in ring, so output never takes idle mixer for late one.
+        __atomic_store_n(&s->bMixerIdle, false, __ATOMIC_RELEASE);
 
-            int32_t val = ((*src * volume) >> 8) + chnk[i];
-            chnk[i] = val > SAMPLE_MAXV ? SAMPLE_MAXV : val < SAMPLE_MINV ? SAMPLE_MINV : val;
-        }
+        pthread_mutex_lock(&s->Lock);
     }
+    pthread_mutex_unlock(&s->Lock);
 
-    lvlog(LOGLEVEL_INFO, "Destroying sound procedure thread ... \n");
+    lvlog(LOGLEVEL_INFO, "Destroying sound mixer thread ... \n");
     return NULL;
 }
 
+//! Recover from xrun or suspend. Returns false if device can't be recovered.
+static bool sound_recover(sound_t *s, int err)
+{
+    if (err == -EPIPE)
+        s->NumXruns++;
+
+    if ((err = snd_pcm_recover(s->PCM, err, 1)) < 0)
+    {
+        lvlog(LOGLEVEL_ERROR, "Can't recover PCM device. %s\n", snd_strerror(err));
+        return false;
+    }
+    return true;
+}
+
+static bool sound_write_period(sound_t *s)
+{
+    sample_t const *pcm = s->OutPeriod;
+    snd_pcm_uframes_t left = s->PeriodFrames;
+
+    while (left)
+    {
+        snd_pcm_sframes_t written = snd_pcm_writei(s->PCM, pcm, left);
+        if (written < 0)
+        {
+            if (!sound_recover(s, written))
+                return false;
+            continue;
+        }
+        pcm += written * DEFAULT_CHANNEL_NUMB;
+        left -= written;
+    }
+    return true;
+}
+
+/*! \brief Take a period from the ring. Missing samples are filled with silence.
+    \return Number of frames taken.
+ */
+static size_t sound_take_period(sound_t *s)
+{
+    // Idle flag is loaded before ring, thus ring holds every period of idle mixer.
+    bool bIdle = __atomic_load_n(&s->bMixerIdle, __ATOMIC_ACQUIRE);
+    size_t want = s->PeriodFrames;
+    if (bIdle)
+    {
+        // Remaining tail isn't an underrun.
+        size_t avail = spsc_ring_readable(&s->Ring);
+        want = avail < want ? avail : want;
+    }
+
+    size_t got = spsc_ring_read(&s->Ring, s->OutPeriod, want);
+    memset(s->OutPeriod + got * DEFAULT_CHANNEL_NUMB, 0, (s->PeriodFrames - got) * DEFAULT_CHANNEL_NUMB * sizeof(sample_t));
+    if (got)
+        sound_notify(&s->bMixerWaiting, &s->SpaceSem);
+    return got;
+}
+
+static bool sound_output_idle(sound_t *s)
+{
+    return __atomic_load_n(&s->bMixerIdle, __ATOMIC_ACQUIRE) && spsc_ring_readable(&s->Ring) == 0;
+}
+
 static void *sound_output(void *hSound)
 {
     sound_t *s = hSound;
 
-    while (s->bActive)
+    // Silence written since the ring has run out. Device is stopped once its buffer holds nothing else.
+    snd_pcm_uframes_t silence = s->BufferFrames;
+    bool bRunning = false;
+
+    while (sound_active(s))
     {
-        if (s->queue_lastidx == s->queue_playidx)
+        if (silence >= s->BufferFrames && sound_output_idle(s))
+        {
+            if (bRunning)
+            {
+                snd_pcm_drop(s->PCM);
+                bRunning = false;
+            }
+            SOUND_SLEEP_WHILE(sound_active(s) && sound_output_idle(s), &s->bOutputWaiting, &s->DataSem);
             continue;
+        }
 
-        printf("Processing sound ... %d / %d\n", s->queue_playidx, s->queue_lastidx);
-        sample_t *rd = s->queue[s->queue_playidx].pcm;
-        s->queue_playidx = next_chunk(s->queue_playidx);
-
-        for (int retry = 5; retry; --retry)
+        if (bRunning == false)
         {
-            int write = snd_pcm_writei(s->PCM, rd, CHUNK_SIZE);
-            if (write == CHUNK_SIZE)
-                break;
-            else if (write == -EPIPE)
-                snd_pcm_prepare(s->PCM);
+            snd_pcm_prepare(s->PCM);
+            bRunning = true;
         }
 
-        memset(rd, 0, CHUNK_SIZE);
+        // Sleep until device has room for a period.
+        int err = snd_pcm_wait(s->PCM, SOUND_WAIT_TIMEOUT_MS);
+        if (err == 0)
+            lvlog(LOGLEVEL_WARNING, "PCM device doesn't respond for %d ms\n", SOUND_WAIT_TIMEOUT_MS);
+
+        silence = sound_take_period(s) ? 0 : silence + s->PeriodFrames;
+
+        if ((err < 0 && !sound_recover(s, err)) || !sound_write_period(s))
+        {
+            // Device is gone. Stop mixer, and discard further requests.
+            lvlog(LOGLEVEL_ERROR, "Sound output is disabled.\n");
+            pthread_mutex_lock(&s->Lock);
+            __atomic_store_n(&s->bActive, false, __ATOMIC_SEQ_CST);
+            s->NumVoices = 0;
+            s->NumWavData = 0;
+            pthread_cond_signal(&s->Cond);
+            pthread_mutex_unlock(&s->Lock);
+            sem_post(&s->SpaceSem);
+            break;
+        }
+        s->NumPeriods++;
     }
 
-    // static int16_t buff[STANDARD_SAMPLE_RATE];
-    // for (size_t i = 0; i < STANDARD_SAMPLE_RATE; i++)
-    // {
-    //     buff[i] = (int16_t)(32767 * sin(i * (M_PI * 2.0 * 440.0 / STANDARD_SAMPLE_RATE)));
-    // }
-
-    // int frames;
-
-    // int16_t *head,
-    //     *const end = buff + STANDARD_SAMPLE_RATE;
-
-    // printf(" EPIPE %d, EBADFD %d, ESTRPIPE %d\n", EPIPE, EBADFD, ESTRPIPE);
-    // while (s->bActive)
-    // {
-    //     head = buff;
-    //     while (s->bActive && head != end)
-    //     {
-    //         int write = snd_pcm_writei(s->PCM, head, end - head);
-
-    //         if (write > 0)
-    //             head += write;
-    //         else if (write == -EPIPE)
-    //         {
-    //             printf("XRUN\n");
-    //             snd_pcm_prepare(s->PCM);
-    //         }
-    //         else
-    //         {
-    //             printf("SND FAILED %d\n", write);
-    //             break;
-    //         }
-    //     }
-    // }
+    if (bRunning)
+        snd_pcm_drop(s->PCM);
 
     lvlog(LOGLEVEL_INFO, "Destroying sound output thread ... \n");
     return NULL;
@@ -0,0 +1,382 @@
+/*! \brief Wave file import
+    \file program-wav.c
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-09
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+ */
+#include "program-wav.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define WAV_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define WAV_SSE2 1
+#endif
+
+// Zero crossings of filter on each side, counted in rate of lower one.
+#define WAV_SINC_ZEROS 24
+// Filter phases between two input samples. Ones between are interpolated.
+#define WAV_SINC_PHASES 128
+// Output samples resampled at once on stack before conversion.
+#define WAV_BLOCK 1024
+
+#define WAV_PI 3.14159265358979323846
+
+/*! \brief Polyphase filter bank. */
+typedef struct wav_sinc
+{
+    // Taps per phase, multiple of 4 to fit vectors.
+    size_t taps;
+    // First tap applies to this many samples before output position.
+    size_t half;
+    // WAV_SINC_PHASES + 1 rows of taps. Last row is first one shifted by a sample.
+    float *table;
+} wav_sinc_t;
+
+static uint16_t wav_le16(unsigned char const *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t wav_le32(unsigned char const *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool wav_supported(wav_info_t const *w)
+{
+    bool bInt = w->format == 1 && (w->bits == 8 || w->bits == 16 || w->bits == 24 || w->bits == 32);
+    bool bFloat = w->format == 3 && w->bits == 32;
+    return (bInt || bFloat) && w->channels > 0 && w->rate > 0;
+}
+
+bool wav_parse(void const *File, size_t Size, wav_info_t *Info)
+{
+    unsigned char const *p = File, *end = p + Size;
+    bool bFmt = false;
+    memset(Info, 0, sizeof *Info);
+
+    if (Size < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4))
+        return false;
+
+    for (p += 12; end - p >= 8;)
+    {
+        uint32_t sz = wav_le32(p + 4);
+        unsigned char const *body = p + 8;
+        size_t avail = end - body;
+
+        if (memcmp(p, "fmt ", 4) == 0 && sz >= 16 && avail >= 16)
+        {
+            Info->format = wav_le16(body);
+            Info->channels = wav_le16(body + 2);
+            Info->rate = wav_le32(body + 4);
+            Info->bits = wav_le16(body + 14);
+
+            // WAVE_FORMAT_EXTENSIBLE keeps actual format in its sub format GUID.
+            if (Info->format == 0xfffe && sz >= 26 && avail >= 26)
+                Info->format = wav_le16(body + 24);
+            bFmt = wav_supported(Info);
+        }
+        else if (memcmp(p, "data", 4) == 0 && bFmt)
+        {
+            Info->data = body;
+            Info->num_frames = (sz < avail ? sz : avail) / ((size_t)Info->channels * (Info->bits / 8));
+            return true;
+        }
+
+        // Chunks are padded to even size.
+        size_t skip = (size_t)sz + (sz & 1);
+        if (skip > avail)
+            break;
+        p = body + skip;
+    }
+    return false;
+}
+
+size_t wav_import_length(wav_info_t const *Info, uint32_t Rate)
+{
+    return (uint64_t)Info->num_frames * Rate / Info->rate;
+}
+
+static inline int32_t wav_read_u8(unsigned char const *p)
+{
+    return p[0] - 128;
+}
+
+static inline int32_t wav_read_s16(unsigned char const *p)
+{
+    return (int16_t)(p[0] | p[1] << 8);
+}
+
+static inline int64_t wav_read_s24(unsigned char const *p)
+{
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+}
+
+static inline int64_t wav_read_s32(unsigned char const *p)
+{
+    return (int32_t)wav_le32(p);
+}
+
+static inline float wav_read_f32(unsigned char const *p)
+{
+    uint32_t u = wav_le32(p);
+    float f;
+    memcpy(&f, &u, sizeof f);
+    return f;
+}
+
+// Sum channels of each frame, and scale into [-1, 1].
+#define WAV_DECODE(SUM_T, READ, BYTES, FULL_SCALE)                  \
+    do                                                              \
+    {                                                               \
+        float const scale = 1.0f / ((float)(FULL_SCALE) * numCh);   \
+        for (size_t i = 0; i < n; i++, p += numCh * (BYTES))        \
+        {                                                           \
+            SUM_T sum = 0;                                          \
+            for (size_t ch = 0; ch < numCh; ch++)                   \
+                sum += READ(p + ch * (BYTES));                      \
+            Out[i] = sum * scale;                                   \
+        }                                                           \
+    } while (0)
+
+//! Decode and downmix every frame into mono.
+static void wav_decode(wav_info_t const *Info, float *Out)
+{
+    unsigned char const *p = Info->data;
+    size_t const n = Info->num_frames, numCh = Info->channels;
+
+    if (Info->format == 3)
+        WAV_DECODE(float, wav_read_f32, 4, 1);
+    else if (Info->bits == 8)
+        WAV_DECODE(int32_t, wav_read_u8, 1, 128);
+    else if (Info->bits == 16)
+        WAV_DECODE(int32_t, wav_read_s16, 2, 32768);
+    else if (Info->bits == 24)
+        WAV_DECODE(int64_t, wav_read_s24, 3, 8388608);
+    else
+        WAV_DECODE(int64_t, wav_read_s32, 4, 2147483648.0);
+}
+
+/*! \brief Interpolate linearly between two input samples around each output position.
+    \details Reads In[0 .. NumIn], thus one sample after input should be readable.
+ */
+static void wav_resample_linear(float const *In, uint32_t InRate, float *Out, size_t Begin, size_t n, uint32_t OutRate)
+{
+    // Output i is at input position i * InRate / OutRate. Stepped exactly as index and remainder.
+    uint64_t at = (uint64_t)Begin * InRate;
+    size_t idx = at / OutRate;
+    uint32_t rem = at % OutRate;
+    uint32_t const step = InRate / OutRate, stepRem = InRate % OutRate;
+    float const invRate = 1.0f / OutRate;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        float frac = rem * invRate;
+        Out[i] = In[idx] + (In[idx + 1] - In[idx]) * frac;
+
+        idx += step;
+        rem += stepRem;
+        if (rem >= OutRate)
+        {
+            rem -= OutRate;
+            idx++;
+        }
+    }
+}
+
+/*! \brief Build windowed sinc filter bank for resampling between given rates.
+    \details Cutoff is at Nyquist frequency of lower rate, thus filter widens on downsampling.
+ */
+static bool wav_sinc_init(wav_sinc_t *f, uint32_t InRate, uint32_t OutRate)
+{
+    double const fc = OutRate < InRate ? (double)OutRate / InRate : 1.0;
+    f->half = (size_t)ceil(WAV_SINC_ZEROS / fc);
+    f->taps = (2 * f->half + 3) & ~(size_t)3;
+    f->table = malloc((WAV_SINC_PHASES + 1) * f->taps * sizeof(float));
+    if (f->table == NULL)
+        return false;
+
+    for (size_t ph = 0; ph <= WAV_SINC_PHASES; ph++)
+    {
+        float *row = f->table + ph * f->taps;
+        double sum = 0;
+
+        for (size_t j = 0; j < f->taps; j++)
+        {
+            // Tap j applies to input sample half - 1 - j before output position.
+            double d = (double)ph / WAV_SINC_PHASES + f->half - 1 - (double)j;
+            double x = d / f->half;
+            double h = 0;
+            if (fabs(x) < 1)
+            {
+                double arg = WAV_PI * fc * d;
+                double sinc = fabs(arg) < 1e-9 ? 1 : sin(arg) / arg;
+                double blackman = 0.42 + 0.5 * cos(WAV_PI * x) + 0.08 * cos(2 * WAV_PI * x);
+                h = sinc * blackman;
+            }
+            row[j] = h;
+            sum += h;
+        }
+
+        // Unity gain on every phase, so constant input stays constant.
+        for (size_t j = 0; j < f->taps; j++)
+            row[j] /= sum;
+    }
+    return true;
+}
+
+//! Dot products of x with two filter phases. n is multiple of 4.
+static inline void wav_dot2(float const *x, float const *h0, float const *h1, size_t n, float *d0, float *d1)
+{
+#if defined(WAV_SSE2)
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+    for (size_t i = 0; i < n; i += 4)
+    {
+        __m128 v = _mm_loadu_ps(x + i);
+        a0 = _mm_add_ps(a0, _mm_mul_ps(v, _mm_loadu_ps(h0 + i)));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(v, _mm_loadu_ps(h1 + i)));
+    }
+
+    // Horizontal sums of both, as {a0 low + high, a1 low + high}
+    __m128 s = _mm_add_ps(_mm_unpacklo_ps(a0, a1), _mm_unpackhi_ps(a0, a1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    *d0 = _mm_cvtss_f32(s);
+    *d1 = _mm_cvtss_f32(_mm_shuffle_ps(s, s, 1));
+#elif defined(WAV_NEON)
+    float32x4_t a0 = vdupq_n_f32(0), a1 = vdupq_n_f32(0);
+    for (size_t i = 0; i < n; i += 4)
+    {
+        float32x4_t v = vld1q_f32(x + i);
+        a0 = vmlaq_f32(a0, v, vld1q_f32(h0 + i));
+        a1 = vmlaq_f32(a1, v, vld1q_f32(h1 + i));
+    }
+
+    float32x2_t s = vpadd_f32(vadd_f32(vget_low_f32(a0), vget_high_f32(a0)),
+                              vadd_f32(vget_low_f32(a1), vget_high_f32(a1)));
+    *d0 = vget_lane_f32(s, 0);
+    *d1 = vget_lane_f32(s, 1);
+#else
+    float a0 = 0, a1 = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        a0 += x[i] * h0[i];
+        a1 += x[i] * h1[i];
+    }
+    *d0 = a0;
+    *d1 = a1;
+#endif
+}
+
+/*! \brief Filter input around each output position, with filter phase of its fraction.
+    \details Reads f->half samples before input, and f->taps samples after it.
+ */
+static void wav_resample_sinc(wav_sinc_t const *f, float const *In, uint32_t InRate, float *Out, size_t Begin, size_t n, uint32_t OutRate)
+{
+    uint64_t at = (uint64_t)Begin * InRate;
+    size_t idx = at / OutRate;
+    uint32_t rem = at % OutRate;
+    uint32_t const step = InRate / OutRate, stepRem = InRate % OutRate;
+    float const phaseScale = (float)WAV_SINC_PHASES / OutRate;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        float phase = rem * phaseScale;
+        size_t ph = (size_t)phase;
+        ph = ph < WAV_SINC_PHASES ? ph : WAV_SINC_PHASES - 1;
+        float const *h0 = f->table + ph * f->taps;
+        float d0, d1;
+
+        wav_dot2(In + idx + 1 - f->half, h0, h0 + f->taps, f->taps, &d0, &d1);
+        Out[i] = d0 + (d1 - d0) * (phase - ph);
+
+        idx += step;
+        rem += stepRem;
+        if (rem >= OutRate)
+        {
+            rem -= OutRate;
+            idx++;
+        }
+    }
+}
+
+//! Convert into 16 bit samples, rounded to nearest and saturated.
+static void wav_store_s16(int16_t *Out, float const *In, size_t n)
+{
+    size_t i = 0;
+#if defined(WAV_SSE2)
+    __m128 const scale = _mm_set1_ps(32768.0f), hi = _mm_set1_ps(32767.0f), lo = _mm_set1_ps(-32768.0f);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128 a = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(In + i), scale), hi), lo);
+        __m128 b = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(In + i + 4), scale), hi), lo);
+        _mm_storeu_si128((__m128i *)(Out + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+#elif defined(WAV_NEON) && defined(__aarch64__)
+    float32x4_t const hi = vdupq_n_f32(32767.0f), lo = vdupq_n_f32(-32768.0f);
+    for (; i + 8 <= n; i += 8)
+    {
+        float32x4_t a = vmaxq_f32(vminq_f32(vmulq_n_f32(vld1q_f32(In + i), 32768.0f), hi), lo);
+        float32x4_t b = vmaxq_f32(vminq_f32(vmulq_n_f32(vld1q_f32(In + i + 4), 32768.0f), hi), lo);
+        vst1q_s16(Out + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(a)), vqmovn_s32(vcvtnq_s32_f32(b))));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        float v = In[i] * 32768.0f;
+        v = v > 32767.0f ? 32767.0f : v < -32768.0f ? -32768.0f : v;
+        Out[i] = (int16_t)lrintf(v);
+    }
+}
+
+bool wav_import(wav_info_t const *Info, uint32_t Rate, wav_quality_t Quality, int16_t *Out)
+{
+    size_t const numIn = Info->num_frames, numOut = wav_import_length(Info, Rate);
+    bool const bResample = Rate != Info->rate;
+    bool const bSinc = bResample && Quality == WAV_RESAMPLE_SINC;
+
+    wav_sinc_t f = {0};
+    if (bSinc && wav_sinc_init(&f, Info->rate, Rate) == false)
+        return false;
+
+    // Filter reads silence around input.
+    size_t const front = bSinc ? f.half : 0, back = bSinc ? f.taps : 1;
+    float *buf = malloc((front + numIn + back) * sizeof(float));
+    if (buf == NULL)
+    {
+        free(f.table);
+        return false;
+    }
+    memset(buf, 0, front * sizeof(float));
+    memset(buf + front + numIn, 0, back * sizeof(float));
+
+    float *mono = buf + front;
+    wav_decode(Info, mono);
+
+    if (bResample == false)
+    {
+        wav_store_s16(Out, mono, numOut);
+    }
+    else
+    {
+        float block[WAV_BLOCK];
+        for (size_t i = 0; i < numOut; i += WAV_BLOCK)
+        {
+            size_t n = numOut - i < WAV_BLOCK ? numOut - i : WAV_BLOCK;
+            if (bSinc)
+                wav_resample_sinc(&f, mono, Info->rate, block, i, n, Rate);
+            else
+                wav_resample_linear(mono, Info->rate, block, i, n, Rate);
+            wav_store_s16(Out + i, block, n);
+        }
+    }
+
+    free(buf);
+    free(f.table);
+    return true;
+}
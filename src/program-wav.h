@@ -0,0 +1,52 @@
+/*! \brief Wave file import into mono 16 bit samples of given rate.
+    \file program-wav.h
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-09
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Decodes 8, 16, 24, 32 bit integer PCM and 32 bit float PCM of any channel count, downmixed
+        into mono. Then resamples to target rate in one of two quality tiers.
+        Linear interpolation is cheap, but aliases above target's Nyquist frequency.
+        Polyphase windowed sinc filters out those frequencies before resampling, with its cutoff
+        lowered to target's Nyquist frequency on downsampling. Filter phases are interpolated linearly.
+        Filter and sample conversion are vectorized with SSE2 on x86 and NEON on ARM.
+        Shared by runtime loader and resource packer, so packed waves sound same as loaded ones.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef enum wav_quality
+{
+    WAV_RESAMPLE_LINEAR,
+    WAV_RESAMPLE_SINC,
+} wav_quality_t;
+
+/*! \brief Format and location of samples in wave file. */
+typedef struct wav_info
+{
+    //! 1 for integer PCM, 3 for float PCM.
+    uint16_t format;
+    uint16_t channels;
+    uint16_t bits;
+    uint32_t rate;
+    unsigned char const *data;
+    size_t num_frames;
+} wav_info_t;
+
+/*! \brief Parse RIFF wave file in memory.
+    \return false if file is invalid or in unsupported format. Data of truncated file is cut at end of file.
+ */
+bool wav_parse(void const *File, size_t Size, wav_info_t *Info);
+
+//! Number of samples wave has once imported in given rate.
+size_t wav_import_length(wav_info_t const *Info, uint32_t Rate);
+
+/*! \brief Decode wave, and resample it to given rate in mono.
+    \param Out Receives wav_import_length() samples.
+    \return false if out of memory.
+ */
+bool wav_import(wav_info_t const *Info, uint32_t Rate, wav_quality_t Quality, int16_t *Out);
@@ -0,0 +1,216 @@
+/*! \brief Verifies and measures software blitter against cairo.
+    \file blitbench.c
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-09
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Usage: blitbench [trials]
+        Random sprites of random alpha are blitted on random whole pixel positions, partly out of
+        destination and optionally clipped, both by the blitter and by cairo with its default filter,
+        as the renderer draws unscaled image. Every channel should be within 1 LSB of cairo's. Exits
+        with non-zero status on mismatch. Then both are measured on sprites of few sizes, in megapixels
+        per second.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cairo.h>
+#include "../src/program-blit.h"
+
+#define BENCH_NS 200000000.0
+#define DST_W 61
+#define DST_H 47
+#define MAX_SPRITE 33
+
+static uint32_t g_rand = 0x1234567u;
+
+static uint32_t next_rand(void)
+{
+    g_rand = g_rand * 1103515245u + 12345u;
+    return g_rand >> 8;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static pixel_plane_t surface_plane(cairo_surface_t *surf)
+{
+    return (pixel_plane_t){
+        .data = (uint32_t *)cairo_image_surface_get_data(surf),
+        .w = cairo_image_surface_get_width(surf),
+        .h = cairo_image_surface_get_height(surf),
+        .stride = cairo_image_surface_get_stride(surf)};
+}
+
+//! Random premultiplied pixel. Fully transparent and opaque ones are frequent, as in sprites.
+static uint32_t random_pixel(void)
+{
+    uint32_t r = next_rand() % 4;
+    uint32_t a = r == 0 ? 0 : r == 1 ? 255 : next_rand() % 256;
+    uint32_t p = a << 24;
+    for (int c = 0; c < 3; c++)
+        p |= (a ? next_rand() % (a + 1) : 0) << (8 * c);
+    return p;
+}
+
+static cairo_surface_t *random_surface(cairo_format_t fmt, int w, int h)
+{
+    cairo_surface_t *surf = cairo_image_surface_create(fmt, w, h);
+    pixel_plane_t p = surface_plane(surf);
+    for (int y = 0; y < h; y++)
+    {
+        uint32_t *row = (uint32_t *)((char *)p.data + y * p.stride);
+        for (int x = 0; x < w; x++)
+            row[x] = fmt == CAIRO_FORMAT_RGB24 ? next_rand() : random_pixel();
+    }
+    cairo_surface_mark_dirty(surf);
+    return surf;
+}
+
+//! Draw sprite centered on given position, same as renderer's cairo path does.
+static void cairo_draw(cairo_surface_t *dst, pixel_rect_t const *clip, cairo_surface_t *src, int cx, int cy)
+{
+    cairo_t *cr = cairo_create(dst);
+    if (clip)
+    {
+        cairo_rectangle(cr, clip->x0, clip->y0, clip->x1 - clip->x0, clip->y1 - clip->y0);
+        cairo_clip(cr);
+    }
+    cairo_translate(cr, cx, cy);
+    cairo_set_source_surface(cr, src, -cairo_image_surface_get_width(src) / 2, -cairo_image_surface_get_height(src) / 2);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_flush(dst);
+}
+
+//! Draw sprite centered on given position, same as renderer's fast path does.
+static void blit_draw(cairo_surface_t *dst, pixel_rect_t const *clip, cairo_surface_t *src, int cx, int cy)
+{
+    pixel_plane_t d = surface_plane(dst), s = surface_plane(src);
+    cairo_surface_flush(dst);
+    blit_over(&d, clip, &s, cx - s.w / 2, cy - s.h / 2, cairo_image_surface_get_format(src) == CAIRO_FORMAT_RGB24);
+    cairo_surface_mark_dirty(dst);
+}
+
+//! Maximum difference of any channel between two planes.
+static int max_diff(cairo_surface_t *a, cairo_surface_t *b)
+{
+    pixel_plane_t pa = surface_plane(a), pb = surface_plane(b);
+    int diff = 0;
+    for (int y = 0; y < pa.h; y++)
+    {
+        uint8_t const *ra = (uint8_t const *)pa.data + y * pa.stride;
+        uint8_t const *rb = (uint8_t const *)pb.data + y * pb.stride;
+        for (int i = 0; i < pa.w * 4; i++)
+        {
+            int d = abs((int)ra[i] - (int)rb[i]);
+            diff = d > diff ? d : diff;
+        }
+    }
+    return diff;
+}
+
+//! Whole pixel position around destination. Renderer leaves subpixel positions to cairo.
+static int random_position(int size)
+{
+    return (int)(next_rand() % (size + 2 * MAX_SPRITE)) - MAX_SPRITE;
+}
+
+static int verify(int trials)
+{
+    cairo_surface_t *ref = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, DST_W, DST_H);
+    cairo_surface_t *out = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, DST_W, DST_H);
+    int failed = 0;
+
+    for (int t = 0; t < trials && !failed; t++)
+    {
+        cairo_format_t fmt = next_rand() % 4 ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+        cairo_surface_t *src = random_surface(fmt, 1 + next_rand() % MAX_SPRITE, 1 + next_rand() % MAX_SPRITE);
+        cairo_surface_t *bg = random_surface(CAIRO_FORMAT_ARGB32, DST_W, DST_H);
+        int cx = random_position(DST_W), cy = random_position(DST_H);
+
+        pixel_rect_t clip = {next_rand() % DST_W, next_rand() % DST_H, 0, 0};
+        clip.x1 = clip.x0 + next_rand() % (DST_W - clip.x0 + 1);
+        clip.y1 = clip.y0 + next_rand() % (DST_H - clip.y0 + 1);
+        pixel_rect_t const *pclip = next_rand() % 2 ? &clip : NULL;
+
+        pixel_plane_t pb = surface_plane(bg), pr = surface_plane(ref), po = surface_plane(out);
+        memcpy(pr.data, pb.data, pb.stride * pb.h);
+        memcpy(po.data, pb.data, pb.stride * pb.h);
+        cairo_surface_mark_dirty(ref);
+        cairo_surface_mark_dirty(out);
+
+        cairo_draw(ref, pclip, src, cx, cy);
+        blit_draw(out, pclip, src, cx, cy);
+
+        int diff = max_diff(ref, out);
+        if (diff > 1)
+        {
+            fprintf(stderr, "trial %d: %s %dx%d sprite at (%d, %d)%s differs from cairo by %d\n", t,
+                    fmt == CAIRO_FORMAT_RGB24 ? "RGB24" : "ARGB32",
+                    cairo_image_surface_get_width(src), cairo_image_surface_get_height(src),
+                    cx, cy, pclip ? " clipped" : "", diff);
+            failed = 1;
+        }
+        cairo_surface_destroy(src);
+        cairo_surface_destroy(bg);
+    }
+
+    cairo_surface_destroy(ref);
+    cairo_surface_destroy(out);
+    return failed;
+}
+
+typedef void (*draw_fn)(cairo_surface_t *dst, pixel_rect_t const *clip, cairo_surface_t *src, int cx, int cy);
+
+static double bench(draw_fn draw, cairo_surface_t *dst, cairo_surface_t *src)
+{
+    int w = cairo_image_surface_get_width(dst), h = cairo_image_surface_get_height(dst);
+    int sw = cairo_image_surface_get_width(src), sh = cairo_image_surface_get_height(src);
+    size_t draws = 0;
+    double begin = now_ns(), elapsed;
+
+    do
+    {
+        for (int rep = 0; rep < 64; rep++, draws++)
+            draw(dst, NULL, src, sw / 2 + next_rand() % (w - sw), sh / 2 + next_rand() % (h - sh));
+        elapsed = now_ns() - begin;
+    } while (elapsed < BENCH_NS);
+
+    return draws * sw * sh / (elapsed * 1e-3);
+}
+
+int main(int argc, char *argv[])
+{
+    int trials = argc > 1 ? atoi(argv[1]) : 20000;
+    static int const sizes[] = {16, 64, 256};
+
+    if (trials <= 0)
+    {
+        fprintf(stderr, "usage: %s [trials]\n", argv[0]);
+        return 1;
+    }
+
+    int failed = verify(trials);
+    printf("Blitter is %s\n", failed ? "NOT within 1 LSB of cairo" : "within 1 LSB of cairo");
+
+    cairo_surface_t *dst = random_surface(CAIRO_FORMAT_ARGB32, 800, 480);
+    printf("Sprite over 800x480:\n");
+    for (size_t i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+        cairo_surface_t *src = random_surface(CAIRO_FORMAT_ARGB32, sizes[i], sizes[i]);
+        printf("  %3dx%-3d: blit %8.1f cairo %8.1f Mpx/s\n", sizes[i], sizes[i],
+               bench(blit_draw, dst, src), bench(cairo_draw, dst, src));
+        cairo_surface_destroy(src);
+    }
+    cairo_surface_destroy(dst);
+    return failed;
+}
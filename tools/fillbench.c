@@ -0,0 +1,224 @@
+/*! \brief Verifies and measures solid rectangle fill against cairo.
+    \file fillbench.c
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-09
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Usage: fillbench [trials]
+        Rectangles of random color and alpha, partly out of destination and optionally clipped,
+        are filled both by fill_rect and by cairo. Every channel should be within 1 LSB of cairo's.
+        Exits with non-zero status on mismatch. Then both are measured on opaque and translucent
+        rectangles of few sizes, in megapixels per second.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cairo.h>
+#include "../src/program-blit.h"
+
+#define BENCH_NS 200000000.0
+#define DST_W 61
+#define DST_H 47
+#define MAX_RECT 40
+
+static uint32_t g_rand = 0x1234567u;
+
+static uint32_t next_rand(void)
+{
+    g_rand = g_rand * 1103515245u + 12345u;
+    return g_rand >> 8;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static pixel_plane_t surface_plane(cairo_surface_t *surf)
+{
+    return (pixel_plane_t){
+        .data = (uint32_t *)cairo_image_surface_get_data(surf),
+        .w = cairo_image_surface_get_width(surf),
+        .h = cairo_image_surface_get_height(surf),
+        .stride = cairo_image_surface_get_stride(surf)};
+}
+
+//! Random premultiplied pixel. Fully transparent and opaque ones are frequent, as in renderer.
+static uint32_t random_pixel(void)
+{
+    uint32_t r = next_rand() % 4;
+    uint32_t a = r == 0 ? 0 : r == 1 ? 255 : next_rand() % 256;
+    uint32_t p = a << 24;
+    for (int c = 0; c < 3; c++)
+        p |= (a ? next_rand() % (a + 1) : 0) << (8 * c);
+    return p;
+}
+
+static cairo_surface_t *random_surface(int w, int h)
+{
+    cairo_surface_t *surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    pixel_plane_t p = surface_plane(surf);
+    for (int y = 0; y < h; y++)
+    {
+        uint32_t *row = (uint32_t *)((char *)p.data + y * p.stride);
+        for (int x = 0; x < w; x++)
+            row[x] = random_pixel();
+    }
+    cairo_surface_mark_dirty(surf);
+    return surf;
+}
+
+//! Fill rectangle with cairo. Color is given as repeated single pixel, so both sides blend same premultiplied value.
+static void cairo_draw(cairo_surface_t *dst, pixel_rect_t const *clip, pixel_rect_t const *rect, uint32_t color)
+{
+    cairo_surface_t *pixel = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+    *(uint32_t *)cairo_image_surface_get_data(pixel) = color;
+    cairo_surface_mark_dirty(pixel);
+
+    cairo_t *cr = cairo_create(dst);
+    if (clip)
+    {
+        cairo_rectangle(cr, clip->x0, clip->y0, clip->x1 - clip->x0, clip->y1 - clip->y0);
+        cairo_clip(cr);
+    }
+    cairo_set_source_surface(cr, pixel, 0, 0);
+    cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_REPEAT);
+    cairo_rectangle(cr, rect->x0, rect->y0, rect->x1 - rect->x0, rect->y1 - rect->y0);
+    cairo_fill(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(pixel);
+    cairo_surface_flush(dst);
+}
+
+static void blit_draw(cairo_surface_t *dst, pixel_rect_t const *clip, pixel_rect_t const *rect, uint32_t color)
+{
+    pixel_plane_t d = surface_plane(dst);
+    cairo_surface_flush(dst);
+    fill_rect(&d, clip, rect, color);
+    cairo_surface_mark_dirty(dst);
+}
+
+//! Maximum difference of any channel between two planes.
+static int max_diff(cairo_surface_t *a, cairo_surface_t *b)
+{
+    pixel_plane_t pa = surface_plane(a), pb = surface_plane(b);
+    int diff = 0;
+    for (int y = 0; y < pa.h; y++)
+    {
+        uint8_t const *ra = (uint8_t const *)pa.data + y * pa.stride;
+        uint8_t const *rb = (uint8_t const *)pb.data + y * pb.stride;
+        for (int i = 0; i < pa.w * 4; i++)
+        {
+            int d = abs((int)ra[i] - (int)rb[i]);
+            diff = d > diff ? d : diff;
+        }
+    }
+    return diff;
+}
+
+//! Random rectangle around destination, possibly empty or inverted.
+static pixel_rect_t random_rect(void)
+{
+    pixel_rect_t r;
+    r.x0 = (int)(next_rand() % (DST_W + 2 * MAX_RECT)) - MAX_RECT;
+    r.y0 = (int)(next_rand() % (DST_H + 2 * MAX_RECT)) - MAX_RECT;
+    r.x1 = r.x0 + (int)(next_rand() % (MAX_RECT + 4)) - 2;
+    r.y1 = r.y0 + (int)(next_rand() % (MAX_RECT + 4)) - 2;
+    return r;
+}
+
+static int verify(int trials)
+{
+    cairo_surface_t *ref = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, DST_W, DST_H);
+    cairo_surface_t *out = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, DST_W, DST_H);
+    int failed = 0;
+
+    for (int t = 0; t < trials && !failed; t++)
+    {
+        cairo_surface_t *bg = random_surface(DST_W, DST_H);
+        pixel_rect_t rect = random_rect();
+        uint32_t color = random_pixel();
+
+        pixel_rect_t clip = {next_rand() % DST_W, next_rand() % DST_H, 0, 0};
+        clip.x1 = clip.x0 + next_rand() % (DST_W - clip.x0 + 1);
+        clip.y1 = clip.y0 + next_rand() % (DST_H - clip.y0 + 1);
+        pixel_rect_t const *pclip = next_rand() % 2 ? &clip : NULL;
+
+        pixel_plane_t pb = surface_plane(bg), pr = surface_plane(ref), po = surface_plane(out);
+        memcpy(pr.data, pb.data, pb.stride * pb.h);
+        memcpy(po.data, pb.data, pb.stride * pb.h);
+        cairo_surface_mark_dirty(ref);
+        cairo_surface_mark_dirty(out);
+
+        // Cairo fills inverted rectangle too, where fill_rect treats it as empty.
+        if (rect.x0 < rect.x1 && rect.y0 < rect.y1)
+            cairo_draw(ref, pclip, &rect, color);
+        blit_draw(out, pclip, &rect, color);
+
+        int diff = max_diff(ref, out);
+        if (diff > 1)
+        {
+            fprintf(stderr, "trial %d: color %08x on (%d, %d)-(%d, %d)%s differs from cairo by %d\n", t, color,
+                    rect.x0, rect.y0, rect.x1, rect.y1, pclip ? " clipped" : "", diff);
+            failed = 1;
+        }
+        cairo_surface_destroy(bg);
+    }
+
+    cairo_surface_destroy(ref);
+    cairo_surface_destroy(out);
+    return failed;
+}
+
+typedef void (*fill_fn)(cairo_surface_t *dst, pixel_rect_t const *clip, pixel_rect_t const *rect, uint32_t color);
+
+static double bench(fill_fn fill, cairo_surface_t *dst, int size, uint32_t color)
+{
+    int w = cairo_image_surface_get_width(dst), h = cairo_image_surface_get_height(dst);
+    size_t fills = 0;
+    double begin = now_ns(), elapsed;
+
+    do
+    {
+        for (int rep = 0; rep < 64; rep++, fills++)
+        {
+            int x = next_rand() % (w - size), y = next_rand() % (h - size);
+            fill(dst, NULL, &(pixel_rect_t){x, y, x + size, y + size}, color);
+        }
+        elapsed = now_ns() - begin;
+    } while (elapsed < BENCH_NS);
+
+    return fills * size * size / (elapsed * 1e-3);
+}
+
+int main(int argc, char *argv[])
+{
+    int trials = argc > 1 ? atoi(argv[1]) : 20000;
+    static int const sizes[] = {16, 64, 256};
+
+    if (trials <= 0)
+    {
+        fprintf(stderr, "usage: %s [trials]\n", argv[0]);
+        return 1;
+    }
+
+    int failed = verify(trials);
+    printf("Rectangle fill is %s\n", failed ? "NOT within 1 LSB of cairo" : "within 1 LSB of cairo");
+
+    cairo_surface_t *dst = random_surface(800, 480);
+    printf("Rectangle over 800x480:\n");
+    for (size_t i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+        printf("  %3dx%-3d: opaque fill %8.1f cairo %8.1f, translucent fill %8.1f cairo %8.1f Mpx/s\n", sizes[i], sizes[i],
+               bench(blit_draw, dst, sizes[i], 0xff336699u), bench(cairo_draw, dst, sizes[i], 0xff336699u),
+               bench(blit_draw, dst, sizes[i], 0x80193350u), bench(cairo_draw, dst, sizes[i], 0x80193350u));
+    }
+    cairo_surface_destroy(dst);
+    return failed;
+}
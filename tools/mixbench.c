@@ -0,0 +1,173 @@
+/*! \brief Verifies and measures sound mixing kernels.
+    \file mixbench.c
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-09
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Usage: mixbench [period frames] [num voices] ...
+        Every kernel set runnable on this CPU is first checked to produce output identical to scalar
+        reference, over random and full scale samples at odd lengths. Exits with non-zero status on
+        mismatch. Then each mixes periods of given voice counts(1, 4, 16 by default) for a while, and
+        reports voices mixed per millisecond. Default period is the mixer's, 60 ms latency in 3 periods
+        at 11 kHz.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/program-mix.h"
+
+#define MAX_KERNELS 8
+#define MAX_VOICES 64
+#define BENCH_NS 200000000.0
+#define VERIFY_MAX_FRAMES 257
+
+static uint32_t g_rand = 0x1234567u;
+
+static uint32_t next_rand(void)
+{
+    g_rand = g_rand * 1103515245u + 12345u;
+    return g_rand >> 8;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void fill_voice(int16_t *v, size_t n, int pattern)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        switch (pattern)
+        {
+        case 0:
+            v[i] = (int16_t)next_rand();
+            break;
+        case 1:
+            v[i] = (next_rand() & 1) ? INT16_MAX : INT16_MIN;
+            break;
+        default:
+            v[i] = (int16_t)(next_rand() % 2001) - 1000;
+            break;
+        }
+    }
+}
+
+//! Mix same voices with kernel and scalar reference, at every length up to max.
+static int verify(mix_kernels_t const *ref, mix_kernels_t const *k)
+{
+    static int16_t voices[4][VERIFY_MAX_FRAMES];
+    static int32_t gains[4];
+    static int32_t acc_ref[VERIFY_MAX_FRAMES], acc[VERIFY_MAX_FRAMES];
+    static int16_t out_ref[VERIFY_MAX_FRAMES], out[VERIFY_MAX_FRAMES];
+
+    for (int pattern = 0; pattern < 3; pattern++)
+    {
+        for (int v = 0; v < 4; v++)
+        {
+            fill_voice(voices[v], VERIFY_MAX_FRAMES, pattern);
+            gains[v] = v == 0 ? 256 : (int32_t)(next_rand() % 257);
+        }
+
+        for (size_t n = 0; n <= VERIFY_MAX_FRAMES; n++)
+        {
+            for (int shift = 0; shift <= 8; shift += 8)
+            {
+                memset(acc_ref, 0, sizeof acc_ref);
+                memset(acc, 0, sizeof acc);
+                for (int v = 0; v < 4; v++)
+                {
+                    ref->accum(acc_ref, voices[v], gains[v], n);
+                    k->accum(acc, voices[v], gains[v], n);
+                }
+                ref->store(out_ref, acc_ref, shift, n);
+                k->store(out, acc, shift, n);
+
+                if (memcmp(acc, acc_ref, n * sizeof *acc) || memcmp(out, out_ref, n * sizeof *out))
+                {
+                    fprintf(stderr, "%s: mismatch against %s, pattern %d, %zu frames, shift %d\n",
+                            k->name, ref->name, pattern, n, shift);
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static double bench(mix_kernels_t const *k, int16_t *const *voices, size_t num_voices, size_t frames, int32_t *acc, int16_t *out)
+{
+    size_t periods = 0;
+    double begin = now_ns(), elapsed;
+
+    do
+    {
+        for (int rep = 0; rep < 64; rep++, periods++)
+        {
+            memset(acc, 0, frames * sizeof *acc);
+            for (size_t v = 0; v < num_voices; v++)
+                k->accum(acc, voices[v], 200, frames);
+            k->store(out, acc, 8, frames);
+        }
+        elapsed = now_ns() - begin;
+    } while (elapsed < BENCH_NS);
+
+    return periods * num_voices / (elapsed * 1e-6);
+}
+
+int main(int argc, char *argv[])
+{
+    mix_kernels_t const *kernels[MAX_KERNELS];
+    size_t num_kernels = mix_get_kernels(kernels, MAX_KERNELS);
+    size_t frames = argc > 1 ? strtoul(argv[1], NULL, 10) : 220;
+    size_t default_voices[] = {1, 4, 16};
+    size_t num_counts = argc > 2 ? (size_t)argc - 2 : 3;
+
+    if (frames == 0)
+    {
+        fprintf(stderr, "usage: %s [period frames] [num voices] ...\n", argv[0]);
+        return 1;
+    }
+
+    int failed = 0;
+    for (size_t k = 1; k < num_kernels; k++)
+        failed |= verify(kernels[0], kernels[k]);
+    printf("Kernels are %s\n", failed ? "NOT identical to scalar reference" : "identical to scalar reference");
+
+    int16_t *voices[MAX_VOICES];
+    for (size_t v = 0; v < MAX_VOICES; v++)
+    {
+        voices[v] = malloc(frames * sizeof(int16_t));
+        fill_voice(voices[v], frames, 0);
+    }
+    int32_t *acc = malloc(frames * sizeof(int32_t));
+    int16_t *out = malloc(frames * sizeof(int16_t));
+
+    printf("%zu frames per period\n", frames);
+    for (size_t c = 0; c < num_counts; c++)
+    {
+        size_t num_voices = argc > 2 ? strtoul(argv[c + 2], NULL, 10) : default_voices[c];
+        if (num_voices == 0 || num_voices > MAX_VOICES)
+        {
+            fprintf(stderr, "number of voices should be in 1..%d\n", MAX_VOICES);
+            return 1;
+        }
+
+        printf("  %2zu voices:", num_voices);
+        for (size_t k = 0; k < num_kernels; k++)
+            printf(" %s %9.0f", kernels[k]->name, bench(kernels[k], voices, num_voices, frames, acc, out));
+        printf(" voices/ms\n");
+    }
+
+    for (size_t v = 0; v < MAX_VOICES; v++)
+        free(voices[v]);
+    free(acc);
+    free(out);
+    return failed;
+}
@@ -0,0 +1,128 @@
+/*! \brief Converts png images into raw image files.
+    \file png2pimg.c
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-04
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Usage: png2pimg <directory or png file> ...
+        Every png file under given directories is decoded, and written next to it as raw image file.
+        Raw image which is newer than its png file is not converted again.
+ */
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <cairo.h>
+#include "../src/core/internal/raw-image.h"
+
+static size_t gNumConverted;
+static size_t gNumSkipped;
+static size_t gNumFailed;
+
+static int convert(char const *Path, struct stat const *PngStat)
+{
+    char RawPath[4096];
+    size_t len = strlen(Path);
+    if (len < 4 || strcmp(Path + len - 4, ".png") != 0 || len + sizeof(RAW_IMAGE_EXTENSION) > sizeof(RawPath))
+        return 0;
+
+    memcpy(RawPath, Path, len - 4);
+    strcpy(RawPath + len - 4, RAW_IMAGE_EXTENSION);
+
+    struct stat RawStat;
+    if (stat(RawPath, &RawStat) == 0 && RawStat.st_mtime >= PngStat->st_mtime)
+    {
+        gNumSkipped++;
+        return 0;
+    }
+
+    cairo_surface_t *img = cairo_image_surface_create_from_png(Path);
+    if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS)
+    {
+        fprintf(stderr, "%s: %s\n", Path, cairo_status_to_string(cairo_surface_status(img)));
+        cairo_surface_destroy(img);
+        gNumFailed++;
+        return 0;
+    }
+    cairo_surface_flush(img);
+
+    cairo_format_t fmt = cairo_image_surface_get_format(img);
+    struct RawImageHeader h;
+    memset(&h, 0, sizeof(h));
+    h.Magic = RAW_IMAGE_MAGIC;
+    h.Version = RAW_IMAGE_VERSION;
+    h.Format = fmt == CAIRO_FORMAT_RGB24 ? RAW_IMAGE_RGB24 : RAW_IMAGE_ARGB32;
+    h.Width = cairo_image_surface_get_width(img);
+    h.Height = cairo_image_surface_get_height(img);
+    h.Stride = cairo_format_stride_for_width(h.Format == RAW_IMAGE_RGB24 ? CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32, h.Width);
+    h.DataOffset = (sizeof(h) + 15) & ~15u;
+
+    if (fmt != CAIRO_FORMAT_ARGB32 && fmt != CAIRO_FORMAT_RGB24)
+    {
+        fprintf(stderr, "%s: unsupported pixel format %d\n", Path, fmt);
+        cairo_surface_destroy(img);
+        gNumFailed++;
+        return 0;
+    }
+
+    FILE *fp = fopen(RawPath, "wb");
+    if (fp == NULL)
+    {
+        perror(RawPath);
+        cairo_surface_destroy(img);
+        gNumFailed++;
+        return 0;
+    }
+
+    static char const pad[16];
+    unsigned char const *row = cairo_image_surface_get_data(img);
+    int srcStride = cairo_image_surface_get_stride(img);
+    bool bOk = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(pad, h.DataOffset - sizeof(h), 1, fp) <= 1;
+
+    for (uint32_t y = 0; bOk && y < h.Height; y++, row += srcStride)
+        bOk = fwrite(row, h.Stride, 1, fp) == 1;
+
+    bOk = fclose(fp) == 0 && bOk;
+    cairo_surface_destroy(img);
+
+    if (bOk == false)
+    {
+        fprintf(stderr, "%s: failed to write\n", RawPath);
+        remove(RawPath);
+        gNumFailed++;
+        return 0;
+    }
+
+    printf("%s -> %s [%u x %u]\n", Path, RawPath, h.Width, h.Height);
+    gNumConverted++;
+    return 0;
+}
+
+static int visit(char const *Path, struct stat const *st, int flag, struct FTW *ftw)
+{
+    (void)ftw;
+    return flag == FTW_F ? convert(Path, st) : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <directory or png file> ...\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (nftw(argv[i], visit, 16, FTW_PHYS) != 0)
+            perror(argv[i]);
+    }
+
+    printf("%zu converted, %zu up to date, %zu failed\n", gNumConverted, gNumSkipped, gNumFailed);
+    return gNumFailed != 0;
+}
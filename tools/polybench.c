@@ -0,0 +1,222 @@
+/*! \brief Verifies and measures polyline stroke from cached path.
+    \file polybench.c
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-09
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Usage: polybench [trials]
+        Random trails are stroked under random transforms, both from path cached once as the line
+        vector loader does, and from points rebuilt on every draw. Both should produce identical
+        pixels. Exits with non-zero status on mismatch. Then both are measured on trails of few
+        point counts, in strokes per second.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <cairo.h>
+
+#define BENCH_NS 200000000.0
+#define DST_W 160
+#define DST_H 120
+#define MAX_POINTS 64
+#define PI 3.14159265358979323846
+
+typedef struct trail
+{
+    double *xy;
+    int num_points;
+    double line_width;
+    cairo_path_t *path;
+} trail_t;
+
+typedef struct transform
+{
+    double x, y;
+    double r;
+    double sx, sy;
+} transform_t;
+
+static uint32_t g_rand = 0x1234567u;
+
+static uint32_t next_rand(void)
+{
+    g_rand = g_rand * 1103515245u + 12345u;
+    return g_rand >> 8;
+}
+
+static double rand_range(double lo, double hi)
+{
+    return lo + (hi - lo) * (next_rand() % 65536) / 65535.0;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//! Random walk around origin. Path is recorded once on scratch context, as line vector loader does.
+static trail_t make_trail(int num_points)
+{
+    trail_t t = {malloc(num_points * 2 * sizeof(double)), num_points, rand_range(0.5, 4.0), NULL};
+    double x = 0, y = 0;
+    for (int i = 0; i < num_points; i++)
+    {
+        x += rand_range(-6, 6);
+        y += rand_range(-6, 6);
+        t.xy[2 * i] = x;
+        t.xy[2 * i + 1] = y;
+    }
+
+    cairo_surface_t *scratch = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+    cairo_t *cr = cairo_create(scratch);
+    cairo_move_to(cr, t.xy[0], t.xy[1]);
+    for (int i = 1; i < num_points; i++)
+        cairo_line_to(cr, t.xy[2 * i], t.xy[2 * i + 1]);
+    t.path = cairo_copy_path(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(scratch);
+    return t;
+}
+
+static void free_trail(trail_t *t)
+{
+    cairo_path_destroy(t->path);
+    free(t->xy);
+}
+
+static void set_transform(cairo_t *cr, transform_t const *tr, trail_t const *t)
+{
+    cairo_matrix_t m;
+    cairo_matrix_init_translate(&m, tr->x, tr->y);
+    cairo_matrix_rotate(&m, tr->r);
+    cairo_matrix_scale(&m, tr->sx, tr->sy);
+    cairo_set_matrix(cr, &m);
+    cairo_set_line_width(cr, t->line_width);
+    cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
+    cairo_set_source_rgba(cr, 0.2, 0.8, 0.4, 0.75);
+}
+
+//! Stroke cached path, same as renderer does.
+static void draw_cached(cairo_t *cr, transform_t const *tr, trail_t const *t)
+{
+    set_transform(cr, tr, t);
+    cairo_new_path(cr);
+    cairo_append_path(cr, t->path);
+    cairo_stroke(cr);
+}
+
+//! Stroke path built from points on every draw.
+static void draw_rebuilt(cairo_t *cr, transform_t const *tr, trail_t const *t)
+{
+    set_transform(cr, tr, t);
+    cairo_new_path(cr);
+    cairo_move_to(cr, t->xy[0], t->xy[1]);
+    for (int i = 1; i < t->num_points; i++)
+        cairo_line_to(cr, t->xy[2 * i], t->xy[2 * i + 1]);
+    cairo_stroke(cr);
+}
+
+static transform_t random_transform(void)
+{
+    return (transform_t){rand_range(0, DST_W), rand_range(0, DST_H), rand_range(-PI, PI),
+                         rand_range(0.25, 3.0), rand_range(0.25, 3.0)};
+}
+
+static int verify(int trials)
+{
+    cairo_surface_t *ref = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, DST_W, DST_H);
+    cairo_surface_t *out = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, DST_W, DST_H);
+    size_t size = cairo_image_surface_get_stride(ref) * DST_H;
+    int failed = 0;
+
+    for (int i = 0; i < trials && !failed; i++)
+    {
+        trail_t t = make_trail(2 + next_rand() % (MAX_POINTS - 1));
+        transform_t tr = random_transform();
+
+        cairo_surface_flush(ref);
+        cairo_surface_flush(out);
+        memset(cairo_image_surface_get_data(ref), 0, size);
+        memset(cairo_image_surface_get_data(out), 0, size);
+        cairo_surface_mark_dirty(ref);
+        cairo_surface_mark_dirty(out);
+
+        cairo_t *cr = cairo_create(ref);
+        draw_rebuilt(cr, &tr, &t);
+        cairo_destroy(cr);
+        cr = cairo_create(out);
+        draw_cached(cr, &tr, &t);
+        cairo_destroy(cr);
+        cairo_surface_flush(ref);
+        cairo_surface_flush(out);
+
+        if (memcmp(cairo_image_surface_get_data(ref), cairo_image_surface_get_data(out), size))
+        {
+            fprintf(stderr, "trial %d: %d points under (%.2f, %.2f) r %.2f s (%.2f, %.2f) differ\n", i,
+                    t.num_points, tr.x, tr.y, tr.r, tr.sx, tr.sy);
+            failed = 1;
+        }
+        free_trail(&t);
+    }
+
+    cairo_surface_destroy(ref);
+    cairo_surface_destroy(out);
+    return failed;
+}
+
+typedef void (*draw_fn)(cairo_t *cr, transform_t const *tr, trail_t const *t);
+
+static double bench(draw_fn draw, cairo_t *cr, trail_t const *t)
+{
+    size_t draws = 0;
+    double begin = now_ns(), elapsed;
+
+    do
+    {
+        for (int rep = 0; rep < 16; rep++, draws++)
+        {
+            transform_t tr = {rand_range(0, 800), rand_range(0, 480), rand_range(-PI, PI), 1.0, 1.0};
+            draw(cr, &tr, t);
+        }
+        elapsed = now_ns() - begin;
+    } while (elapsed < BENCH_NS);
+
+    return draws / (elapsed * 1e-9);
+}
+
+int main(int argc, char *argv[])
+{
+    int trials = argc > 1 ? atoi(argv[1]) : 2000;
+    static int const counts[] = {8, 64, 512};
+
+    if (trials <= 0)
+    {
+        fprintf(stderr, "usage: %s [trials]\n", argv[0]);
+        return 1;
+    }
+
+    int failed = verify(trials);
+    printf("Cached path stroke is %s\n", failed ? "NOT identical to rebuilt one" : "identical to rebuilt one");
+
+    cairo_surface_t *dst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 800, 480);
+    cairo_t *cr = cairo_create(dst);
+    printf("Trail over 800x480:\n");
+    for (size_t i = 0; i < sizeof counts / sizeof *counts; i++)
+    {
+        trail_t t = make_trail(counts[i]);
+        printf("  %3d points: cached %8.0f rebuilt %8.0f strokes/s\n", counts[i],
+               bench(draw_cached, cr, &t), bench(draw_rebuilt, cr, &t));
+        free_trail(&t);
+    }
+    cairo_destroy(cr);
+    cairo_surface_destroy(dst);
+    return failed;
+}
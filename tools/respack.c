@@ -0,0 +1,325 @@
+/*! \brief Compiles resource directories into single resource pack.
+    \file respack.c
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-06
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Usage: respack [-r rate] <pack file> <header file> <directory>[=<path prefix>] ...
+        PNG images are decoded into raw images, and WAV files are resampled to the mixer's rate in mono,
+        with same import code as the runtime loader.
+        Each resource is identified by hash of its path prefix + path relative to directory, which is
+        the path game passes to PInst_LoadResource. Path prefix is directory itself by default.
+        Letter case of path is ignored, thus directory may differ in case from paths game uses.
+        Header file defines hash of every resource as constant.
+ */
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <cairo.h>
+#include "../src/core/internal/raw-image.h"
+#include "../src/core/internal/resource-pack.h"
+#include "../src/program-wav.h"
+
+#define DEFAULT_SAMPLE_RATE 11000
+
+typedef struct pack_item
+{
+    struct ResourcePackEntry entry;
+    char *path;
+    void *data;
+} pack_item_t;
+
+static pack_item_t *gItems;
+static size_t gNumItems;
+static size_t gMaxItems;
+static size_t gNumFailed;
+static uint32_t gSampleRate = DEFAULT_SAMPLE_RATE;
+
+// Directory being walked, and path prefix which replaces it.
+static char const *gRoot;
+static char const *gPrefix;
+
+static bool has_extension(char const *Path, char const *Ext)
+{
+    size_t len = strlen(Path), ext = strlen(Ext);
+    return len > ext && strcasecmp(Path + len - ext, Ext) == 0;
+}
+
+static void *pack_png(char const *Path, size_t *Size)
+{
+    cairo_surface_t *img = cairo_image_surface_create_from_png(Path);
+    cairo_format_t fmt = cairo_image_surface_get_format(img);
+    if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS || (fmt != CAIRO_FORMAT_ARGB32 && fmt != CAIRO_FORMAT_RGB24))
+    {
+        fprintf(stderr, "%s: %s\n", Path, cairo_status_to_string(cairo_surface_status(img)));
+        cairo_surface_destroy(img);
+        return NULL;
+    }
+    cairo_surface_flush(img);
+
+    struct RawImageHeader h;
+    memset(&h, 0, sizeof(h));
+    h.Magic = RAW_IMAGE_MAGIC;
+    h.Version = RAW_IMAGE_VERSION;
+    h.Format = fmt == CAIRO_FORMAT_RGB24 ? RAW_IMAGE_RGB24 : RAW_IMAGE_ARGB32;
+    h.Width = cairo_image_surface_get_width(img);
+    h.Height = cairo_image_surface_get_height(img);
+    h.Stride = cairo_format_stride_for_width(fmt, h.Width);
+    h.DataOffset = (sizeof(h) + 15) & ~15u;
+
+    *Size = h.DataOffset + (size_t)h.Stride * h.Height;
+    unsigned char *out = calloc(1, *Size);
+    memcpy(out, &h, sizeof(h));
+
+    unsigned char const *row = cairo_image_surface_get_data(img);
+    int srcStride = cairo_image_surface_get_stride(img);
+    for (uint32_t y = 0; y < h.Height; y++, row += srcStride)
+        memcpy(out + h.DataOffset + (size_t)y * h.Stride, row, h.Stride);
+
+    cairo_surface_destroy(img);
+    return out;
+}
+
+static void *pack_wav(char const *Path, size_t *Size)
+{
+    FILE *fp = fopen(Path, "rb");
+    if (fp == NULL)
+    {
+        perror(Path);
+        return NULL;
+    }
+
+    // Whole file is parsed in memory, same as runtime loader does.
+    unsigned char *file = NULL;
+    long fileSize = -1;
+    if (fseek(fp, 0, SEEK_END) == 0 && (fileSize = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0)
+        file = malloc(fileSize);
+    bool bRead = file && fread(file, fileSize, 1, fp) == 1;
+    fclose(fp);
+
+    wav_info_t info;
+    if (bRead == false || wav_parse(file, fileSize, &info) == false)
+    {
+        fprintf(stderr, "%s: invalid or unsupported wave file\n", Path);
+        free(file);
+        return NULL;
+    }
+
+    // Resampled offline, thus always in higher quality.
+    size_t numOut = wav_import_length(&info, gSampleRate);
+    *Size = sizeof(struct PackedWaveHeader) + numOut * sizeof(int16_t);
+    struct PackedWaveHeader *h = calloc(1, *Size);
+    if (h == NULL || wav_import(&info, gSampleRate, WAV_RESAMPLE_SINC, (int16_t *)(h + 1)) == false)
+    {
+        fprintf(stderr, "%s: out of memory\n", Path);
+        free(h);
+        free(file);
+        return NULL;
+    }
+    h->SampleRate = gSampleRate;
+    h->NumSamples = numOut;
+
+    free(file);
+    return h;
+}
+
+static int visit(char const *Path, struct stat const *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)ftw;
+    if (flag != FTW_F)
+        return 0;
+
+    uint32_t type;
+    if (has_extension(Path, ".png"))
+        type = RESOURCE_PACK_IMAGE;
+    else if (has_extension(Path, ".wav"))
+        type = RESOURCE_PACK_WAV;
+    else
+        return 0;
+
+    // Path as the game refers it.
+    char const *rel = Path + strlen(gRoot);
+    while (*rel == '/')
+        ++rel;
+    char *name = malloc(strlen(gPrefix) + strlen(rel) + 1);
+    strcpy(name, gPrefix);
+    strcat(name, rel);
+
+    size_t size = 0;
+    void *data = type == RESOURCE_PACK_IMAGE ? pack_png(Path, &size) : pack_wav(Path, &size);
+    if (data == NULL)
+    {
+        gNumFailed++;
+        free(name);
+        return 0;
+    }
+
+    if (gNumItems == gMaxItems)
+    {
+        gMaxItems = gMaxItems ? gMaxItems * 2 : 64;
+        gItems = realloc(gItems, gMaxItems * sizeof(pack_item_t));
+    }
+
+    pack_item_t *it = gItems + gNumItems++;
+    it->entry.Hash = resource_pack_hash(name);
+    it->entry.Type = type;
+    it->entry.Offset = 0;
+    it->entry.Size = size;
+    it->path = name;
+    it->data = data;
+    printf("%s -> %08x [%zu bytes]\n", name, it->entry.Hash, size);
+    return 0;
+}
+
+static int item_cmp(void const *va, void const *vb)
+{
+    pack_item_t const *a = va, *b = vb;
+    return (a->entry.Hash > b->entry.Hash) - (a->entry.Hash < b->entry.Hash);
+}
+
+static bool write_pack(char const *Path)
+{
+    struct ResourcePackHeader h;
+    memset(&h, 0, sizeof(h));
+    h.Magic = RESOURCE_PACK_MAGIC;
+    h.Version = RESOURCE_PACK_VERSION;
+    h.NumEntries = gNumItems;
+    h.EntryOffset = sizeof(h);
+
+    uint64_t offset = sizeof(h) + gNumItems * sizeof(struct ResourcePackEntry);
+    for (size_t i = 0; i < gNumItems; i++)
+    {
+        offset = (offset + 15) & ~(uint64_t)15;
+        gItems[i].entry.Offset = offset;
+        offset += gItems[i].entry.Size;
+    }
+
+    FILE *fp = fopen(Path, "wb");
+    if (fp == NULL)
+    {
+        perror(Path);
+        return false;
+    }
+
+    static char const pad[16];
+    bool bOk = fwrite(&h, sizeof(h), 1, fp) == 1;
+    for (size_t i = 0; bOk && i < gNumItems; i++)
+        bOk = fwrite(&gItems[i].entry, sizeof(struct ResourcePackEntry), 1, fp) == 1;
+    for (size_t i = 0; bOk && i < gNumItems; i++)
+    {
+        long at = ftell(fp);
+        bOk = fwrite(pad, gItems[i].entry.Offset - at, 1, fp) <= 1 &&
+              fwrite(gItems[i].data, gItems[i].entry.Size, 1, fp) == 1;
+    }
+
+    bOk = fclose(fp) == 0 && bOk;
+    if (bOk == false)
+    {
+        fprintf(stderr, "%s: failed to write\n", Path);
+        remove(Path);
+    }
+    return bOk;
+}
+
+static bool write_header(char const *Path)
+{
+    FILE *fp = fopen(Path, "w");
+    if (fp == NULL)
+    {
+        perror(Path);
+        return false;
+    }
+
+    fprintf(fp, "/* Generated by respack. Do not edit. */\n#pragma once\n\n");
+
+    char **names = calloc(gNumItems, sizeof(char *));
+    for (size_t i = 0; i < gNumItems; i++)
+    {
+        // Identifier from path, skipping leading dots and slashes.
+        char const *p = gItems[i].path;
+        while (*p == '.' || *p == '/')
+            ++p;
+        char *id = malloc(strlen(p) + sizeof("RSRC_"));
+        char *o = id + sprintf(id, "RSRC_");
+        for (; *p; ++p)
+            *o++ = isalnum((unsigned char)*p) ? toupper((unsigned char)*p) : '_';
+        *o = '\0';
+
+        bool bDuplicated = false;
+        for (size_t k = 0; k < i && !bDuplicated; k++)
+            bDuplicated = strcmp(names[k], id) == 0;
+
+        fprintf(fp, "%s#define %s 0x%08xu // %s\n", bDuplicated ? "// " : "", id, gItems[i].entry.Hash, gItems[i].path);
+        names[i] = id;
+    }
+
+    for (size_t i = 0; i < gNumItems; i++)
+        free(names[i]);
+    free(names);
+    return fclose(fp) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "r:")) != -1)
+    {
+        if (opt == 'r')
+            gSampleRate = atoi(optarg);
+    }
+
+    if (argc - optind < 3 || gSampleRate == 0)
+    {
+        fprintf(stderr, "Usage: %s [-r rate] <pack file> <header file> <directory>[=<path prefix>] ...\n", argv[0]);
+        return 1;
+    }
+
+    char const *packPath = argv[optind];
+    char const *headerPath = argv[optind + 1];
+    for (int i = optind + 2; i < argc; i++)
+    {
+        char *arg = argv[i];
+        char *eq = strchr(arg, '=');
+        char prefix[4096];
+        if (eq)
+        {
+            *eq = '\0';
+            gPrefix = eq + 1;
+        }
+        else
+        {
+            snprintf(prefix, sizeof(prefix), "%s/", arg);
+            gPrefix = prefix;
+        }
+
+        gRoot = arg;
+        if (nftw(arg, visit, 16, FTW_PHYS) != 0)
+            perror(arg);
+    }
+
+    // Entries are binary searched by hash at runtime.
+    qsort(gItems, gNumItems, sizeof(pack_item_t), item_cmp);
+    for (size_t i = 1; i < gNumItems; i++)
+    {
+        if (gItems[i].entry.Hash == gItems[i - 1].entry.Hash)
+        {
+            fprintf(stderr, "Hash collision: %s, %s\n", gItems[i - 1].path, gItems[i].path);
+            return 1;
+        }
+    }
+
+    if (write_pack(packPath) == false || write_header(headerPath) == false)
+        return 1;
+
+    printf("%zu resources packed into %s, %zu failed\n", gNumItems, packPath, gNumFailed);
+    return gNumFailed != 0;
+}
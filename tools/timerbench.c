@@ -0,0 +1,202 @@
+/*! \brief Compares timing wheel against uEmbedded timer queue.
+    \file timerbench.c
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-07
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Usage: timerbench [num timers] ...
+        For each count(10k and 100k by default), both timers are given same sequence of work:
+        timers are queued with random delay, quarter of them are canceled, then time advances
+        in frame steps until every timer expires. Half of expired timers queue another one, as
+        repeating game timers do.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "../src/core/timer-wheel.h"
+#include "uEmbedded/timer_logic.h"
+
+#define FRAME_MS 8
+#define MAX_DELAY_MS 60000
+
+typedef struct bench_result
+{
+    double add_ns;
+    double cancel_ns;
+    double update_ms;
+    double max_frame_us;
+    size_t num_expired;
+} bench_result_t;
+
+typedef struct bench_ops
+{
+    void (*init)(size_t capacity);
+    void (*destroy)(void);
+    uint64_t (*add)(size_t expires, void (*callback)(void *), void *arg);
+    void (*cancel)(uint64_t handle);
+    void (*update)(size_t now);
+} bench_ops_t;
+
+static size_t g_now;
+static size_t g_expired;
+static bench_ops_t const *g_ops;
+static uint32_t g_rand;
+
+static uint32_t next_rand(void)
+{
+    g_rand = g_rand * 1103515245u + 12345u;
+    return g_rand >> 8;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void on_expire(void *arg)
+{
+    ++g_expired;
+
+    // Requeue until the last second, to keep workload bounded.
+    if ((next_rand() & 1) && g_now + FRAME_MS < MAX_DELAY_MS)
+        g_ops->add(g_now + 1 + next_rand() % (MAX_DELAY_MS - g_now), on_expire, arg);
+}
+
+// Timing wheel
+static timer_wheel_t g_wheel;
+
+static void wheel_init(size_t capacity)
+{
+    timer_wheel_init(&g_wheel, capacity, 0);
+}
+
+static void wheel_destroy(void)
+{
+    timer_wheel_destroy(&g_wheel);
+}
+
+static uint64_t wheel_add(size_t expires, void (*callback)(void *), void *arg)
+{
+    return timer_wheel_add(&g_wheel, expires, callback, arg);
+}
+
+static void wheel_cancel(uint64_t handle)
+{
+    timer_wheel_cancel(&g_wheel, handle);
+}
+
+static void wheel_update(size_t now)
+{
+    timer_wheel_advance(&g_wheel, now);
+}
+
+// uEmbedded timer queue
+static timer_logic_t g_queue;
+static void *g_queue_buff;
+
+static void queue_init(size_t capacity)
+{
+    // Fixed capacity. Reserve room for requeued timers.
+    size_t size = TIMER_ELEM_SIZE * capacity * 2;
+    g_queue_buff = malloc(size);
+    timer_init(&g_queue, g_queue_buff, size);
+}
+
+static void queue_destroy(void)
+{
+    free(g_queue_buff);
+}
+
+static uint64_t queue_add(size_t expires, void (*callback)(void *), void *arg)
+{
+    return (uint64_t)timer_add(&g_queue, expires, callback, arg);
+}
+
+static void queue_cancel(uint64_t handle)
+{
+    timer_erase(&g_queue, (timer_handle_t)handle);
+}
+
+static void queue_update(size_t now)
+{
+    timer_update(&g_queue, now);
+}
+
+static bench_ops_t const g_wheel_ops = {wheel_init, wheel_destroy, wheel_add, wheel_cancel, wheel_update};
+static bench_ops_t const g_queue_ops = {queue_init, queue_destroy, queue_add, queue_cancel, queue_update};
+
+static bench_result_t run(bench_ops_t const *ops, size_t count)
+{
+    bench_result_t r = {0};
+    uint64_t *handles = malloc(count * sizeof *handles);
+    double t;
+
+    g_ops = ops;
+    g_now = 0;
+    g_expired = 0;
+    g_rand = 0x1234567u;
+    ops->init(count);
+
+    t = now_ns();
+    for (size_t i = 0; i < count; ++i)
+        handles[i] = ops->add(1 + next_rand() % MAX_DELAY_MS, on_expire, NULL);
+    r.add_ns = (now_ns() - t) / count;
+
+    t = now_ns();
+    for (size_t i = 0; i < count; i += 4)
+        ops->cancel(handles[i]);
+    r.cancel_ns = (now_ns() - t) / ((count + 3) / 4);
+
+    for (g_now = FRAME_MS; g_now <= MAX_DELAY_MS + FRAME_MS; g_now += FRAME_MS)
+    {
+        t = now_ns();
+        ops->update(g_now);
+        t = now_ns() - t;
+
+        r.update_ms += t * 1e-6;
+        if (t * 1e-3 > r.max_frame_us)
+            r.max_frame_us = t * 1e-3;
+    }
+
+    r.num_expired = g_expired;
+    ops->destroy();
+    free(handles);
+    return r;
+}
+
+static void report(char const *name, bench_result_t const *r)
+{
+    printf("  %-8s add %7.1f ns, cancel %7.1f ns, update %8.2f ms total, %8.1f us worst frame, %zu expired\n",
+           name, r->add_ns, r->cancel_ns, r->update_ms, r->max_frame_us, r->num_expired);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t defaults[] = {10000, 100000};
+    size_t num_counts = argc > 1 ? (size_t)argc - 1 : 2;
+
+    for (size_t i = 0; i < num_counts; ++i)
+    {
+        size_t count = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : defaults[i];
+        if (count == 0)
+        {
+            fprintf(stderr, "usage: %s [num timers] ...\n", argv[0]);
+            return 1;
+        }
+
+        bench_result_t wheel = run(&g_wheel_ops, count);
+        bench_result_t queue = run(&g_queue_ops, count);
+
+        printf("%zu timers, %d ms frames over %d ms\n", count, FRAME_MS, MAX_DELAY_MS);
+        report("wheel", &wheel);
+        report("queue", &queue);
+    }
+
+    return 0;
+}
@@ -0,0 +1,255 @@
+/*! \brief Verifies and measures wave import.
+    \file wavbench.c
+    \author Seungwoo Kang (ki6080@gmail.com)
+    \version 0.1
+    \date 2019-12-09
+    \copyright Copyright (c) 2019. Seungwoo Kang. All rights reserved.
+
+    \details
+        Usage: wavbench [rate]
+        Waves are synthesized in memory, and imported to given rate(mixer's 11000 Hz by default).
+        Every sample format and few channel counts are first checked to decode within one step of
+        exact downmix at same rate. Exits with non-zero status on mismatch.
+        Then each resampling quality is measured from few common rates, by signal to noise ratio of
+        a tone well below target's Nyquist frequency, and by level of a tone above it which should
+        have been filtered out. At last, import speed of 16 bit stereo is reported in times of real time.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../src/program-wav.h"
+
+#define BENCH_NS 500000000.0
+#define BENCH_SECONDS 10
+// Edges are skipped on measuring, where filter meets silence around wave.
+#define EDGE_SECONDS 0.1
+#define PI 3.14159265358979323846
+
+typedef double (*signal_fn)(double t, int ch, void *arg);
+
+static uint32_t g_rand = 0x1234567u;
+
+static uint32_t next_rand(void)
+{
+    g_rand = g_rand * 1103515245u + 12345u;
+    return g_rand >> 8;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void put_le(unsigned char *p, uint32_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = v >> (8 * i);
+}
+
+//! Quantize [-1, 1] into integer of given bits.
+static int32_t quantize(double v, int bits)
+{
+    double full = ldexp(1, bits - 1);
+    double q = floor(v * full + 0.5);
+    return q > full - 1 ? full - 1 : q < -full ? -full : q;
+}
+
+/*! \brief Synthesize wave file in memory.
+    \param Exact Receives exact mono downmix of stored samples, if not NULL.
+ */
+static unsigned char *make_wav(int format, int bits, int channels, uint32_t rate, size_t frames,
+                               signal_fn fn, void *arg, size_t *size, double *Exact)
+{
+    size_t bytes = bits / 8, dataSize = frames * channels * bytes;
+    *size = 44 + dataSize;
+    unsigned char *w = malloc(*size);
+
+    memcpy(w, "RIFF", 4);
+    put_le(w + 4, *size - 8, 4);
+    memcpy(w + 8, "WAVEfmt ", 8);
+    put_le(w + 16, 16, 4);
+    put_le(w + 20, format, 2);
+    put_le(w + 22, channels, 2);
+    put_le(w + 24, rate, 4);
+    put_le(w + 28, rate * channels * bytes, 4);
+    put_le(w + 32, channels * bytes, 2);
+    put_le(w + 34, bits, 2);
+    memcpy(w + 36, "data", 4);
+    put_le(w + 40, dataSize, 4);
+
+    unsigned char *p = w + 44;
+    for (size_t i = 0; i < frames; i++)
+    {
+        double sum = 0;
+        for (int ch = 0; ch < channels; ch++, p += bytes)
+        {
+            double v = fn((double)i / rate, ch, arg);
+            if (format == 3)
+            {
+                float f = v;
+                memcpy(p, &f, 4);
+                sum += f;
+            }
+            else
+            {
+                int32_t q = quantize(v, bits);
+                put_le(p, bits == 8 ? (uint32_t)(q + 128) : (uint32_t)q, bytes);
+                sum += q / ldexp(1, bits - 1);
+            }
+        }
+        if (Exact)
+            Exact[i] = sum / channels;
+    }
+    return w;
+}
+
+static int16_t *import(unsigned char const *w, size_t size, uint32_t rate, wav_quality_t q, size_t *n)
+{
+    wav_info_t info;
+    if (wav_parse(w, size, &info) == false)
+        return NULL;
+    *n = wav_import_length(&info, rate);
+    int16_t *out = malloc(*n * sizeof(int16_t) + 1);
+    if (wav_import(&info, rate, q, out) == false)
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static double sig_noise(double t, int ch, void *arg)
+{
+    (void)t;
+    (void)arg;
+    return (int32_t)(next_rand() % 65536 - 32768) / 32768.0 * (ch & 1 ? 0.5 : 1.0);
+}
+
+static double sig_tone(double t, int ch, void *arg)
+{
+    (void)ch;
+    return 0.5 * sin(2 * PI * *(double *)arg * t);
+}
+
+//! Check every format decodes within one step of exact downmix.
+static int verify(uint32_t rate)
+{
+    static int const formats[][2] = {{1, 8}, {1, 16}, {1, 24}, {1, 32}, {3, 32}};
+    static int const channels[] = {1, 2, 6};
+    size_t const frames = 4099;
+    double *exact = malloc(frames * sizeof(double));
+    int failed = 0;
+
+    for (size_t f = 0; f < sizeof formats / sizeof *formats; f++)
+    {
+        for (size_t c = 0; c < sizeof channels / sizeof *channels; c++)
+        {
+            size_t size, n;
+            unsigned char *w = make_wav(formats[f][0], formats[f][1], channels[c], rate, frames, sig_noise, NULL, &size, exact);
+            int16_t *out = import(w, size, rate, WAV_RESAMPLE_SINC, &n);
+
+            double maxErr = out && n == frames ? 0 : INFINITY;
+            for (size_t i = 0; out && i < n && i < frames; i++)
+                maxErr = fmax(maxErr, fabs(out[i] - exact[i] * 32768.0));
+
+            // 16 bit mono at same rate should pass through untouched.
+            bool bExact = formats[f][0] == 1 && formats[f][1] == 16 && channels[c] == 1;
+            if (maxErr > (bExact ? 0 : 1))
+            {
+                fprintf(stderr, "format %d, %d bits, %d channels: error %g steps\n", formats[f][0], formats[f][1], channels[c], maxErr);
+                failed = 1;
+            }
+            free(out);
+            free(w);
+        }
+    }
+    free(exact);
+    return failed;
+}
+
+/*! \brief Import tone, and measure its output against ideal one.
+    \return Ratio of error to ideal in dB, or level of output if tone should be filtered out.
+ */
+static double measure(uint32_t from, uint32_t rate, wav_quality_t q, double freq, bool bFiltered)
+{
+    size_t size, n;
+    unsigned char *w = make_wav(3, 32, 1, from, from, sig_tone, &freq, &size, NULL);
+    int16_t *out = import(w, size, rate, q, &n);
+    free(w);
+    if (out == NULL)
+        return NAN;
+
+    double sig = 0, err = 0;
+    for (size_t i = EDGE_SECONDS * rate; i + EDGE_SECONDS * rate < n; i++)
+    {
+        double ideal = bFiltered ? 0 : 0.5 * sin(2 * PI * freq * i / rate) * 32768.0;
+        double s = 0.5 * 32768.0 * sin(2 * PI * freq * i / rate);
+        sig += s * s;
+        err += (out[i] - ideal) * (out[i] - ideal);
+    }
+    free(out);
+    return 10 * log10(err / sig);
+}
+
+static double bench(uint32_t rate, wav_quality_t q)
+{
+    static double const freq = 440;
+    size_t size, n, runs = 0;
+    unsigned char *w = make_wav(1, 16, 2, 44100, 44100 * BENCH_SECONDS, sig_tone, (void *)&freq, &size, NULL);
+    double begin = now_ns(), elapsed;
+
+    do
+    {
+        free(import(w, size, rate, q, &n));
+        runs++;
+        elapsed = now_ns() - begin;
+    } while (elapsed < BENCH_NS);
+
+    free(w);
+    return runs * BENCH_SECONDS / (elapsed * 1e-9);
+}
+
+int main(int argc, char *argv[])
+{
+    static uint32_t const sources[] = {8000, 22050, 44100, 48000};
+    static char const *const names[] = {"linear", "sinc"};
+    uint32_t rate = argc > 1 ? strtoul(argv[1], NULL, 10) : 11000;
+
+    if (rate == 0)
+    {
+        fprintf(stderr, "usage: %s [rate]\n", argv[0]);
+        return 1;
+    }
+
+    int failed = verify(rate);
+    printf("Decoding is %s\n", failed ? "NOT within one step of exact downmix" : "within one step of exact downmix");
+
+    // Tones at quarter of lower Nyquist frequency, and beyond target's one.
+    printf("Resampling to %u Hz: SNR of passed tone, level of filtered tone\n", rate);
+    for (size_t s = 0; s < sizeof sources / sizeof *sources; s++)
+    {
+        uint32_t from = sources[s];
+        double pass = (from < rate ? from : rate) / 8.0;
+        double stop = rate * 0.65;
+
+        printf("  %5u Hz:", from);
+        for (int q = WAV_RESAMPLE_LINEAR; q <= WAV_RESAMPLE_SINC; q++)
+        {
+            printf(" %s %6.1f dB", names[q], -measure(from, rate, q, pass, false));
+            if (stop < from / 2.0)
+                printf(" %6.1f dB", measure(from, rate, q, stop, true));
+        }
+        printf("\n");
+    }
+
+    printf("Importing 16 bit stereo from 44100 Hz:");
+    for (int q = WAV_RESAMPLE_LINEAR; q <= WAV_RESAMPLE_SINC; q++)
+        printf(" %s %6.0fx", names[q], bench(rate, q));
+    printf(" real time\n");
+    return failed;
+}